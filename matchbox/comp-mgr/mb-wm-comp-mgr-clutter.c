@@ -22,25 +22,25 @@
 #include "mb-wm-client.h"
 #include "mb-wm-comp-mgr.h"
 #include "mb-wm-comp-mgr-clutter.h"
+#include "mb-wm-comp-mgr-shadow.h"
 #include "mb-wm-theme.h"
 
 #include <clutter/clutter.h>
 #include <clutter/x11/clutter-x11.h>
 #if HAVE_CLUTTER_GLX
 #include <clutter/glx/clutter-glx-texture-pixmap.h>
+#include <GL/gl.h>
 #endif
 #include <X11/Xresource.h>
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xcomposite.h>
 
-#include <math.h>
-
 #define SHADOW_RADIUS 4
 #define SHADOW_OPACITY	0.9
 #define SHADOW_OFFSET_X	(-SHADOW_RADIUS)
 #define SHADOW_OFFSET_Y	(-SHADOW_RADIUS)
 
-#define MAX_TILE_SZ 16 	/* make sure size/2 < MAX_TILE_SZ */
+#define MAX_TILE_SZ MB_WM_COMP_MGR_SHADOW_TILE_SZ
 #define WIDTH  (3*MAX_TILE_SZ)
 #define HEIGHT (3*MAX_TILE_SZ)
 
@@ -51,9 +51,53 @@ tidy_texture_frame_new (ClutterTexture *texture,
 			gint            right,
 			gint            bottom);
 
+static ClutterActor *
+mb_wm_shaped_texture_new (ClutterTexture *texture);
+
+static void
+mb_wm_shaped_texture_set_shape (ClutterActor *self,
+				XRectangle   *rects,
+				int           n_rects);
+
 static unsigned char *
 mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ();
 
+/*
+ * An animation run by the master clock of the manager; see
+ * mb_wm_comp_mgr_clutter_animation_new ().
+ */
+typedef struct MBWMCompMgrClutterAnimation
+{
+  MBWMCompMgrClutter * cmgr;
+  ClutterAlpha       * alpha;
+  unsigned long        duration;
+  long                 start;    /* clock time, -1 until the first frame */
+  Bool                 ramp_dec;
+
+  void               (*completed) (void *data);
+  void               * data;
+} MBWMCompMgrClutterAnimation;
+
+static MBWMCompMgrClutterAnimation *
+mb_wm_comp_mgr_clutter_animation_new (MBWMCompMgrClutter * cmgr,
+				      unsigned long        duration,
+				      Bool                 ramp_dec,
+				      void               (*completed) (void *),
+				      void               * data);
+
+static void
+mb_wm_comp_mgr_clutter_animation_start (MBWMCompMgrClutterAnimation *anim);
+
+static void
+mb_wm_comp_mgr_clutter_animation_free (MBWMCompMgrClutterAnimation *anim);
+
+static void
+mb_wm_comp_mgr_clutter_invalidate_redraw (MBWMCompMgrClutter *cmgr);
+
+static void
+mb_wm_comp_mgr_clutter_add_redraw_damage (MBWMCompMgrClutter *cmgr,
+					  XRectangle         *rect);
+
 static void
 mb_wm_comp_mgr_clutter_add_actor (MBWMCompMgrClutter *,
 				  MBWMCompMgrClutterClient *);
@@ -65,12 +109,17 @@ struct _MBWMCompMgrClutterClientPrivate
 {
   ClutterActor          * actor;  /* Overall actor */
   ClutterActor          * texture; /* The texture part of our actor */
+  ClutterActor          * shape;   /* Paints the texture of shaped clients */
   Pixmap                  pixmap;
   int                     pxm_width;
   int                     pxm_height;
   int                     pxm_depth;
   unsigned int            flags;
   Damage                  damage;
+
+  /* Texture memory accounted to us, and when we were last painted */
+  unsigned long           texture_bytes;
+  unsigned long           last_used;
 };
 
 static void
@@ -84,7 +133,17 @@ mb_wm_comp_mgr_clutter_client_repair_real (MBWMCompMgrClient * client);
 
 static void
 mb_wm_comp_mgr_clutter_client_configure_real (MBWMCompMgrClient * client,
-                                              MBWMGeometry * geometry);
+                                              MBGeometry   * geometry);
+
+static void
+mb_wm_comp_mgr_clutter_client_move_real (MBWMCompMgrClient * client,
+					 MBGeometry        * geometry);
+
+static void
+mb_wm_comp_mgr_clutter_client_release_real (MBWMCompMgrClient * client);
+
+static unsigned long
+mb_wm_comp_mgr_clutter_client_resource_bytes_real (MBWMCompMgrClient * client);
 
 static void
 mb_wm_comp_mgr_clutter_client_class_init (MBWMObjectClass *klass)
@@ -95,12 +154,172 @@ mb_wm_comp_mgr_clutter_client_class_init (MBWMObjectClass *klass)
   c_klass->hide       = mb_wm_comp_mgr_clutter_client_hide_real;
   c_klass->repair     = mb_wm_comp_mgr_clutter_client_repair_real;
   c_klass->configure  = mb_wm_comp_mgr_clutter_client_configure_real;
+  c_klass->move       = mb_wm_comp_mgr_clutter_client_move_real;
+  c_klass->release    = mb_wm_comp_mgr_clutter_client_release_real;
+  c_klass->resource_bytes = mb_wm_comp_mgr_clutter_client_resource_bytes_real;
 
 #if MBWM_WANT_DEBUG
   klass->klass_name = "MBWMCompMgrClutterClient";
 #endif
 }
 
+/*
+ * The depth of the window backing our client; a frame only has the depth of
+ * the client window for argb32 clients.
+ */
+static int
+mb_wm_comp_mgr_clutter_client_pixmap_depth (MBWMCompMgrClient *client)
+{
+  MBWindowManagerClient *wm_client = client->wm_client;
+  MBWindowManager       *wm        = client->wm;
+
+  if (wm_client->xwin_frame && !client->is_argb32)
+    return DefaultDepth (wm->xdpy, wm->xscreen);
+
+  return wm_client->window->depth;
+}
+
+/*
+ * Whether the client is currently on the screen; the textures of clients
+ * which are not can be released.
+ */
+static Bool
+mb_wm_comp_mgr_clutter_client_is_visible (MBWMCompMgrClutterClient *cclient)
+{
+  ClutterActor * actor = cclient->priv->actor;
+  ClutterActor * parent;
+
+  if (!actor || !CLUTTER_ACTOR_IS_VISIBLE (actor))
+    return False;
+
+  /* Clients on other desktops sit in hidden desktop groups */
+  parent = clutter_actor_get_parent (actor);
+
+  return (!parent || CLUTTER_ACTOR_IS_VISIBLE (parent));
+}
+
+/*
+ * Accounts for the client texture taking bytes of memory from now on, and
+ * marks it as the most recently used one.
+ */
+static void
+mb_wm_comp_mgr_clutter_client_account_texture (MBWMCompMgrClient *client,
+					       unsigned long      bytes)
+{
+  MBWMCompMgrClutterClient  * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT(client);
+  MBWMCompMgrClutterPrivate * mpriv   =
+    MB_WM_COMP_MGR_CLUTTER (client->wm->comp_mgr)->priv;
+
+  mpriv->texture_bytes -= cclient->priv->texture_bytes;
+  mpriv->texture_bytes += bytes;
+
+  if (mpriv->texture_bytes > mpriv->texture_peak)
+    mpriv->texture_peak = mpriv->texture_bytes;
+
+  cclient->priv->texture_bytes = bytes;
+  cclient->priv->last_used     = ++mpriv->texture_clock;
+}
+
+/*
+ * Releases the backing pixmap and the texture of the client; both get
+ * fetched again once the client is on the screen.
+ */
+static void
+mb_wm_comp_mgr_clutter_client_release_texture (MBWMCompMgrClient *client)
+{
+  MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT(client);
+  MBWindowManager          * wm      = client->wm;
+  static const guint32       empty   = 0;
+
+  MBWM_NOTE (COMPOSITOR, "releasing %lu bytes of texture for %x",
+	     cclient->priv->texture_bytes, client->wm_client->window->xwindow);
+
+  if (cclient->priv->pixmap)
+    {
+      XFreePixmap (wm->xdpy, cclient->priv->pixmap);
+      cclient->priv->pixmap = None;
+    }
+
+  /* Swap the texture for a single pixel, which frees the GL texture */
+  if (cclient->priv->texture_bytes)
+    clutter_texture_set_from_rgb_data (CLUTTER_TEXTURE (cclient->priv->texture),
+				       (const guchar *) &empty,
+				       TRUE, 1, 1, 4, 4, 0, NULL);
+
+  mb_wm_comp_mgr_clutter_client_account_texture (client, 0);
+}
+
+/*
+ * Releases the texture of a client which is not on the screen, whatever the
+ * budget; show() fetches it again.
+ */
+static void
+mb_wm_comp_mgr_clutter_client_release_real (MBWMCompMgrClient *client)
+{
+  MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT(client);
+
+  if (!cclient->priv->pixmap && !cclient->priv->texture_bytes)
+    return;
+
+  if ((cclient->priv->flags & MBWMCompMgrClutterClientEffectRunning) ||
+      mb_wm_comp_mgr_clutter_client_is_visible (cclient))
+    return;
+
+  mb_wm_comp_mgr_clutter_client_release_texture (client);
+}
+
+static unsigned long
+mb_wm_comp_mgr_clutter_client_resource_bytes_real (MBWMCompMgrClient *client)
+{
+  return MB_WM_COMP_MGR_CLUTTER_CLIENT(client)->priv->texture_bytes;
+}
+
+/*
+ * Releases the textures of clients that are not on the screen, least
+ * recently used first, until the texture memory fits in the budget. The
+ * candidates come from the client list rather than the stack, since
+ * iconized clients are taken off the stack.
+ */
+static void
+mb_wm_comp_mgr_clutter_enforce_texture_budget (MBWMCompMgr *mgr)
+{
+  MBWMCompMgrClutterPrivate * priv = MB_WM_COMP_MGR_CLUTTER (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
+
+  if (!priv->texture_budget)
+    return;
+
+  while (priv->texture_bytes > priv->texture_budget)
+    {
+      MBWindowManagerClient * victim = NULL;
+      unsigned long           oldest = 0;
+      MBWMList              * l;
+
+      for (l = wm->clients; l; l = l->next)
+	{
+	  MBWindowManagerClient    * c  = l->data;
+	  MBWMCompMgrClutterClient * cc =
+	    MB_WM_COMP_MGR_CLUTTER_CLIENT (c->cm_client);
+
+	  if (!cc || !cc->priv->texture_bytes ||
+	      (cc->priv->flags & MBWMCompMgrClutterClientEffectRunning) ||
+	      mb_wm_comp_mgr_clutter_client_is_visible (cc))
+	    continue;
+
+	  if (!victim || cc->priv->last_used < oldest)
+	    {
+	      victim = c;
+	      oldest = cc->priv->last_used;
+	    }
+	}
+
+      if (!victim)
+	break;
+
+      mb_wm_comp_mgr_clutter_client_release_texture (victim->cm_client);
+    }
+}
+
 /*
  * Fetch the entire texture for our client
  */
@@ -112,33 +331,6 @@ mb_wm_comp_mgr_clutter_fetch_texture (MBWMCompMgrClient *client)
   MBWindowManager           *wm        = client->wm;
   MBGeometry                 geom;
   Window                     xwin;
-  Window root;
-  int                        x, y, w, h, bw, depth;
-#ifdef HAVE_XEXT
-  /* Stuff we need for shaped windows */
-  XRectangle                *shp_rect;
-  int                        shp_order;
-  int                        shp_count;
-  int                        i;
-
-  /*
-   * This is square of 32-bit comletely transparent values we use to
-   * clear bits of the texture from shaped windows; the size is a compromise
-   * between how much memory we want to allocate and how much tiling we are
-   * happy with.
-   *
-   * Make this power of 2 for efficient operation
-   */
-#define SHP_CLEAR_SIZE 4
-  static int clear_init = 0;
-  static guint32 clear_data[SHP_CLEAR_SIZE * SHP_CLEAR_SIZE];
-
-  if  (!clear_init)
-    {
-      memset (&clear_data, 0, sizeof (clear_data));
-      clear_init = 1;
-    }
-#endif
 
   if (!(cclient->priv->flags & MBWMCompMgrClutterClientMapped))
     return;
@@ -154,92 +346,56 @@ mb_wm_comp_mgr_clutter_fetch_texture (MBWMCompMgrClient *client)
   if (!cclient->priv->pixmap)
     return;
 
-  XGetGeometry (wm->xdpy, cclient->priv->pixmap, &root,
-		&x, &y, &w, &h, &bw, &depth);
-
+  /*
+   * The pixmap has the size we last configured the window to; no need to
+   * ask the server.
+   */
   mb_wm_client_get_coverage (wm_client, &geom);
 
-  cclient->priv->pxm_width  = w;
-  cclient->priv->pxm_height = h;
-  cclient->priv->pxm_depth  = depth;
+  cclient->priv->pxm_width  = geom.width;
+  cclient->priv->pxm_height = geom.height;
+  cclient->priv->pxm_depth  =
+    mb_wm_comp_mgr_clutter_client_pixmap_depth (client);
+
+  if (!(cclient->priv->flags & MBWMCompMgrClutterClientMoving))
+    clutter_actor_set_position (cclient->priv->actor, geom.x, geom.y);
 
-  clutter_actor_set_position (cclient->priv->actor, geom.x, geom.y);
   clutter_actor_set_size (cclient->priv->texture, geom.width, geom.height);
 
+  mb_wm_comp_mgr_clutter_invalidate_redraw (
+			MB_WM_COMP_MGR_CLUTTER (wm->comp_mgr));
+
   clutter_x11_texture_pixmap_set_pixmap (
 				CLUTTER_X11_TEXTURE_PIXMAP (cclient->priv->texture),
 				cclient->priv->pixmap);
 
+  mb_wm_comp_mgr_clutter_client_account_texture (client,
+						 (unsigned long) geom.width *
+						 geom.height * 4);
+
+  mb_wm_comp_mgr_clutter_enforce_texture_budget (wm->comp_mgr);
+
 #ifdef HAVE_XEXT
   /*
-   * If the client is shaped, we have to manually clear any pixels in our
-   * texture in the non-visible areas.
+   * If the client is shaped, the shape actor paints only the parts of the
+   * texture inside the shape.
    */
-  if (mb_wm_theme_is_client_shaped (wm->theme, wm_client))
+  if (cclient->priv->shape)
     {
-      shp_rect = XShapeGetRectangles (wm->xdpy, xwin,
-				     ShapeBounding, &shp_count, &shp_order);
-
-      if (shp_rect && shp_count)
-	{
-	  XserverRegion clear_rgn;
-	  XRectangle rect;
-	  XRectangle * clear_rect;
-	  int clear_count;
-
-	  XRectangle *r0, r1;
-	  int c;
-
-	  rect.x = 0;
-	  rect.y = 0;
-	  rect.width = geom.width;
-	  rect.height = geom.height;
+      XRectangle * shp_rect;
+      int          shp_count, shp_order;
 
-	  clear_rgn   = XFixesCreateRegion (wm->xdpy, shp_rect, shp_count);
-
-	  XFixesInvertRegion (wm->xdpy, clear_rgn, &rect, clear_rgn);
-
-	  clear_rect = XFixesFetchRegion (wm->xdpy, clear_rgn, &clear_count);
-
-	  for (i = 0; i < clear_count; ++i)
-	    {
-	      int k, l;
-
-	      for (k = 0; k < clear_rect[i].width; k += SHP_CLEAR_SIZE)
-		for (l = 0; l < clear_rect[i].height; l += SHP_CLEAR_SIZE)
-		  {
-		    int w1 = clear_rect[i].width - k;
-		    int h1 = clear_rect[i].height - l;
-
-		    if (w1 > SHP_CLEAR_SIZE)
-		      w1 = SHP_CLEAR_SIZE;
-
-		    if (h1 > SHP_CLEAR_SIZE)
-		      h1 = SHP_CLEAR_SIZE;
-
-		    clutter_texture_set_area_from_rgb_data (
-					  CLUTTER_TEXTURE (cclient->priv->texture),
-					  (const guchar *)&clear_data,
-					  TRUE,
-					  clear_rect[i].x + k,
-					  clear_rect[i].y + l,
-					  w1, h1,
-					  SHP_CLEAR_SIZE * 4,
-					  4,
-					  CLUTTER_TEXTURE_RGB_FLAG_BGR,
-                                          NULL);
-		  }
-	    }
+      shp_rect = XShapeGetRectangles (wm->xdpy, xwin,
+				      ShapeBounding, &shp_count, &shp_order);
 
-	  XFixesDestroyRegion (wm->xdpy, clear_rgn);
+      mb_wm_shaped_texture_set_shape (cclient->priv->shape,
+				      shp_rect, shp_rect ? shp_count : 0);
 
-	  XFree (shp_rect);
+      clutter_actor_set_size (cclient->priv->shape, geom.width, geom.height);
 
-	  if (clear_rect)
-	    XFree (clear_rect);
-	}
+      if (shp_rect)
+	XFree (shp_rect);
     }
-
 #endif
 }
 
@@ -264,7 +420,10 @@ mb_wm_comp_mgr_clutter_client_destroy (MBWMObject* obj)
   int                        i;
 
   if (cclient->priv->actor)
-    clutter_actor_destroy (cclient->priv->actor);
+    {
+      clutter_actor_destroy (cclient->priv->actor);
+      mb_wm_comp_mgr_clutter_invalidate_redraw (mgr);
+    }
 
   if (cclient->priv->pixmap)
     XFreePixmap (wm->xdpy, cclient->priv->pixmap);
@@ -272,6 +431,8 @@ mb_wm_comp_mgr_clutter_client_destroy (MBWMObject* obj)
   if (cclient->priv->damage)
     XDamageDestroy (wm->xdpy, cclient->priv->damage);
 
+  mgr->priv->texture_bytes -= cclient->priv->texture_bytes;
+
   free (cclient->priv);
 }
 
@@ -325,6 +486,11 @@ mb_wm_comp_mgr_clutter_client_hide_real (MBWMCompMgrClient * client)
     return;
 
   clutter_actor_hide (cclient->priv->actor);
+
+  mb_wm_comp_mgr_clutter_invalidate_redraw (
+			MB_WM_COMP_MGR_CLUTTER (client->wm->comp_mgr));
+
+  mb_wm_comp_mgr_clutter_enforce_texture_budget (client->wm->comp_mgr);
 }
 
 static void
@@ -347,6 +513,21 @@ mb_wm_comp_mgr_clutter_client_show_real (MBWMCompMgrClient * client)
    */
   cclient->priv->flags &= ~MBWMCompMgrClutterClientDontUpdate;
   clutter_actor_show_all (cclient->priv->actor);
+
+  mb_wm_comp_mgr_clutter_invalidate_redraw (
+			MB_WM_COMP_MGR_CLUTTER (client->wm->comp_mgr));
+
+  /* Shaped clients are painted by the shape actor only */
+  if (cclient->priv->shape)
+    clutter_actor_hide (cclient->priv->texture);
+
+  /* The texture may have been released while we were hidden */
+  if (!cclient->priv->pixmap &&
+      mb_wm_comp_mgr_clutter_client_is_visible (cclient))
+    {
+      XDamageSubtract (client->wm->xdpy, cclient->priv->damage, None, None);
+      mb_wm_comp_mgr_clutter_fetch_texture (client);
+    }
 }
 
 void
@@ -376,14 +557,16 @@ mb_wm_comp_mgr_clutter_client_get_flags (MBWMCompMgrClutterClient  *cclient)
  */
 typedef struct MBWMCompMgrClutterClientEventEffect
 {
-  ClutterTimeline        *timeline;
+  MBWMCompMgrClutterAnimation *animation; /* NULL once started */
   ClutterBehaviour       *behaviour; /* can be either behaviour or effect */
 } MBWMCompMgrClutterClientEventEffect;
 
 static void
 mb_wm_comp_mgr_clutter_client_event_free (MBWMCompMgrClutterClientEventEffect * effect)
 {
-  g_object_unref (effect->timeline);
+  if (effect->animation)
+    mb_wm_comp_mgr_clutter_animation_free (effect->animation);
+
   g_object_unref (effect->behaviour);
 
   free (effect);
@@ -391,7 +574,6 @@ mb_wm_comp_mgr_clutter_client_event_free (MBWMCompMgrClutterClientEventEffect *
 
 struct completed_cb_data
 {
-  gulong                                my_id;
   MBWMCompMgrClutterClient            * cclient;
   MBWMCompMgrClientEvent                event;
   MBWMCompMgrClutterClientEventEffect * effect;
@@ -409,7 +591,7 @@ mb_wm_comp_mgr_clutter_client_event_new (MBWMCompMgrClient     *client,
 					 unsigned long          duration)
 {
   MBWMCompMgrClutterClientEventEffect * eff;
-  ClutterTimeline          * timeline;
+  MBWMCompMgrClutterAnimation * animation;
   ClutterBehaviour         * behaviour;
   ClutterAlpha             * alpha;
   MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT (client);
@@ -420,13 +602,11 @@ mb_wm_comp_mgr_clutter_client_event_new (MBWMCompMgrClient     *client,
   if (!cclient->priv->actor)
     return NULL;
 
-  timeline = clutter_timeline_new_for_duration (duration);
+  animation =
+    mb_wm_comp_mgr_clutter_animation_new (MB_WM_COMP_MGR_CLUTTER (wm->comp_mgr),
+					  duration, False, NULL, NULL);
 
-  if (!timeline)
-    return NULL;
-
-  alpha = clutter_alpha_new_full (timeline,
-				  CLUTTER_ALPHA_RAMP_INC, NULL, NULL);
+  alpha = animation->alpha;
 
   mb_wm_client_get_coverage (client->wm_client, &geom);
 
@@ -449,7 +629,7 @@ mb_wm_comp_mgr_clutter_client_event_new (MBWMCompMgrClient     *client,
     }
 
   eff = mb_wm_util_malloc0 (sizeof (MBWMCompMgrClutterClientEventEffect));
-  eff->timeline = timeline;
+  eff->animation = animation;
   eff->behaviour = behaviour;
 
   clutter_behaviour_apply (behaviour, cclient->priv->actor);
@@ -467,16 +647,377 @@ struct _MBWMCompMgrClutterPrivate
   ClutterActor * shadow;
 
   Window         overlay_window;
+
+  /* Timeout repairing clients whose damage was deferred */
+  unsigned long  deferred_id;
+
+  /*
+   * Master clock driving all the running animations; it only runs while
+   * there are any.
+   */
+  ClutterTimeline * clock;
+  GTimer          * clock_timer;
+  unsigned long     clock_now;
+  MBWMList        * animations;
+
+  /*
+   * Texture memory of all clients, and the budget above which the textures
+   * of hidden clients get released (0 for no limit).
+   */
+  unsigned long  texture_bytes;
+  unsigned long  texture_peak;
+  unsigned long  texture_budget;
+  unsigned long  texture_clock;
+
+  /*
+   * Clipped redraws: the stage area damaged since the last frame and the
+   * area redrawn by the last frame, and the number of frames still to be
+   * redrawn in full.
+   */
+  Bool           clipped_redraws;
+  Region         redraw_damage;
+  Region         redraw_last;
+  int            redraw_full;
+
+  unsigned long  redraw_frames;
+  unsigned long  redraw_pixels;
+  unsigned long  redraw_last_pixels;
 };
 
+/*
+ * Animations
+ *
+ * All effects and transitions are driven by a single looping timeline, the
+ * master clock, instead of a timeline each; this keeps a single frame
+ * callback however many windows animate at the same time. Each animation
+ * gets an alpha on the clock which works out its progress from the clock
+ * time at which it started; animations started before the next frame all
+ * start together at that frame. The clock is stopped as soon as the last
+ * animation completes.
+ */
+#define MBWM_COMP_MGR_CLUTTER_CLOCK_PERIOD 1000
+
+static guint32
+mb_wm_comp_mgr_clutter_animation_alpha (ClutterAlpha *alpha, gpointer data)
+{
+  MBWMCompMgrClutterAnimation * anim = data;
+  unsigned long                 elapsed = 0;
+  guint32                       value;
+
+  if (anim->start >= 0)
+    elapsed = anim->cmgr->priv->clock_now - anim->start;
+
+  if (elapsed >= anim->duration)
+    value = CLUTTER_ALPHA_MAX_ALPHA;
+  else
+    value = (guint32) ((guint64) CLUTTER_ALPHA_MAX_ALPHA * elapsed
+		       / anim->duration);
+
+  return anim->ramp_dec ? CLUTTER_ALPHA_MAX_ALPHA - value : value;
+}
+
+/*
+ * Runs before the alphas get updated for the frame; advances the clock and
+ * starts any animations added since the last frame.
+ */
+static void
+mb_wm_comp_mgr_clutter_clock_new_frame (ClutterTimeline *clock,
+					gint             frame,
+					gpointer         data)
+{
+  MBWMCompMgrClutterPrivate * priv = data;
+  MBWMList                  * l;
+
+  priv->clock_now =
+    (unsigned long) (g_timer_elapsed (priv->clock_timer, NULL) * 1000.0);
+
+  for (l = priv->animations; l; l = l->next)
+    {
+      MBWMCompMgrClutterAnimation * anim = l->data;
+
+      if (anim->start < 0)
+	anim->start = priv->clock_now;
+    }
+}
+
+/*
+ * Runs once the alphas have been updated; completes the animations that
+ * reached their end.
+ */
+static void
+mb_wm_comp_mgr_clutter_clock_new_frame_after (ClutterTimeline *clock,
+					      gint             frame,
+					      gpointer         data)
+{
+  MBWMCompMgrClutterPrivate * priv = data;
+  MBWMList                  * done = NULL;
+  MBWMList                  * l;
+
+  l = priv->animations;
+
+  while (l)
+    {
+      MBWMCompMgrClutterAnimation * anim = l->data;
+
+      l = l->next;
+
+      if (priv->clock_now - anim->start >= anim->duration)
+	{
+	  priv->animations = mb_wm_util_list_remove (priv->animations, anim);
+	  done = mb_wm_util_list_append (done, anim);
+	}
+    }
+
+  /* The callbacks can start new animations */
+  if (!priv->animations)
+    {
+      clutter_timeline_stop (priv->clock);
+
+      /* Clear whatever the last frames of the animations left behind */
+      priv->redraw_full = 2;
+    }
+
+  for (l = done; l; l = l->next)
+    {
+      MBWMCompMgrClutterAnimation * anim = l->data;
+
+      if (anim->completed)
+	anim->completed (anim->data);
+
+      mb_wm_comp_mgr_clutter_animation_free (anim);
+    }
+
+  mb_wm_util_list_free (done);
+}
+
+/*
+ * Creates an animation lasting duration ms, whose alpha ramps up (or down
+ * with ramp_dec); the behaviours go on the alpha of the animation, and
+ * completed is called once the animation has run its course.
+ */
+static MBWMCompMgrClutterAnimation *
+mb_wm_comp_mgr_clutter_animation_new (MBWMCompMgrClutter * cmgr,
+				      unsigned long        duration,
+				      Bool                 ramp_dec,
+				      void               (*completed) (void *),
+				      void               * data)
+{
+  MBWMCompMgrClutterPrivate   * priv = cmgr->priv;
+  MBWMCompMgrClutterAnimation * anim;
+
+  if (!priv->clock)
+    {
+      priv->clock =
+	clutter_timeline_new_for_duration (MBWM_COMP_MGR_CLUTTER_CLOCK_PERIOD);
+      clutter_timeline_set_loop (priv->clock, TRUE);
+
+      g_signal_connect (priv->clock, "new-frame",
+			G_CALLBACK (mb_wm_comp_mgr_clutter_clock_new_frame),
+			priv);
+      g_signal_connect_after (priv->clock, "new-frame",
+		      G_CALLBACK (mb_wm_comp_mgr_clutter_clock_new_frame_after),
+		      priv);
+
+      priv->clock_timer = g_timer_new ();
+    }
+
+  anim = mb_wm_util_malloc0 (sizeof (MBWMCompMgrClutterAnimation));
+
+  anim->cmgr      = cmgr;
+  anim->duration  = duration ? duration : 1;
+  anim->start     = -1;
+  anim->ramp_dec  = ramp_dec;
+  anim->completed = completed;
+  anim->data      = data;
+
+  /*
+   * Our handlers were connected to the clock first, so on each frame the
+   * clock time is updated before any alpha looks at it.
+   */
+  anim->alpha =
+    g_object_ref (clutter_alpha_new_full (priv->clock,
+					  mb_wm_comp_mgr_clutter_animation_alpha,
+					  anim, NULL));
+
+  return anim;
+}
+
+static void
+mb_wm_comp_mgr_clutter_animation_start (MBWMCompMgrClutterAnimation *anim)
+{
+  MBWMCompMgrClutterPrivate * priv = anim->cmgr->priv;
+
+  priv->animations = mb_wm_util_list_append (priv->animations, anim);
+
+  mb_wm_comp_mgr_clutter_invalidate_redraw (anim->cmgr);
+
+  if (!clutter_timeline_is_playing (priv->clock))
+    clutter_timeline_start (priv->clock);
+}
+
+/*
+ * Frees an animation that was never started, or has completed.
+ */
+static void
+mb_wm_comp_mgr_clutter_animation_free (MBWMCompMgrClutterAnimation *anim)
+{
+  /* The behaviours may outlive us; stop the alpha from calling us */
+  clutter_alpha_set_timeline (anim->alpha, NULL);
+  g_object_unref (anim->alpha);
+
+  free (anim);
+}
+
+/*
+ * Clipped redraws
+ *
+ * Clutter always repaints the whole stage, so a small damage on a single
+ * window costs a full screen repaint. With clipped redraws on, the damage
+ * of the clients is collected in stage coordinates as it is repaired, and
+ * the next stage paint is scissored to its bounds. Since the back buffer
+ * we paint into holds the frame before the last one, the scissor covers
+ * the damage of the last frame as well. Anything that can move actors
+ * around (configure, restack, map, animations, ...) makes the next two
+ * frames full ones.
+ */
+static void
+mb_wm_comp_mgr_clutter_invalidate_redraw (MBWMCompMgrClutter *cmgr)
+{
+  cmgr->priv->redraw_full = 2;
+}
+
+static void
+mb_wm_comp_mgr_clutter_add_redraw_damage (MBWMCompMgrClutter *cmgr,
+					  XRectangle         *rect)
+{
+  MBWMCompMgrClutterPrivate * priv = cmgr->priv;
+
+  if (!priv->clipped_redraws)
+    return;
+
+  XUnionRectWithRegion (rect, priv->redraw_damage, priv->redraw_damage);
+}
+
+static void
+mb_wm_comp_mgr_clutter_stage_paint (ClutterActor *stage, gpointer data)
+{
+  MBWMCompMgrClutter        * cmgr = data;
+  MBWMCompMgrClutterPrivate * priv = cmgr->priv;
+  MBWindowManager           * wm   = MB_WM_COMP_MGR (cmgr)->wm;
+  Region                      clip;
+  XRectangle                  bounds;
+  unsigned long               pixels;
+  Bool                        full;
+
+  clip = XCreateRegion ();
+  XUnionRegion (priv->redraw_damage, priv->redraw_last, clip);
+
+  /* A redraw without any damage was not queued by us; play it safe */
+  full = (priv->redraw_full > 0 || XEmptyRegion (clip) ||
+	  (priv->clock && clutter_timeline_is_playing (priv->clock)));
+
+  if (full)
+    {
+      bounds.x      = 0;
+      bounds.y      = 0;
+      bounds.width  = wm->xdpy_width;
+      bounds.height = wm->xdpy_height;
+
+      if (priv->redraw_full > 0)
+	priv->redraw_full--;
+
+      /* The next frame still has to catch up with the one before this */
+      XDestroyRegion (priv->redraw_last);
+      priv->redraw_last = XCreateRegion ();
+      XUnionRectWithRegion (&bounds, priv->redraw_last, priv->redraw_last);
+
+      XDestroyRegion (priv->redraw_damage);
+      priv->redraw_damage = XCreateRegion ();
+    }
+  else
+    {
+      XClipBox (clip, &bounds);
+
+      XDestroyRegion (priv->redraw_last);
+      priv->redraw_last = priv->redraw_damage;
+      priv->redraw_damage = XCreateRegion ();
+
+#if HAVE_CLUTTER_GLX
+      glEnable (GL_SCISSOR_TEST);
+      glScissor (bounds.x, wm->xdpy_height - (bounds.y + bounds.height),
+		 bounds.width, bounds.height);
+#endif
+    }
+
+  XDestroyRegion (clip);
+
+  pixels = (unsigned long) bounds.width * bounds.height;
+
+  priv->redraw_frames++;
+  priv->redraw_pixels += pixels;
+  priv->redraw_last_pixels = pixels;
+
+  MBWM_NOTE (COMPOSITOR, "frame %lu: redrawing %d,%d;%dx%d (%lu pixels)%s",
+	     priv->redraw_frames, bounds.x, bounds.y,
+	     bounds.width, bounds.height, pixels, full ? " full" : "");
+}
+
+static void
+mb_wm_comp_mgr_clutter_stage_paint_after (ClutterActor *stage, gpointer data)
+{
+#if HAVE_CLUTTER_GLX
+  glDisable (GL_SCISSOR_TEST);
+#endif
+}
+
+/*
+ * The textures repaired so far are on the screen now, which closes the
+ * damage frames of their clients.
+ */
+static void
+mb_wm_comp_mgr_clutter_stage_painted (ClutterActor *stage, gpointer data)
+{
+  MBWindowManager       * wm = MB_WM_COMP_MGR (data)->wm;
+  MBWindowManagerClient * c;
+
+  mb_wm_stack_enumerate (wm, c)
+    mb_wm_comp_mgr_client_damage_frame_end (c->cm_client);
+}
+
 static void
 mb_wm_comp_mgr_clutter_private_free (MBWMCompMgrClutter *mgr)
 {
   MBWMCompMgrClutterPrivate * priv = mgr->priv;
+  MBWindowManager           * wm   = MB_WM_COMP_MGR (mgr)->wm;
+
+  if (priv->deferred_id)
+    mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+					       priv->deferred_id);
+
+  while (priv->animations)
+    {
+      MBWMCompMgrClutterAnimation * anim = priv->animations->data;
+
+      priv->animations = mb_wm_util_list_remove (priv->animations, anim);
+      mb_wm_comp_mgr_clutter_animation_free (anim);
+    }
+
+  if (priv->clock)
+    {
+      clutter_timeline_stop (priv->clock);
+      g_object_unref (priv->clock);
+      g_timer_destroy (priv->clock_timer);
+    }
 
   if (priv->shadow)
     clutter_actor_destroy (priv->shadow);
 
+  if (priv->redraw_damage)
+    XDestroyRegion (priv->redraw_damage);
+
+  if (priv->redraw_last)
+    XDestroyRegion (priv->redraw_last);
+
   free (priv);
 }
 
@@ -569,8 +1110,33 @@ mb_wm_comp_mgr_clutter_init (MBWMObject *obj, va_list vap)
   MBWindowManager            * wm = mgr->wm;
   ClutterActor               * desktop, * arena;
 
-  priv = mb_wm_util_malloc0 (sizeof (MBWMCompMgrClutterPrivate));
-  cmgr->priv = priv;
+  priv = mb_wm_util_malloc0 (sizeof (MBWMCompMgrClutterPrivate));
+  cmgr->priv = priv;
+
+  priv->texture_budget = wm->texture_budget;
+
+  priv->clipped_redraws = (wm->flags & MBWindowManagerFlagClippedRedraws);
+  priv->redraw_damage   = XCreateRegion ();
+  priv->redraw_last     = XCreateRegion ();
+  priv->redraw_full     = 2;
+
+  /*
+   * The stage clears itself from its class paint handler, so the scissor
+   * has to be set up from a handler that runs ahead of it.
+   */
+  if (priv->clipped_redraws)
+    {
+      g_signal_connect (clutter_stage_get_default (), "paint",
+			G_CALLBACK (mb_wm_comp_mgr_clutter_stage_paint),
+			cmgr);
+      g_signal_connect_after (clutter_stage_get_default (), "paint",
+			G_CALLBACK (mb_wm_comp_mgr_clutter_stage_paint_after),
+			cmgr);
+    }
+
+  g_signal_connect_after (clutter_stage_get_default (), "paint",
+			  G_CALLBACK (mb_wm_comp_mgr_clutter_stage_painted),
+			  cmgr);
 
   XCompositeRedirectSubwindows (wm->xdpy, wm->root_win->xwindow,
 				CompositeRedirectManual);
@@ -647,6 +1213,13 @@ mb_wm_comp_mgr_clutter_turn_off_real (MBWMCompMgr *mgr)
   XCompositeReleaseOverlayWindow (wm->xdpy, wm->root_win->xwindow);
   priv->overlay_window = None;
 
+  if (priv->deferred_id)
+    {
+      mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+						 priv->deferred_id);
+      priv->deferred_id = 0;
+    }
+
   mgr->disabled = True;
 }
 
@@ -715,10 +1288,12 @@ mb_wm_comp_mgr_clutter_client_repair_real (MBWMCompMgrClient * client)
   MBWindowManagerClient    * wm_client = client->wm_client;
   MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT (client);
   MBWindowManager          * wm   = client->wm;
+  MBWMCompMgrClutter       * cmgr = MB_WM_COMP_MGR_CLUTTER (wm->comp_mgr);
   XserverRegion              parts;
   int                        i, r_count;
   XRectangle               * r_damage;
   XRectangle                 r_bounds;
+  gint                       ax, ay;
 
   MBWM_NOTE (COMPOSITOR, "REPAIRING %x", wm_client->window->xwindow);
 
@@ -729,14 +1304,22 @@ mb_wm_comp_mgr_clutter_client_repair_real (MBWMCompMgrClient * client)
     {
       /*
        * First time we have been called since creation/configure,
-       * fetch the whole texture.
+       * fetch the whole texture; if the texture was released, leave that
+       * until the client is on the screen again.
        */
       MBWM_NOTE (DAMAGE, "Full screen repair.");
       XDamageSubtract (wm->xdpy, cclient->priv->damage, None, None);
+
+      if (!cclient->priv->texture_bytes &&
+	  !mb_wm_comp_mgr_clutter_client_is_visible (cclient))
+	return;
+
       mb_wm_comp_mgr_clutter_fetch_texture (client);
       return;
     }
 
+  cclient->priv->last_used = ++cmgr->priv->texture_clock;
+
   /*
    * Retrieve the damaged region and break it down into individual
    * rectangles so we do not have to update the whole shebang.
@@ -748,10 +1331,14 @@ mb_wm_comp_mgr_clutter_client_repair_real (MBWMCompMgrClient * client)
 					 &r_count,
 					 &r_bounds);
 
+  clutter_actor_get_position (cclient->priv->actor, &ax, &ay);
+
   if (r_damage)
     {
       for (i = 0; i < r_count; ++i)
 	{
+	  XRectangle stage_rect = r_damage[i];
+
 	  MBWM_NOTE (DAMAGE, "Repairing %d,%d;%dx%d",
 		     r_damage[i].x,
 		     r_damage[i].y,
@@ -764,23 +1351,62 @@ mb_wm_comp_mgr_clutter_client_repair_real (MBWMCompMgrClient * client)
 			r_damage[i].y,
 			r_damage[i].width,
 			r_damage[i].height);
+
+	  /* Only the damaged part of the stage needs redrawing */
+	  stage_rect.x += ax;
+	  stage_rect.y += ay;
+
+	  mb_wm_comp_mgr_clutter_add_redraw_damage (cmgr, &stage_rect);
 	}
 
       XFree (r_damage);
     }
 
+  /* The texture is hidden, so nothing queues the clone for a redraw */
+  if (cclient->priv->shape)
+    clutter_actor_queue_redraw (cclient->priv->shape);
+
   XFixesDestroyRegion (wm->xdpy, parts);
 }
 
 static void
 mb_wm_comp_mgr_clutter_client_configure_real (MBWMCompMgrClient * client,
-                                              MBWMGeometry * geometry)
+                                              MBGeometry   * geometry)
 {
   MBWindowManagerClient    * wm_client = client->wm_client;
   MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT (client);
+  MBGeometry                 geom;
 
   MBWM_NOTE (COMPOSITOR, "CONFIGURE request");
 
+  /*
+   * For framed clients we can get called with the geometry of the client
+   * window, so go by the frame.
+   */
+  if (wm_client->xwin_frame)
+    mb_wm_client_get_coverage (wm_client, &geom);
+  else
+    geom = *geometry;
+
+  /*
+   * A move leaves the backing pixmap alone, so keep the texture bound to it
+   * and just move the actor.
+   */
+  if (cclient->priv->pixmap && cclient->priv->actor &&
+      geom.width  == cclient->priv->pxm_width &&
+      geom.height == cclient->priv->pxm_height &&
+      cclient->priv->pxm_depth ==
+      mb_wm_comp_mgr_clutter_client_pixmap_depth (client))
+    {
+      /* An interactive move puts the actor where it wants it */
+      if (!(cclient->priv->flags & MBWMCompMgrClutterClientMoving))
+	clutter_actor_set_position (cclient->priv->actor, geom.x, geom.y);
+
+      mb_wm_comp_mgr_clutter_invalidate_redraw (
+			MB_WM_COMP_MGR_CLUTTER (client->wm->comp_mgr));
+      return;
+    }
+
   /*
    * Release the backing pixmap; we will recreate it next time we get damage
    * notification for this window.
@@ -792,6 +1418,68 @@ mb_wm_comp_mgr_clutter_client_configure_real (MBWMCompMgrClient * client,
     }
 }
 
+/*
+ * Moves the actor only, leaving the window and its texture alone; a NULL
+ * geometry puts the actor back where the window is.
+ */
+static void
+mb_wm_comp_mgr_clutter_client_move_real (MBWMCompMgrClient * client,
+					 MBGeometry        * geometry)
+{
+  MBWMCompMgrClutterClient * cclient = MB_WM_COMP_MGR_CLUTTER_CLIENT (client);
+  MBGeometry                 geom;
+
+  if (geometry)
+    {
+      cclient->priv->flags |= MBWMCompMgrClutterClientMoving;
+      geom = *geometry;
+    }
+  else
+    {
+      cclient->priv->flags &= ~MBWMCompMgrClutterClientMoving;
+      mb_wm_client_get_coverage (client->wm_client, &geom);
+    }
+
+  if (!cclient->priv->actor)
+    return;
+
+  clutter_actor_set_position (cclient->priv->actor, geom.x, geom.y);
+
+  mb_wm_comp_mgr_clutter_invalidate_redraw (
+			MB_WM_COMP_MGR_CLUTTER (client->wm->comp_mgr));
+}
+
+/*
+ * Repairs the clients whose damage was held back by the rate limiting.
+ */
+static Bool
+mb_wm_comp_mgr_clutter_deferred_timeout (void *userdata)
+{
+  MBWMCompMgr               * mgr  = userdata;
+  MBWMCompMgrClutterPrivate * priv = MB_WM_COMP_MGR_CLUTTER (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
+  MBWindowManagerClient     * c;
+
+  priv->deferred_id = 0;
+
+  mb_wm_stack_enumerate (wm, c)
+    {
+      MBWMCompMgrClutterClient *cclient =
+	MB_WM_COMP_MGR_CLUTTER_CLIENT (c->cm_client);
+
+      if (!cclient ||
+	  !(cclient->priv->flags & MBWMCompMgrClutterClientDamageDeferred))
+	continue;
+
+      cclient->priv->flags &= ~MBWMCompMgrClutterClientDamageDeferred;
+
+      mb_wm_comp_mgr_client_damage_frame_start (c->cm_client);
+      mb_wm_comp_mgr_clutter_client_repair_real (c->cm_client);
+    }
+
+  return False;
+}
+
 static Bool
 mb_wm_comp_mgr_clutter_handle_damage (XDamageNotifyEvent * de,
 				      MBWMCompMgr        * mgr)
@@ -820,6 +1508,25 @@ mb_wm_comp_mgr_clutter_handle_damage (XDamageNotifyEvent * de,
 		 de->geometry.height,
 		 de->more);
 
+      /*
+       * The damage is reported only once until repaired, so holding back
+       * the repair of a client over its budget also stops further events.
+       */
+      if (!mb_wm_comp_mgr_client_damage_account (c->cm_client,
+						 de->area.width *
+						 de->area.height))
+	{
+	  cclient->priv->flags |= MBWMCompMgrClutterClientDamageDeferred;
+
+	  if (!priv->deferred_id)
+	    priv->deferred_id =
+	      mb_wm_main_context_timeout_handler_add (wm->main_ctx,
+				  MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL,
+				  mb_wm_comp_mgr_clutter_deferred_timeout,
+				  mgr);
+	  return False;
+	}
+
       mb_wm_comp_mgr_clutter_client_repair_real (c->cm_client);
     }
   else
@@ -839,6 +1546,8 @@ mb_wm_comp_mgr_clutter_restack_real (MBWMCompMgr *mgr)
   MBWMList           * l;
   int                  i = 0;
 
+  mb_wm_comp_mgr_clutter_invalidate_redraw (cmgr);
+
   l = cmgr->priv->desktops;
 
   if (!mb_wm_stack_empty (wm))
@@ -932,12 +1641,16 @@ mb_wm_comp_mgr_clutter_select_desktop (MBWMCompMgr * mgr,
 				       int           desktop,
 				       int           old_desktop)
 {
-  MBWMCompMgrClutter * cmgr = MB_WM_COMP_MGR_CLUTTER (mgr);
-  ClutterActor       * d;
-  MBWMList           * l;
+  MBWMCompMgrClutter    * cmgr = MB_WM_COMP_MGR_CLUTTER (mgr);
+  MBWindowManager       * wm   = mgr->wm;
+  ClutterActor          * d;
+  MBWMList              * l;
+  const MBWMList        * cl;
 
   d = mb_wm_comp_mgr_clutter_get_nth_desktop (cmgr, desktop);
 
+  mb_wm_comp_mgr_clutter_invalidate_redraw (cmgr);
+
   l = cmgr->priv->desktops;
 
   while (l)
@@ -951,6 +1664,76 @@ mb_wm_comp_mgr_clutter_select_desktop (MBWMCompMgr * mgr,
 
       l = l->next;
     }
+
+  /*
+   * Fetch any textures released while the desktop was hidden, and make room
+   * for them among the clients just hidden.
+   */
+  for (cl = mb_wm_get_desktop_clients (wm, desktop); cl; cl = cl->next)
+    {
+      MBWindowManagerClient    * c  = cl->data;
+      MBWMCompMgrClutterClient * cc =
+	MB_WM_COMP_MGR_CLUTTER_CLIENT (c->cm_client);
+
+      if (cc && !cc->priv->pixmap &&
+	  mb_wm_comp_mgr_clutter_client_is_visible (cc))
+	{
+	  XDamageSubtract (wm->xdpy, cc->priv->damage, None, None);
+	  mb_wm_comp_mgr_clutter_fetch_texture (c->cm_client);
+	}
+    }
+
+  mb_wm_comp_mgr_clutter_enforce_texture_budget (mgr);
+}
+
+/*
+ * Sets the amount of texture memory, in bytes, above which the textures of
+ * clients that are not on the screen get released; 0 means no limit.
+ */
+void
+mb_wm_comp_mgr_clutter_set_texture_budget (MBWMCompMgrClutter *cmgr,
+					   unsigned long       bytes)
+{
+  cmgr->priv->texture_budget = bytes;
+
+  mb_wm_comp_mgr_clutter_enforce_texture_budget (MB_WM_COMP_MGR (cmgr));
+}
+
+/*
+ * Retrieves the texture memory currently held for the clients and the most
+ * ever held, in bytes; either pointer can be NULL.
+ */
+void
+mb_wm_comp_mgr_clutter_get_texture_stats (MBWMCompMgrClutter *cmgr,
+					  unsigned long      *current,
+					  unsigned long      *peak)
+{
+  if (current)
+    *current = cmgr->priv->texture_bytes;
+
+  if (peak)
+    *peak = cmgr->priv->texture_peak;
+}
+
+/*
+ * Retrieves the number of stage frames painted, the pixels they redrew in
+ * total, and the pixels redrawn by the last one; either pointer can be
+ * NULL. Only kept with clipped redraws turned on.
+ */
+void
+mb_wm_comp_mgr_clutter_get_redraw_stats (MBWMCompMgrClutter *cmgr,
+					 unsigned long      *frames,
+					 unsigned long      *pixels,
+					 unsigned long      *last)
+{
+  if (frames)
+    *frames = cmgr->priv->redraw_frames;
+
+  if (pixels)
+    *pixels = cmgr->priv->redraw_pixels;
+
+  if (last)
+    *last = cmgr->priv->redraw_last_pixels;
 }
 
 static void
@@ -963,6 +1746,7 @@ mb_wm_comp_mgr_clutter_map_notify_real (MBWMCompMgr *mgr,
   MBWindowManager           * wm      = client->wm;
   ClutterActor              * actor;
   ClutterActor              * texture;
+  ClutterActor              * paint;
   ClutterActor              * rect;
   MBGeometry                  geom;
   const MBWMList            * l;
@@ -1016,6 +1800,25 @@ mb_wm_comp_mgr_clutter_map_notify_real (MBWMCompMgr *mgr,
 #endif
   clutter_actor_show (texture);
 
+  paint = texture;
+
+#ifdef HAVE_XEXT
+  /*
+   * Shaped clients are painted through a clone of the texture which only
+   * draws the parts inside the shape; the texture itself stays hidden.
+   */
+  if (mb_wm_theme_is_client_shaped (wm->theme, c))
+    {
+      paint = mb_wm_shaped_texture_new (CLUTTER_TEXTURE (texture));
+
+      clutter_actor_set_size (paint, geom.width, geom.height);
+      clutter_actor_show (paint);
+      clutter_actor_hide (texture);
+
+      cclient->priv->shape = paint;
+    }
+#endif
+
   if (ctype == MBWMClientTypeDialog   ||
       ctype == MBWMClientTypeMenu     ||
       ctype == MBWMClientTypeNote     ||
@@ -1025,7 +1828,7 @@ mb_wm_comp_mgr_clutter_map_notify_real (MBWMCompMgr *mgr,
 
       if (shadow_type == MBWM_COMP_MGR_SHADOW_NONE)
 	{
-	  clutter_container_add (CLUTTER_CONTAINER (actor), texture, NULL);
+	  clutter_container_add (CLUTTER_CONTAINER (actor), paint, NULL);
 	}
       else
 	{
@@ -1083,14 +1886,17 @@ mb_wm_comp_mgr_clutter_map_notify_real (MBWMCompMgr *mgr,
 	  clutter_actor_show (rect);
 
 	  clutter_container_add (CLUTTER_CONTAINER (actor),
-				 rect, texture, NULL);
+				 rect, paint, NULL);
 	}
     }
   else
     {
-      clutter_container_add (CLUTTER_CONTAINER (actor), texture, NULL);
+      clutter_container_add (CLUTTER_CONTAINER (actor), paint, NULL);
     }
 
+  if (paint != texture)
+    clutter_container_add (CLUTTER_CONTAINER (actor), texture, NULL);
+
 
   cclient->priv->actor = actor;
   cclient->priv->texture = texture;
@@ -1107,12 +1913,11 @@ struct _fade_cb_data
 {
   MBWMCompMgrClutterClient *cclient1;
   MBWMCompMgrClutterClient *cclient2;
-  ClutterTimeline  * timeline;
   ClutterBehaviour * beh;
 };
 
 static void
-mb_wm_comp_mgr_clutter_transtion_fade_cb (ClutterTimeline * t, void * data)
+mb_wm_comp_mgr_clutter_transtion_fade_cb (void * data)
 {
   struct _fade_cb_data * d  = data;
   ClutterActor   * a1 = d->cclient1->priv->actor;
@@ -1126,8 +1931,9 @@ mb_wm_comp_mgr_clutter_transtion_fade_cb (ClutterTimeline * t, void * data)
   mb_wm_object_unref (MB_WM_OBJECT (d->cclient1));
   mb_wm_object_unref (MB_WM_OBJECT (d->cclient2));
 
-  g_object_unref (d->timeline);
   g_object_unref (d->beh);
+
+  free (d);
 }
 
 static void
@@ -1155,41 +1961,39 @@ mb_wm_comp_mgr_clutter_client_transition_fade (MBWMCompMgrClutterClient *cclient
                                                MBWMCompMgrClutterClient *cclient2,
                                                unsigned long duration)
 {
-  ClutterTimeline             * timeline;
-  ClutterAlpha                * alpha;
-  static struct _fade_cb_data   cb_data;
+  MBWMCompMgrClutter          * cmgr =
+    MB_WM_COMP_MGR_CLUTTER (MB_WM_COMP_MGR_CLIENT (cclient1)->wm->comp_mgr);
+  MBWMCompMgrClutterAnimation * animation;
+  struct _fade_cb_data        * cb_data;
   ClutterBehaviour            * b;
 
+  cb_data = mb_wm_util_malloc0 (sizeof (struct _fade_cb_data));
+
+  /*
+   * Must restore the opacity on the 'from' actor once done
+   */
+  animation =
+    mb_wm_comp_mgr_clutter_animation_new (cmgr, duration, True,
+				  mb_wm_comp_mgr_clutter_transtion_fade_cb,
+				  cb_data);
+
   /*
    * Fade is simple -- we only need to animate the second actor and its
    * children, as the stacking order automatically takes care of the
    * actor appearing to fade out from the first one
    */
-  timeline = clutter_timeline_new_for_duration (duration);
-
-  alpha = clutter_alpha_new_full (timeline,
-				  CLUTTER_ALPHA_RAMP_DEC, NULL, NULL);
+  b = clutter_behaviour_opacity_new (animation->alpha, 0xff, 0);
 
-  b = clutter_behaviour_opacity_new (alpha, 0xff, 0);
-
-  cb_data.cclient1 = mb_wm_object_ref (MB_WM_OBJECT (cclient1));
-  cb_data.cclient2 = mb_wm_object_ref (MB_WM_OBJECT (cclient2));
-  cb_data.timeline = timeline;
-  cb_data.beh = b;
+  cb_data->cclient1 = mb_wm_object_ref (MB_WM_OBJECT (cclient1));
+  cb_data->cclient2 = mb_wm_object_ref (MB_WM_OBJECT (cclient2));
+  cb_data->beh = b;
 
   _fade_apply_behaviour_to_client (MB_WM_COMP_MGR_CLIENT (cclient2)->wm_client, b);
 
-  /*
-   * Must restore the opacity on the 'from' actor
-   */
-  g_signal_connect (timeline, "completed",
-		    G_CALLBACK (mb_wm_comp_mgr_clutter_transtion_fade_cb),
-		    &cb_data);
-
   cclient1->priv->flags |= MBWMCompMgrClutterClientEffectRunning;
   cclient2->priv->flags |= MBWMCompMgrClutterClientEffectRunning;
 
-  clutter_timeline_start (timeline);
+  mb_wm_comp_mgr_clutter_animation_start (animation);
 }
 
 static void
@@ -1209,20 +2013,15 @@ mb_wm_comp_mgr_clutter_client_transition_real (MBWMCompMgr * mgr,
 }
 
 /*
- * Callback for ClutterTimeline::completed signal.
- *
- * One-off; get connected when the timeline is started, and disconnected
- * again when it finishes.
+ * Called when the animation of an event effect completes.
  */
 static void
-mb_wm_comp_mgr_clutter_client_event_completed_cb (ClutterTimeline * t, void * data)
+mb_wm_comp_mgr_clutter_client_event_completed_cb (void * data)
 {
   struct completed_cb_data * d = data;
 
   d->cclient->priv->flags &= ~MBWMCompMgrClutterClientEffectRunning;
 
-  g_signal_handler_disconnect (t, d->my_id);
-
   switch (d->event)
     {
     case MBWMCompMgrClientEventUnmap:
@@ -1330,13 +2129,16 @@ mb_wm_comp_mgr_clutter_client_event_real (MBWMCompMgr            * mgr,
 	  d->event   = event;
 	  d->effect  = eff;
 
-	  d->my_id = g_signal_connect (eff->timeline, "completed",
-		  G_CALLBACK (mb_wm_comp_mgr_clutter_client_event_completed_cb),
-		  d);
+	  eff->animation->completed =
+	    mb_wm_comp_mgr_clutter_client_event_completed_cb;
+	  eff->animation->data = d;
 
 	  cclient->priv->flags |= MBWMCompMgrClutterClientEffectRunning;
 	  clutter_actor_show (a);
-	  clutter_timeline_start (eff->timeline);
+
+	  /* The animation belongs to the clock from now on */
+	  mb_wm_comp_mgr_clutter_animation_start (eff->animation);
+	  eff->animation = NULL;
 	}
       else
 	mb_wm_comp_mgr_clutter_client_event_free (eff);
@@ -1381,6 +2183,8 @@ mb_wm_comp_mgr_clutter_add_actor (MBWMCompMgrClutter       * cmgr,
   d = mb_wm_comp_mgr_clutter_get_nth_desktop (cmgr, desktop);
 
   clutter_container_add_actor (CLUTTER_CONTAINER (d), cclient->priv->actor);
+
+  mb_wm_comp_mgr_clutter_invalidate_redraw (cmgr);
 }
 
 MBWMCompMgr *
@@ -1398,120 +2202,14 @@ mb_wm_comp_mgr_clutter_new (MBWindowManager *wm)
 /* ------------------------------- */
 /* Shadow Generation */
 
-typedef struct MBGaussianMap
-{
-  int	   size;
-  double * data;
-} MBGaussianMap;
-
-static double
-gaussian (double r, double x, double y)
-{
-  return ((1 / (sqrt (2 * M_PI * r))) *
-	  exp ((- (x * x + y * y)) / (2 * r * r)));
-}
-
-
-static MBGaussianMap *
-mb_wm_comp_mgr_clutter_make_gaussian_map (double r)
-{
-  MBGaussianMap  *c;
-  int	          size = ((int) ceil ((r * 3)) + 1) & ~1;
-  int	          center = size / 2;
-  int	          x, y;
-  double          t = 0.0;
-  double          g;
-
-  c = malloc (sizeof (MBGaussianMap) + size * size * sizeof (double));
-  c->size = size;
-
-  c->data = (double *) (c + 1);
-
-  for (y = 0; y < size; y++)
-    for (x = 0; x < size; x++)
-      {
-	g = gaussian (r, (double) (x - center), (double) (y - center));
-	t += g;
-	c->data[y * size + x] = g;
-      }
-
-  for (y = 0; y < size; y++)
-    for (x = 0; x < size; x++)
-      c->data[y*size + x] /= t;
-
-  return c;
-}
-
-static unsigned char
-mb_wm_comp_mgr_clutter_sum_gaussian (MBGaussianMap * map, double opacity,
-				     int x, int y, int width, int height)
-{
-  int	           fx, fy;
-  double         * g_data;
-  double         * g_line = map->data;
-  int	           g_size = map->size;
-  int	           center = g_size / 2;
-  int	           fx_start, fx_end;
-  int	           fy_start, fy_end;
-  double           v;
-  unsigned int     r;
-
-  /*
-   * Compute set of filter values which are "in range",
-   * that's the set with:
-   *	0 <= x + (fx-center) && x + (fx-center) < width &&
-   *  0 <= y + (fy-center) && y + (fy-center) < height
-   *
-   *  0 <= x + (fx - center)	x + fx - center < width
-   *  center - x <= fx	fx < width + center - x
-   */
-
-  fx_start = center - x;
-  if (fx_start < 0)
-    fx_start = 0;
-  fx_end = width + center - x;
-  if (fx_end > g_size)
-    fx_end = g_size;
-
-  fy_start = center - y;
-  if (fy_start < 0)
-    fy_start = 0;
-  fy_end = height + center - y;
-  if (fy_end > g_size)
-    fy_end = g_size;
-
-  g_line = g_line + fy_start * g_size + fx_start;
-
-  v = 0;
-  for (fy = fy_start; fy < fy_end; fy++)
-    {
-      g_data = g_line;
-      g_line += g_size;
-
-      for (fx = fx_start; fx < fx_end; fx++)
-	v += *g_data++;
-    }
-  if (v > 1)
-    v = 1;
-
-  v *= (opacity * 255.0);
-
-  r = (unsigned int) v;
-
-  return (unsigned char) r;
-}
-
 static unsigned char *
 mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
 {
+  const MBWMCompMgrGaussianShadow * shadow;
   unsigned char              * data;
-  int		               size;
-  int		               center;
   int		               x, y;
   unsigned char                d;
   int                          pwidth, pheight;
-  double                       opacity = SHADOW_OPACITY;
-  static MBGaussianMap       * gaussian_map = NULL;
 
   struct _mypixel
   {
@@ -1522,12 +2220,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   } * _d;
 
 
-  if (!gaussian_map)
-    gaussian_map =
-      mb_wm_comp_mgr_clutter_make_gaussian_map (SHADOW_RADIUS);
-
-  size   = gaussian_map->size;
-  center = size / 2;
+  shadow = mb_wm_comp_mgr_gaussian_shadow_get (SHADOW_RADIUS, SHADOW_OPACITY);
 
   /* Top & bottom */
 
@@ -1541,9 +2234,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   /* N */
   for (y = 0; y < pheight; y++)
     {
-      d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					       center, y - center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[y];
       for (x = 0; x < pwidth; x++)
 	{
 	  _d[y*3*pwidth + x + pwidth].r = 0;
@@ -1560,9 +2251,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
 
   for (y = 0; y < pheight; y++)
     {
-      d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					       center, y - center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[y];
       for (x = 0; x < pwidth; x++)
 	{
 	  _d[(pheight-y-1)*3*pwidth + 6*pwidth*pheight + x + pwidth].r = 0;
@@ -1580,9 +2269,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
 
   for (x = 0; x < pwidth; x++)
     {
-      d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					       x - center, center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[x];
       for (y = 0; y < pheight; y++)
 	{
 	  _d[y*3*pwidth + 3*pwidth*pheight + x].r = 0;
@@ -1596,9 +2283,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   /* E */
   for (x = 0; x < pwidth; x++)
     {
-      d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					       x - center, center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[x];
       for (y = 0; y < pheight; y++)
 	{
 	  _d[y*3*pwidth + 3*pwidth*pheight + (pwidth-x-1) + 2*pwidth].r = 0;
@@ -1616,9 +2301,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	_d[y*3*pwidth + x].r = 0;
 	_d[y*3*pwidth + x].g = 0;
@@ -1630,9 +2313,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	_d[(pheight-y-1)*3*pwidth + 6*pwidth*pheight + x].r = 0;
 	_d[(pheight-y-1)*3*pwidth + 6*pwidth*pheight + x].g = 0;
@@ -1644,9 +2325,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	_d[(pheight-y-1)*3*pwidth + 6*pwidth*pheight + (pwidth-x-1) +
 	   2*pwidth].r = 0;
@@ -1662,8 +2341,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					 x-center, y-center, WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	_d[y*3*pwidth + (pwidth - x - 1) + 2*pwidth].r = 0;
 	_d[y*3*pwidth + (pwidth - x - 1) + 2*pwidth].g = 0;
@@ -1675,8 +2353,7 @@ mb_wm_comp_mgr_clutter_shadow_gaussian_make_tile ()
   pwidth = MAX_TILE_SZ;
   pheight = MAX_TILE_SZ;
 
-  d = mb_wm_comp_mgr_clutter_sum_gaussian (gaussian_map, opacity,
-					   center, center, WIDTH, HEIGHT);
+  d = shadow->center;
 
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
@@ -2056,3 +2733,165 @@ tidy_texture_frame_new (ClutterTexture *texture,
 		       "bottom", bottom,
 		       NULL);
 }
+
+/*
+ * MBWMShapedTexture: a clone of a texture which only paints the parts of it
+ * inside the given rectangles, so that shaped windows need nothing cleared
+ * in their textures.
+ */
+#define MB_WM_TYPE_SHAPED_TEXTURE (mb_wm_shaped_texture_get_type ())
+
+#define MB_WM_SHAPED_TEXTURE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  MB_WM_TYPE_SHAPED_TEXTURE, MBWMShapedTexture))
+
+typedef struct _MBWMShapedTexture      MBWMShapedTexture;
+typedef struct _MBWMShapedTextureClass MBWMShapedTextureClass;
+
+struct _MBWMShapedTexture
+{
+  ClutterCloneTexture  parent;
+
+  /* Shape in texture coordinates, NULL while unknown */
+  XRectangle          *rects;
+  int                  n_rects;
+};
+
+struct _MBWMShapedTextureClass
+{
+  ClutterCloneTextureClass parent_class;
+};
+
+G_DEFINE_TYPE (MBWMShapedTexture,
+	       mb_wm_shaped_texture,
+	       CLUTTER_TYPE_CLONE_TEXTURE);
+
+static void
+mb_wm_shaped_texture_paint (ClutterActor *self)
+{
+  MBWMShapedTexture * shaped = MB_WM_SHAPED_TEXTURE (self);
+  ClutterTexture    * parent_texture;
+  ClutterColor        col = { 0xff, 0xff, 0xff, 0xff };
+  CoglHandle          cogl_texture;
+  guint               width, height;
+  guint               tex_width, tex_height;
+  int                 i;
+
+  if (!shaped->rects)
+    {
+      CLUTTER_ACTOR_CLASS (mb_wm_shaped_texture_parent_class)->paint (self);
+      return;
+    }
+
+  parent_texture =
+    clutter_clone_texture_get_parent_texture (CLUTTER_CLONE_TEXTURE (self));
+
+  if (!parent_texture)
+    return;
+
+  /* The parent texture is hidden, so we have to realize it ourselves */
+  if (!CLUTTER_ACTOR_IS_REALIZED (parent_texture))
+    clutter_actor_realize (CLUTTER_ACTOR (parent_texture));
+
+  cogl_texture = clutter_texture_get_cogl_texture (parent_texture);
+  if (cogl_texture == COGL_INVALID_HANDLE)
+    return;
+
+  tex_width  = cogl_texture_get_width (cogl_texture);
+  tex_height = cogl_texture_get_height (cogl_texture);
+
+  if (!tex_width || !tex_height)
+    return;
+
+  clutter_actor_get_size (self, &width, &height);
+
+  col.alpha = clutter_actor_get_paint_opacity (self);
+  cogl_color (&col);
+
+  for (i = 0; i < shaped->n_rects; ++i)
+    {
+      XRectangle * r  = &shaped->rects[i];
+      int          x1 = MAX (r->x, 0);
+      int          y1 = MAX (r->y, 0);
+      int          x2 = MIN (r->x + r->width,  (int) tex_width);
+      int          y2 = MIN (r->y + r->height, (int) tex_height);
+
+      if (x1 >= x2 || y1 >= y2)
+	continue;
+
+      cogl_texture_rectangle (cogl_texture,
+			      CLUTTER_FLOAT_TO_FIXED ((float) x1 * width
+						      / tex_width),
+			      CLUTTER_FLOAT_TO_FIXED ((float) y1 * height
+						      / tex_height),
+			      CLUTTER_FLOAT_TO_FIXED ((float) x2 * width
+						      / tex_width),
+			      CLUTTER_FLOAT_TO_FIXED ((float) y2 * height
+						      / tex_height),
+			      CLUTTER_INT_TO_FIXED (x1) / tex_width,
+			      CLUTTER_INT_TO_FIXED (y1) / tex_height,
+			      CLUTTER_INT_TO_FIXED (x2) / tex_width,
+			      CLUTTER_INT_TO_FIXED (y2) / tex_height);
+    }
+}
+
+static void
+mb_wm_shaped_texture_finalize (GObject *object)
+{
+  MBWMShapedTexture * shaped = MB_WM_SHAPED_TEXTURE (object);
+
+  g_free (shaped->rects);
+
+  G_OBJECT_CLASS (mb_wm_shaped_texture_parent_class)->finalize (object);
+}
+
+static void
+mb_wm_shaped_texture_class_init (MBWMShapedTextureClass *klass)
+{
+  GObjectClass      *gobject_class = G_OBJECT_CLASS (klass);
+  ClutterActorClass *actor_class = CLUTTER_ACTOR_CLASS (klass);
+
+  actor_class->paint = mb_wm_shaped_texture_paint;
+
+  gobject_class->finalize = mb_wm_shaped_texture_finalize;
+}
+
+static void
+mb_wm_shaped_texture_init (MBWMShapedTexture *self)
+{
+}
+
+static ClutterActor *
+mb_wm_shaped_texture_new (ClutterTexture *texture)
+{
+  g_return_val_if_fail (texture == NULL || CLUTTER_IS_TEXTURE (texture), NULL);
+
+  return g_object_new (MB_WM_TYPE_SHAPED_TEXTURE,
+		       "parent-texture", texture,
+		       NULL);
+}
+
+/*
+ * Sets the shape, in texture coordinates; with no rectangles the whole
+ * texture is painted.
+ */
+static void
+mb_wm_shaped_texture_set_shape (ClutterActor *self,
+				XRectangle   *rects,
+				int           n_rects)
+{
+  MBWMShapedTexture * shaped = MB_WM_SHAPED_TEXTURE (self);
+
+  g_free (shaped->rects);
+
+  shaped->rects   = NULL;
+  shaped->n_rects = 0;
+
+  if (rects && n_rects)
+    {
+      shaped->rects   = g_memdup (rects, n_rects * sizeof (XRectangle));
+      shaped->n_rects = n_rects;
+    }
+
+  clutter_actor_queue_redraw (self);
+}
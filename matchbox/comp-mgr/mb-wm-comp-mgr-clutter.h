@@ -46,6 +46,8 @@ typedef enum
   MBWMCompMgrClutterClientDontUpdate    = (1<<1),
   MBWMCompMgrClutterClientDone          = (1<<2),
   MBWMCompMgrClutterClientEffectRunning = (1<<3),
+  MBWMCompMgrClutterClientDamageDeferred = (1<<4),
+  MBWMCompMgrClutterClientMoving        = (1<<5),
 } MBWMCompMgrClutterClientFlags;
 
 struct _MBWMCompMgrClutter
@@ -105,4 +107,19 @@ mb_wm_comp_mgr_clutter_get_nth_desktop (MBWMCompMgrClutter *cmgr, int desktop);
 ClutterActor *
 mb_wm_comp_mgr_clutter_get_arena (MBWMCompMgrClutter *cmgr);
 
+void
+mb_wm_comp_mgr_clutter_set_texture_budget (MBWMCompMgrClutter *cmgr,
+					   unsigned long       bytes);
+
+void
+mb_wm_comp_mgr_clutter_get_texture_stats (MBWMCompMgrClutter *cmgr,
+					  unsigned long      *current,
+					  unsigned long      *peak);
+
+void
+mb_wm_comp_mgr_clutter_get_redraw_stats (MBWMCompMgrClutter *cmgr,
+					 unsigned long      *frames,
+					 unsigned long      *pixels,
+					 unsigned long      *last);
+
 #endif
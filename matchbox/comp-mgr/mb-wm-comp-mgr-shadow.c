@@ -0,0 +1,162 @@
+/*
+ *  Matchbox Window Manager - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "mb-wm.h"
+#include "mb-wm-comp-mgr-shadow.h"
+
+#include <math.h>
+
+/*
+ * Shadows already computed; there is rarely more than one.
+ */
+static MBWMList * shadow_cache = NULL;
+
+/*
+ * The shadow is the window rectangle convolved with a gaussian. The
+ * gaussian is separable and the rectangle is larger than the shadow tiles,
+ * so the alpha at any point is the product of the part of the 1D kernel
+ * falling inside the rectangle horizontally and vertically; the 1D parts
+ * are just the suffix sums of the kernel.
+ *
+ * Fills profile with the part of the kernel inside the rectangle at each of
+ * the n offsets from its edge, starting at offset start.
+ */
+static void
+mb_wm_comp_mgr_gaussian_shadow_profile (double radius,
+					int    size,
+					int    start,
+					int    n,
+					double *profile)
+{
+  double * kernel;
+  double * suffix;
+  double   total = 0.0;
+  int      center = size / 2;
+  int      i;
+
+  kernel = malloc ((2 * size + 1) * sizeof (double));
+  suffix = kernel + size;
+
+  for (i = 0; i < size; i++)
+    {
+      double x = (double) (i - center);
+
+      kernel[i] = exp (- (x * x) / (2 * radius * radius));
+      total += kernel[i];
+    }
+
+  suffix[size] = 0.0;
+
+  for (i = size - 1; i >= 0; i--)
+    suffix[i] = suffix[i + 1] + kernel[i] / total;
+
+  for (i = 0; i < n; i++)
+    {
+      int first = center - (start + i);
+
+      if (first < 0)
+	first = 0;
+      else if (first > size)
+	first = size;
+
+      profile[i] = suffix[first];
+    }
+
+  free (kernel);
+}
+
+static unsigned char
+mb_wm_comp_mgr_gaussian_shadow_alpha (double v, double opacity)
+{
+  if (v > 1)
+    v = 1;
+
+  return (unsigned char) (unsigned int) (v * opacity * 255.0);
+}
+
+static MBWMCompMgrGaussianShadow *
+mb_wm_comp_mgr_gaussian_shadow_new (double radius, double opacity)
+{
+  MBWMCompMgrGaussianShadow * shadow;
+  double                      profile[MB_WM_COMP_MGR_SHADOW_TILE_SZ];
+  double                      row[MB_WM_COMP_MGR_SHADOW_TILE_SZ];
+  int                         tile = MB_WM_COMP_MGR_SHADOW_TILE_SZ;
+  int                         size = ((int) ceil ((radius * 3)) + 1) & ~1;
+  int                         center = size / 2;
+  int                         x, y;
+
+  shadow = mb_wm_util_malloc0 (sizeof (MBWMCompMgrGaussianShadow));
+
+  shadow->radius  = radius;
+  shadow->opacity = opacity;
+  shadow->size    = size;
+
+  mb_wm_comp_mgr_gaussian_shadow_profile (radius, size, -center, tile,
+					  profile);
+
+  /* Across an edge only one direction is partly outside the rectangle */
+  for (x = 0; x < tile; x++)
+    shadow->edge[x] =
+      mb_wm_comp_mgr_gaussian_shadow_alpha (profile[x], opacity);
+
+  shadow->center = mb_wm_comp_mgr_gaussian_shadow_alpha (1.0, opacity);
+
+  /*
+   * The corner is the outer product of the profile with itself; keep the
+   * inner loop free of anything that stops it being vectorized.
+   */
+  for (y = 0; y < tile; y++)
+    {
+      unsigned char * dst = &shadow->corner[y * tile];
+      double          py  = profile[y];
+
+      for (x = 0; x < tile; x++)
+	row[x] = profile[x] * py;
+
+      for (x = 0; x < tile; x++)
+	dst[x] = mb_wm_comp_mgr_gaussian_shadow_alpha (row[x], opacity);
+    }
+
+  return shadow;
+}
+
+/*
+ * Returns the gaussian shadow of the given radius and opacity; it is
+ * computed the first time it is asked for and cached for the lifetime of
+ * the process, so the result must not be freed.
+ */
+const MBWMCompMgrGaussianShadow *
+mb_wm_comp_mgr_gaussian_shadow_get (double radius, double opacity)
+{
+  MBWMCompMgrGaussianShadow * shadow;
+  MBWMList                  * l;
+
+  for (l = shadow_cache; l; l = l->next)
+    {
+      shadow = l->data;
+
+      if (shadow->radius == radius && shadow->opacity == opacity)
+	return shadow;
+    }
+
+  shadow = mb_wm_comp_mgr_gaussian_shadow_new (radius, opacity);
+
+  shadow_cache = mb_wm_util_list_prepend (shadow_cache, shadow);
+
+  return shadow;
+}
@@ -0,0 +1,50 @@
+/*
+ *  Matchbox Window Manager - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_MB_WM_COMP_MGR_SHADOW_H
+#define _HAVE_MB_WM_COMP_MGR_SHADOW_H
+
+/* Size of the tiles gaussian shadows are built from */
+#define MB_WM_COMP_MGR_SHADOW_TILE_SZ 16
+
+/*
+ * The alpha values of a gaussian shadow of a given radius and opacity,
+ * shared by the compositors.
+ *
+ * corner holds the top left corner tile, indexed [y * tile + x]; the other
+ * corners are its mirror images. edge holds the alpha going into the shadow
+ * from its top edge, which is the same for the other edges, and center the
+ * alpha of the inside of the shadow. size is the size of the gaussian
+ * kernel, which is the padding the shadow adds around the window.
+ */
+typedef struct MBWMCompMgrGaussianShadow
+{
+  double          radius;
+  double          opacity;
+  int             size;
+
+  unsigned char   corner[MB_WM_COMP_MGR_SHADOW_TILE_SZ *
+			 MB_WM_COMP_MGR_SHADOW_TILE_SZ];
+  unsigned char   edge[MB_WM_COMP_MGR_SHADOW_TILE_SZ];
+  unsigned char   center;
+} MBWMCompMgrGaussianShadow;
+
+const MBWMCompMgrGaussianShadow *
+mb_wm_comp_mgr_gaussian_shadow_get (double radius, double opacity);
+
+#endif
@@ -23,19 +23,66 @@
 #include "mb-wm-client.h"
 #include "mb-wm-comp-mgr.h"
 #include "mb-wm-comp-mgr-xrender.h"
-
-#include <math.h>
+#include "mb-wm-comp-mgr-shadow.h"
+#include "mb-wm-theme.h"
 
 #include <X11/Xresource.h>
+#include <X11/Xutil.h>
+#include <X11/Xregion.h>
+#include <X11/extensions/shape.h>
 #include <X11/extensions/Xdamage.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/Xcomposite.h>
 
+#ifdef HAVE_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#endif
+
 #define SHADOW_RADIUS 6
 #define SHADOW_OPACITY	0.75
 #define SHADOW_OFFSET_X	(-SHADOW_RADIUS)
 #define SHADOW_OFFSET_Y	(-SHADOW_RADIUS)
 
+/* Number of unused gaussian shadow pictures kept around */
+#define SHADOW_CACHE_SIZE 8
+
+/*
+ * Beyond this many rectangles the damage of a frame is repainted as its
+ * bounding box.
+ */
+#define MAX_DAMAGE_RECTS 64
+
+/*
+ * A gaussian shadow picture of a given size, shared by all clients of that
+ * size.
+ */
+typedef struct MBWMCompMgrDefaultShadow
+{
+  int      width;
+  int      height;
+  Picture  picture;
+  int      refs;
+} MBWMCompMgrDefaultShadow;
+
+/*
+ * The picture of a client window. Besides the client, each scene showing
+ * the client holds a reference, so that the picture stays around until
+ * the frame has been painted.
+ */
+typedef struct MBWMCompMgrDefaultPicture
+{
+  Picture  picture;
+  int      refs;
+} MBWMCompMgrDefaultPicture;
+
 /*
  * A helper object to store manager's per-client data
  */
@@ -45,11 +92,56 @@ struct MBWMCompMgrDefaultClient
 
   int		          damaged;
   Damage	          damage;
-  Picture	          picture;
-  XserverRegion	          extents;
-  XserverRegion	          border_clip;
+  MBWMCompMgrDefaultPicture *picture;
+  XRectangle              extents;
+
+  /*
+   * Coverage as of the last show/configure, and the bounding region of the
+   * window and of its decors in root coordinates (NULL until needed); all
+   * follow moves.
+   */
+  MBGeometry              geom;
+  Region                  border;
+  Region                  decors;
+
+  /*
+   * Position the client is shown at while it is being moved interactively,
+   * see mb_wm_comp_mgr_client_move ().
+   */
+  Bool                    moving;
+  int                     move_x;
+  int                     move_y;
+
+  MBWMCompMgrDefaultShadow *shadow;
+
+  /*
+   * Occlusion data, see mb_wm_comp_mgr_xrender_update_visibility ();
+   * opaque is the part of the screen the client paints solid (NULL when it
+   * needs recomputing), paint_clip the part of the screen not covered by
+   * opaque clients above and shadow_clip the same, less the client itself.
+   * translucent and solid classify the client as of the last update.
+   */
+  Region                  opaque;
+  Bool                    translucent;
+  Bool                    solid;
+  Bool                    occluded;
+  Region                  paint_clip;
+  Region                  shadow_clip;
+
+  /* Damage held back by the rate limiting, root coordinates */
+  Region                  deferred;
+
+  unsigned long           sig_prop_change_id;
 };
 
+static void
+mb_wm_comp_mgr_xrender_shadow_unref (MBWMCompMgr              *mgr,
+				     MBWMCompMgrDefaultShadow *shadow);
+
+static void
+mb_wm_comp_mgr_xrender_picture_unref (Display                   *xdpy,
+				      MBWMCompMgrDefaultPicture *picture);
+
 static void
 mb_wm_comp_mgr_xrender_client_show_real (MBWMCompMgrClient * client);
 
@@ -63,6 +155,16 @@ static void
 mb_wm_comp_mgr_xrender_client_configure_real (MBWMCompMgrClient * client,
                                               MBGeometry * geometry);
 
+static void
+mb_wm_comp_mgr_xrender_client_move_real (MBWMCompMgrClient * client,
+					 MBGeometry        * geometry);
+
+static void
+mb_wm_comp_mgr_xrender_client_release_real (MBWMCompMgrClient * client);
+
+static unsigned long
+mb_wm_comp_mgr_xrender_client_resource_bytes_real (MBWMCompMgrClient * client);
+
 static void
 mb_wm_comp_mgr_xrender_client_class_init (MBWMObjectClass *klass)
 {
@@ -72,12 +174,20 @@ mb_wm_comp_mgr_xrender_client_class_init (MBWMObjectClass *klass)
   c_klass->hide      = mb_wm_comp_mgr_xrender_client_hide_real;
   c_klass->repair    = mb_wm_comp_mgr_xrender_client_repair_real;
   c_klass->configure = mb_wm_comp_mgr_xrender_client_configure_real;
+  c_klass->move      = mb_wm_comp_mgr_xrender_client_move_real;
+  c_klass->release   = mb_wm_comp_mgr_xrender_client_release_real;
+  c_klass->resource_bytes = mb_wm_comp_mgr_xrender_client_resource_bytes_real;
 
 #if MBWM_WANT_DEBUG
   klass->klass_name = "MBWMCompMgrDefaultClient";
 #endif
 }
 
+static Bool
+mb_wm_comp_mgr_xrender_client_on_property_change (MBWMClientWindow * window,
+						  int                property,
+						  void             * userdata);
+
 static int
 mb_wm_comp_mgr_xrender_client_init (MBWMObject *obj, va_list vap)
 {
@@ -89,6 +199,17 @@ mb_wm_comp_mgr_xrender_client_init (MBWMObject *obj, va_list vap)
   if (!wm_client || !wm_client->wmref)
     return 0;
 
+  /*
+   * The translucency and the modal state feed the cached stacking state,
+   * see mb_wm_comp_mgr_xrender_update_visibility ().
+   */
+  dclient->sig_prop_change_id =
+    mb_wm_object_signal_connect (MB_WM_OBJECT (wm_client->window),
+		 MBWM_WINDOW_PROP_CM_TRANSLUCENCY | MBWM_WINDOW_PROP_NET_STATE,
+		 (MBWMObjectCallbackFunc)
+		 mb_wm_comp_mgr_xrender_client_on_property_change,
+		 client);
+
   return 1;
 }
 
@@ -101,17 +222,36 @@ mb_wm_comp_mgr_xrender_client_destroy (MBWMObject* obj)
 
   mb_wm_comp_mgr_client_hide (c);
 
+  if (dc->sig_prop_change_id)
+    mb_wm_object_signal_disconnect (MB_WM_OBJECT (c->wm_client->window),
+				    dc->sig_prop_change_id);
+
+  if (dc->shadow)
+    mb_wm_comp_mgr_xrender_shadow_unref (wm->comp_mgr, dc->shadow);
+
   if (dc->damage)
     XDamageDestroy (wm->xdpy, dc->damage);
 
   if (dc->picture)
-    XRenderFreePicture (wm->xdpy, dc->picture);
+    mb_wm_comp_mgr_xrender_picture_unref (wm->xdpy, dc->picture);
+
+  if (dc->border)
+    XDestroyRegion (dc->border);
+
+  if (dc->decors)
+    XDestroyRegion (dc->decors);
 
-  if (dc->extents)
-    XFixesDestroyRegion (wm->xdpy, dc->extents);
+  if (dc->paint_clip)
+    XDestroyRegion (dc->paint_clip);
 
-  if (dc->border_clip)
-    XFixesDestroyRegion (wm->xdpy, dc->border_clip);
+  if (dc->shadow_clip)
+    XDestroyRegion (dc->shadow_clip);
+
+  if (dc->opaque)
+    XDestroyRegion (dc->opaque);
+
+  if (dc->deferred)
+    XDestroyRegion (dc->deferred);
 }
 
 int
@@ -152,10 +292,42 @@ mb_wm_comp_mgr_xrender_client_new (MBWindowManagerClient * client)
 }
 
 static void
-mb_wm_comp_mgr_xrender_add_damage (MBWMCompMgr * mgr, XserverRegion damage);
+mb_wm_comp_mgr_xrender_add_damage (MBWMCompMgr * mgr, XRectangle * rect);
 
-static XserverRegion
-mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient *client);
+static void
+mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient * client,
+				       XRectangle        * extents);
+
+static void
+mb_wm_comp_mgr_xrender_invalidate_visibility (MBWMCompMgr       * mgr,
+					      MBWMCompMgrClient * client);
+
+static void
+mb_wm_comp_mgr_xrender_client_create_picture (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrDefaultClient * dclient   = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManagerClient    * wm_client = client->wm_client;
+  MBWindowManager          * wm        = client->wm;
+  XRenderPictureAttributes   pa;
+
+  pa.subwindow_mode = IncludeInferiors;
+
+  dclient->picture = mb_wm_util_malloc0 (sizeof (MBWMCompMgrDefaultPicture));
+  dclient->picture->refs = 1;
+  dclient->picture->picture =
+    XRenderCreatePicture (wm->xdpy,
+			  wm_client->xwin_frame ?
+			  wm_client->xwin_frame :
+			  wm_client->window->xwindow,
+			  client->is_argb32 ?
+			  XRenderFindStandardFormat (wm->xdpy,
+						     PictStandardARGB32)
+
+			  : XRenderFindVisualFormat (wm->xdpy,
+						     wm_client->window->visual),
+			  CPSubwindowMode,
+			  &pa);
+}
 
 static void
 mb_wm_comp_mgr_xrender_client_hide_real (MBWMCompMgrClient * client)
@@ -169,7 +341,7 @@ mb_wm_comp_mgr_xrender_client_hide_real (MBWMCompMgrClient * client)
 
   if (is_modal && ((c = mb_wm_get_visible_main_client (wm)) != NULL))
     {
-      XserverRegion extents;
+      XRectangle extents;
       /* We need to make sure the any lowlighting on a 'parent'
        * modal for app gets cleared. This is kind of a sledgehammer
        * approach to it, but more suttle attempts oddly fail at times.
@@ -178,8 +350,8 @@ mb_wm_comp_mgr_xrender_client_hide_real (MBWMCompMgrClient * client)
        *        - there may be a better way.
        */
       mb_wm_comp_mgr_xrender_client_repair_real (c->cm_client);
-      extents = mb_wm_comp_mgr_xrender_client_extents (c->cm_client);
-      mb_wm_comp_mgr_xrender_add_damage (mgr, extents);
+      mb_wm_comp_mgr_xrender_client_extents (c->cm_client, &extents);
+      mb_wm_comp_mgr_xrender_add_damage (mgr, &extents);
     }
 
   if (dclient->damage)
@@ -188,16 +360,142 @@ mb_wm_comp_mgr_xrender_client_hide_real (MBWMCompMgrClient * client)
       dclient->damage = None;
     }
 
-  if (dclient->extents)
+  if (dclient->extents.width)
     {
-      mb_wm_comp_mgr_xrender_add_damage (mgr, dclient->extents);
-      dclient->extents = None;
+      mb_wm_comp_mgr_xrender_add_damage (mgr, &dclient->extents);
+      memset (&dclient->extents, 0, sizeof (XRectangle));
     }
 
+  /* Covered by the extents anyway */
+  if (dclient->deferred)
+    XSubtractRegion (dclient->deferred, dclient->deferred, dclient->deferred);
+
+  if (dclient->picture)
+    {
+      mb_wm_comp_mgr_xrender_picture_unref (wm->xdpy, dclient->picture);
+      dclient->picture = NULL;
+    }
+
+  mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, client);
+}
+
+/*
+ * Drops a reference to a client picture, freeing it with the last one.
+ */
+static void
+mb_wm_comp_mgr_xrender_picture_unref (Display                   *xdpy,
+				      MBWMCompMgrDefaultPicture *picture)
+{
+  if (--picture->refs)
+    return;
+
+  XRenderFreePicture (xdpy, picture->picture);
+  free (picture);
+}
+
+/*
+ * Drops everything we hold for an unmapped client, all of which is created
+ * again as needed once the client is shown. Clients hidden from the desktop
+ * never got hidden here, so may still have their picture and damage.
+ */
+static void
+mb_wm_comp_mgr_xrender_client_release_real (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrDefaultClient * dclient = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManager          * wm      = client->wm;
+
+  if (mb_wm_client_is_mapped (client->wm_client))
+    return;
+
+  if (dclient->picture || dclient->damage)
+    mb_wm_comp_mgr_xrender_client_hide_real (client);
+
+  if (dclient->shadow)
+    {
+      mb_wm_comp_mgr_xrender_shadow_unref (wm->comp_mgr, dclient->shadow);
+      dclient->shadow = NULL;
+    }
+
+  if (dclient->border)
+    {
+      XDestroyRegion (dclient->border);
+      dclient->border = NULL;
+    }
+
+  if (dclient->decors)
+    {
+      XDestroyRegion (dclient->decors);
+      dclient->decors = NULL;
+    }
+
+  if (dclient->paint_clip)
+    {
+      XDestroyRegion (dclient->paint_clip);
+      dclient->paint_clip = NULL;
+    }
+
+  if (dclient->shadow_clip)
+    {
+      XDestroyRegion (dclient->shadow_clip);
+      dclient->shadow_clip = NULL;
+    }
+
+  if (dclient->opaque)
+    {
+      XDestroyRegion (dclient->opaque);
+      dclient->opaque = NULL;
+    }
+
+  if (dclient->deferred)
+    {
+      XDestroyRegion (dclient->deferred);
+      dclient->deferred = NULL;
+    }
+}
+
+/*
+ * The pixels we keep alive for the client: the window contents while it is
+ * shown, which the server holds because the window is redirected, and our
+ * share of its shadow. Regions are too small to matter.
+ */
+static unsigned long
+mb_wm_comp_mgr_xrender_client_resource_bytes_real (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrDefaultClient * dclient = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  unsigned long              bytes   = 0;
+
   if (dclient->picture)
     {
-      XRenderFreePicture (wm->xdpy, dclient->picture);
-      dclient->picture = None;
+      MBGeometry geom;
+
+      mb_wm_client_get_coverage (client->wm_client, &geom);
+
+      bytes += (unsigned long) geom.width * geom.height * 4;
+    }
+
+  if (dclient->shadow && dclient->shadow->refs)
+    bytes += (unsigned long) dclient->shadow->width * dclient->shadow->height
+      / dclient->shadow->refs;
+
+  return bytes;
+}
+
+/*
+ * Where the client is to be painted: its coverage, unless it is being moved
+ * interactively.
+ */
+static void
+mb_wm_comp_mgr_xrender_client_get_geometry (MBWMCompMgrClient * client,
+					    MBGeometry        * geom)
+{
+  MBWMCompMgrDefaultClient * dclient = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+
+  mb_wm_client_get_coverage (client->wm_client, geom);
+
+  if (dclient->moving)
+    {
+      geom->x = dclient->move_x;
+      geom->y = dclient->move_y;
     }
 }
 
@@ -208,8 +506,7 @@ mb_wm_comp_mgr_xrender_client_show_real (MBWMCompMgrClient * client)
   MBWindowManagerClient    * wm_client = client->wm_client;
   MBWindowManager          * wm        = client->wm;
   MBWMCompMgr              * mgr       = wm->comp_mgr;
-  XserverRegion              region;
-  XRenderPictureAttributes   pa;
+  XRectangle                 extents;
   MBWMClientType             ctype = MB_WM_CLIENT_CLIENT_TYPE (wm_client);
   Bool                       is_modal;
 
@@ -218,36 +515,31 @@ mb_wm_comp_mgr_xrender_client_show_real (MBWMCompMgrClient * client)
    *  some memory in the server.
    */
   if (!dclient->picture)
-    {
-      pa.subwindow_mode = IncludeInferiors;
+    mb_wm_comp_mgr_xrender_client_create_picture (client);
 
-      dclient->picture =
-	XRenderCreatePicture (wm->xdpy,
-			      wm_client->xwin_frame ?
-			      wm_client->xwin_frame :
-			      wm_client->window->xwindow,
-			      client->is_argb32 ?
-			      XRenderFindStandardFormat (wm->xdpy,
-							 PictStandardARGB32)
+  if (dclient->damage == None)
+    {
+      dclient->damage = XDamageCreate (wm->xdpy,
+				       wm_client->xwin_frame ?
+				       wm_client->xwin_frame :
+				       wm_client->window->xwindow,
+				       XDamageReportDeltaRectangles);
 
-			      : XRenderFindVisualFormat (wm->xdpy,
-						 wm_client->window->visual),
-			      CPSubwindowMode,
-			      &pa);
+      dclient->damaged = False;
     }
 
-  if (dclient->damage != None)
-    XDamageDestroy (wm->xdpy, dclient->damage);
+  /* The shape may have changed while we were not looking */
+  if (dclient->border)
+    {
+      XDestroyRegion (dclient->border);
+      dclient->border = NULL;
+    }
 
-  dclient->damage = XDamageCreate (wm->xdpy,
-				   wm_client->xwin_frame ?
-				   wm_client->xwin_frame :
-				   wm_client->window->xwindow,
-				   XDamageReportNonEmpty);
+  mb_wm_comp_mgr_xrender_client_get_geometry (client, &dclient->geom);
 
-  region = mb_wm_comp_mgr_xrender_client_extents (client);
+  mb_wm_comp_mgr_xrender_client_extents (client, &extents);
 
-  mb_wm_comp_mgr_xrender_add_damage (mgr, region);
+  mb_wm_comp_mgr_xrender_add_damage (mgr, &extents);
 
   /*
    * If the wm client is modal we have to add its parent to the damage
@@ -260,17 +552,18 @@ mb_wm_comp_mgr_xrender_client_show_real (MBWMCompMgrClient * client)
 
       if (parent && parent->cm_client)
 	{
-	  XserverRegion extents =
-	    mb_wm_comp_mgr_xrender_client_extents (parent->cm_client);
+	  mb_wm_comp_mgr_xrender_client_extents (parent->cm_client, &extents);
 
-	  mb_wm_comp_mgr_xrender_add_damage (mgr, extents);
+	  mb_wm_comp_mgr_xrender_add_damage (mgr, &extents);
 	}
     }
 
-  if (!dclient->extents)
+  if (!dclient->extents.width)
     {
-      dclient->extents = mb_wm_comp_mgr_xrender_client_extents (client);
+      mb_wm_comp_mgr_xrender_client_extents (client, &dclient->extents);
     }
+
+  mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, client);
 }
 
 
@@ -278,17 +571,174 @@ mb_wm_comp_mgr_xrender_client_show_real (MBWMCompMgrClient * client)
  * The Manager itself
  */
 
-typedef struct MBGaussianMap
+/*
+ * Rendering
+ *
+ * Each frame the scene is captured on the wm side into a
+ * MBWMCompMgrDefaultScene, which is then painted by a renderer that looks
+ * at nothing but the scene and the parts of the private data which do not
+ * change after the set up (the solid pictures and the shadow parameters).
+ * The renderer either paints straight away on the wm connection, or, with
+ * the threaded compositor, on a thread with an X connection of its own.
+ *
+ * The scene owns everything it refers to: the regions are client side
+ * copies, uploaded by the renderer on its own connection, and it holds
+ * references to the pictures, which the wm thread only drops once the
+ * scene has been retired by the renderer.
+ */
+typedef enum MBWMCompMgrDefaultSceneFlags
+{
+  MBWMCompMgrDefaultSceneSolid       = (1<<0),
+  MBWMCompMgrDefaultSceneOccluded    = (1<<1),
+  MBWMCompMgrDefaultSceneArgb32      = (1<<2),
+  MBWMCompMgrDefaultSceneTranslucent = (1<<3),
+  MBWMCompMgrDefaultSceneShadowed    = (1<<4),
+  MBWMCompMgrDefaultSceneLowlight    = (1<<5),
+} MBWMCompMgrDefaultSceneFlags;
+
+typedef struct MBWMCompMgrDefaultSceneClient
+{
+  unsigned int    flags;
+  Picture         picture;
+  Picture         shadow;       /* gaussian shadow, if any */
+  MBGeometry      geom;         /* coverage */
+  MBGeometry      win_geom;     /* client window, relative to the coverage */
+  int             title_offset; /* part of the client left out of lowlight */
+  Region          paint_clip;
+  Region          shadow_clip;
+  Region          border;       /* simple shadows only */
+  Region          decors;       /* translucent clients only */
+
+  /* The references keeping picture and shadow alive */
+  MBWMCompMgrDefaultPicture * picture_ref;
+  MBWMCompMgrDefaultShadow  * shadow_ref;
+} MBWMCompMgrDefaultSceneClient;
+
+/*
+ * The clients are listed top to bottom, down to the first solid main
+ * client; shadows and translucent contents are then painted bottom to top
+ * starting with the client at shadow_start. The scene owns the damage, NULL
+ * meaning the whole screen.
+ */
+typedef struct MBWMCompMgrDefaultScene
+{
+  int                             width;
+  int                             height;
+  int                             lowlight; /*0 none, 1 app, 2 full*/
+  Bool                            fully_covered;
+  Region                          uncovered;
+  Region                          damage;
+
+  MBWMCompMgrDefaultSceneClient * clients;
+  int                             n_clients;
+  int                             shadow_start;
+} MBWMCompMgrDefaultScene;
+
+/*
+ * Server side state of a renderer; only ever touched by the thread doing
+ * the rendering.
+ */
+typedef struct MBWMCompMgrDefaultRenderer
 {
-  int	     size;
-  double * data;
-} MBGaussianMap;
+  Display           * xdpy;
+  Window              root;
+  int                 depth;
+  XRenderPictFormat * format;
 
+  Picture             root_picture;
+  Picture             root_buffer;
 
-struct MBWMCompMgrDefaultPrivate
+  /* Back buffer painted by the current frame */
+  Picture             buffer;
+
+  XserverRegion       damage;
+  XserverRegion       paint;
+  XserverRegion       scratch;
+
+  /* Takes the scene regions, one at a time */
+  XserverRegion       clip;
+
+  /* Damage not covered by anything opaque, one per scene client */
+  XserverRegion     * border_clips;
+  int                 n_border_clips;
+
+  /* Present statistics, see mb_wm_comp_mgr_xrender_get_present_stats () */
+  unsigned long       n_frames;
+  unsigned long       presented_pixels;
+  XRectangle          last_present;
+
+#ifdef HAVE_XPRESENT
+  /*
+   * With the Present extension, frames are painted into two back pixmaps in
+   * turn and shown in the composite overlay window at the vertical blank;
+   * missed holds, for each of the two, the damage painted into the other
+   * one since it was last painted itself.
+   */
+  Bool                present;
+  int                 present_opcode;
+  XID                 present_eid;
+  Window              overlay;
+  Pixmap              back[2];
+  Picture             back_picture[2];
+  Bool                back_busy[2];
+  Region              missed[2];
+  int                 current;
+  Bool                present_pending;
+  unsigned int        present_serial;
+  XserverRegion       update;
+#endif
+
+  /* Frame timing, see mb_wm_comp_mgr_xrender_get_present_timing () */
+  unsigned long       n_completed;
+  unsigned long long  last_ust;
+  unsigned long long  last_msc;
+  unsigned long       refresh_interval;
+} MBWMCompMgrDefaultRenderer;
+
+#ifdef HAVE_PTHREAD
+/* Scenes in flight to the render thread; must be a power of two */
+#define RENDER_QUEUE_SIZE 4
+
+/*
+ * A single producer, single consumer ring of scenes: tail is only written
+ * by the producer, head only by the consumer, and each push is signalled
+ * through the pipe.
+ */
+typedef struct MBWMCompMgrDefaultSceneQueue
+{
+  MBWMCompMgrDefaultScene    * scenes[RENDER_QUEUE_SIZE];
+  volatile unsigned int        head;
+  volatile unsigned int        tail;
+  int                          fds[2];
+} MBWMCompMgrDefaultSceneQueue;
+
+/*
+ * The render thread. Scenes go to the thread through queue and come back
+ * through retired once painted or skipped, to be freed on the wm thread;
+ * as no more than RENDER_QUEUE_SIZE scenes are ever handed over at a time,
+ * neither ring can overflow.
+ */
+typedef struct MBWMCompMgrDefaultRenderThread
 {
-  MBGaussianMap  * gaussian_map;
+  MBWMCompMgrDefaultRenderer   renderer;
+  MBWMCompMgrDefaultPrivate  * priv;
+
+  pthread_t                    thread;
+  volatile Bool                quit;
+
+  MBWMCompMgrDefaultSceneQueue queue;
+  MBWMCompMgrDefaultSceneQueue retired;
+
+  /* Scenes handed over and not retired yet; wm thread only */
+  int                          n_scenes;
+  MBWMIOChannel              * channel;
+  unsigned long                watch_id;
+} MBWMCompMgrDefaultRenderThread;
+#endif
+
 
+struct MBWMCompMgrDefaultPrivate
+{
   Picture          shadow_n_pic;
   Picture          shadow_e_pic;
   Picture          shadow_s_pic;
@@ -313,21 +763,68 @@ struct MBWMCompMgrDefaultPrivate
   Picture          lowlight_picture;
   unsigned int     lowlight_params[4]; /* RGBA */
 
-  Picture	   root_picture;
-  Picture	   root_buffer;
-
-  XserverRegion    all_damage;
+  Region           damage;
   Bool             dialog_shade;
+
+  /* Gaussian shadow pictures, most recently used first */
+  MBWMList       * shadow_cache;
+  int              n_shadows;
+
+  /*
+   * Occlusion and stacking state; recomputed by the next render after a
+   * stacking, geometry, mapping, translucency or modal state change.
+   */
+  Bool                    visibility_dirty;
+  MBWindowManagerClient * solid_client;
+  MBWindowManagerClient * top_client;
+  Bool                    top_translucent;
+  int                     lowlight; /*0 none, 1 app, 2 full*/
+  Region                  uncovered;
+  Bool                    fully_covered;
+
+  /* Timeout folding deferred client damage into the next frame */
+  unsigned long           deferred_id;
+
+  /* Frame of the fullscreen client we stopped redirecting for, if any */
+  Window                  unredirected;
+
+  /* Paints the scenes, unless the render thread does */
+  MBWMCompMgrDefaultRenderer renderer;
+
+#ifdef HAVE_PTHREAD
+  MBWMCompMgrDefaultRenderThread * thread;
+#endif
+
+  /* Timeout retrying a frame the render thread had no room for */
+  unsigned long           retry_id;
+
+  /* Presented frame completion, when rendering on the wm connection */
+  unsigned long           present_handler_id;
+  Bool                    frame_pending;
 };
 
+static void
+mb_wm_comp_mgr_xrender_renderer_fini (MBWMCompMgrDefaultRenderer * r);
+
 static void
 mb_wm_comp_mgr_xrender_private_free (MBWMCompMgrDefault *mgr)
 {
   MBWMCompMgrDefaultPrivate * priv = mgr->priv;
-  Display                   * xdpy = MB_WM_COMP_MGR (mgr)->wm->xdpy;
+  MBWindowManager           * wm   = MB_WM_COMP_MGR (mgr)->wm;
+  Display                   * xdpy = wm->xdpy;
+
+
+  while (priv->shadow_cache)
+    {
+      MBWMList                 * l      = priv->shadow_cache;
+      MBWMCompMgrDefaultShadow * shadow = l->data;
+
+      XRenderFreePicture (xdpy, shadow->picture);
+      free (shadow);
 
-  if (priv->gaussian_map)
-    free (priv->gaussian_map);
+      priv->shadow_cache = l->next;
+      free (l);
+    }
 
   XRenderFreePicture (xdpy, priv->shadow_n_pic);
   XRenderFreePicture (xdpy, priv->shadow_e_pic);
@@ -345,18 +842,70 @@ mb_wm_comp_mgr_xrender_private_free (MBWMCompMgrDefault *mgr)
   XRenderFreePicture (xdpy, priv->lowlight_picture);
   XRenderFreePicture (xdpy, priv->trans_picture);
 
-  if (priv->root_picture)
-    XRenderFreePicture (xdpy, priv->root_picture);
+  mb_wm_comp_mgr_xrender_renderer_fini (&priv->renderer);
+
+  if (priv->damage)
+    XDestroyRegion (priv->damage);
 
-  if (priv->root_buffer)
-    XRenderFreePicture (xdpy, priv->root_buffer);
+  if (priv->deferred_id)
+    mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+					       priv->deferred_id);
 
-  if (priv->all_damage)
-    XDamageDestroy (xdpy, priv->all_damage);
+  if (priv->retry_id)
+    mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+					       priv->retry_id);
+
+  if (priv->uncovered)
+    XDestroyRegion (priv->uncovered);
 
   free (priv);
 }
 
+static void
+mb_wm_comp_mgr_xrender_invalidate_visibility (MBWMCompMgr       * mgr,
+					      MBWMCompMgrClient * client)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+
+  if (client)
+    {
+      MBWMCompMgrDefaultClient * dclient =
+	MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+
+      if (dclient->opaque)
+	{
+	  XDestroyRegion (dclient->opaque);
+	  dclient->opaque = NULL;
+	}
+
+      if (dclient->decors)
+	{
+	  XDestroyRegion (dclient->decors);
+	  dclient->decors = NULL;
+	}
+    }
+
+  priv->visibility_dirty = True;
+}
+
+static Bool
+mb_wm_comp_mgr_xrender_client_on_property_change (MBWMClientWindow * window,
+						  int                property,
+						  void             * userdata)
+{
+  MBWMCompMgrClient * client = userdata;
+
+  mb_wm_comp_mgr_xrender_invalidate_visibility (client->wm->comp_mgr, client);
+
+  return False;
+}
+
+static void
+mb_wm_comp_mgr_xrender_restack_real (MBWMCompMgr *mgr)
+{
+  mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, NULL);
+}
+
 static void
 mb_wm_comp_mgr_xrender_register_client_real (MBWMCompMgr           * mgr,
 					     MBWindowManagerClient * c)
@@ -398,6 +947,7 @@ mb_wm_comp_mgr_xrender_class_init (MBWMObjectClass *klass)
   cm_klass->turn_on           = mb_wm_comp_mgr_xrender_turn_on_real;
   cm_klass->turn_off          = mb_wm_comp_mgr_xrender_turn_off_real;
   cm_klass->render            = mb_wm_comp_mgr_xrender_render_real;
+  cm_klass->restack           = mb_wm_comp_mgr_xrender_restack_real;
   cm_klass->handle_damage     = mb_wm_comp_mgr_xrender_handle_damage;
 }
 
@@ -421,6 +971,8 @@ mb_wm_comp_mgr_xrender_init (MBWMObject *obj, va_list vap)
   priv->shadow_dx = SHADOW_OFFSET_X;
   priv->shadow_dy = SHADOW_OFFSET_Y;
 
+  priv->damage = XCreateRegion ();
+
   /* Not really used yet */
   priv->shadow_padding_width  = 0;
   priv->shadow_padding_height = 0;
@@ -481,102 +1033,7 @@ mb_wm_comp_mgr_xrender_class_type ()
 }
 
 /* Shadow Generation */
-static double
-gaussian (double r, double x, double y)
-{
-  return ((1 / (sqrt (2 * M_PI * r))) *
-	  exp ((- (x * x + y * y)) / (2 * r * r)));
-}
-
-
-static MBGaussianMap *
-mb_wm_comp_mgr_xrender_make_gaussian_map (double r)
-{
-  MBGaussianMap  *c;
-  int	          size = ((int) ceil ((r * 3)) + 1) & ~1;
-  int	          center = size / 2;
-  int	          x, y;
-  double          t = 0.0;
-  double          g;
-
-  c = malloc (sizeof (MBGaussianMap) + size * size * sizeof (double));
-  c->size = size;
-
-  c->data = (double *) (c + 1);
-
-  for (y = 0; y < size; y++)
-    for (x = 0; x < size; x++)
-      {
-	g = gaussian (r, (double) (x - center), (double) (y - center));
-	t += g;
-	c->data[y * size + x] = g;
-      }
-
-  for (y = 0; y < size; y++)
-    for (x = 0; x < size; x++)
-      c->data[y*size + x] /= t;
-
-  return c;
-}
-
-static unsigned char
-mb_wm_comp_mgr_xrender_sum_gaussian (MBWMCompMgr * mgr, double opacity,
-				     int x, int y, int width, int height)
-{
-  MBGaussianMap  * map = MB_WM_COMP_MGR_DEFAULT (mgr)->priv->gaussian_map;
-  int	           fx, fy;
-  double         * g_data;
-  double         * g_line = map->data;
-  int	           g_size = map->size;
-  int	           center = g_size / 2;
-  int	           fx_start, fx_end;
-  int	           fy_start, fy_end;
-  double           v;
-
-  /*
-   * Compute set of filter values which are "in range",
-   * that's the set with:
-   *	0 <= x + (fx-center) && x + (fx-center) < width &&
-   *  0 <= y + (fy-center) && y + (fy-center) < height
-   *
-   *  0 <= x + (fx - center)	x + fx - center < width
-   *  center - x <= fx	fx < width + center - x
-   */
-
-  fx_start = center - x;
-  if (fx_start < 0)
-    fx_start = 0;
-  fx_end = width + center - x;
-  if (fx_end > g_size)
-    fx_end = g_size;
-
-  fy_start = center - y;
-  if (fy_start < 0)
-    fy_start = 0;
-  fy_end = height + center - y;
-  if (fy_end > g_size)
-    fy_end = g_size;
-
-  g_line = g_line + fy_start * g_size + fx_start;
-
-  v = 0;
-  for (fy = fy_start; fy < fy_end; fy++)
-    {
-      g_data = g_line;
-      g_line += g_size;
-
-      for (fx = fx_start; fx < fx_end; fx++)
-	v += *g_data++;
-    }
-  if (v > 1)
-    v = 1;
-
-  return ((unsigned int) (v * opacity * 255.0));
-}
-
-#define MAX_TILE_SZ 16 	/* make sure size/2 < MAX_TILE_SZ */
-#define WIDTH  320
-#define HEIGHT 320
+#define MAX_TILE_SZ MB_WM_COMP_MGR_SHADOW_TILE_SZ
 
 static void
 mb_wm_comp_mgr_xrender_shadow_setup_part (MBWMCompMgr  * mgr,
@@ -625,15 +1082,13 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 {
   MBWindowManager            * wm = mgr->wm;
   MBWMCompMgrDefaultPrivate  * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  const MBWMCompMgrGaussianShadow * shadow;
   XImage	             * ximage;
   Pixmap                       pxm;
   unsigned char              * data;
-  int		               size;
-  int		               center;
   int		               x, y;
   unsigned char                d;
   int                          pwidth, pheight;
-  double                       opacity = SHADOW_OPACITY;
 
   if (priv->shadow_style == MBWM_COMP_MGR_SHADOW_NONE)
     return;
@@ -646,18 +1101,14 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
     }
 
   /* SHADOW_STYLE_GAUSSIAN */
-  priv->gaussian_map =
-    mb_wm_comp_mgr_xrender_make_gaussian_map (SHADOW_RADIUS);
-
-  priv->shadow_padding_width  = priv->gaussian_map->size;
-  priv->shadow_padding_height = priv->gaussian_map->size;
+  shadow = mb_wm_comp_mgr_gaussian_shadow_get (SHADOW_RADIUS, SHADOW_OPACITY);
 
-  size   = priv->gaussian_map->size;
-  center = size / 2;
+  priv->shadow_padding_width  = shadow->size;
+  priv->shadow_padding_height = shadow->size;
 
   /* Top & bottom */
   pwidth  = MAX_TILE_SZ;
-  pheight = size/2;
+  pheight = shadow->size/2;
   mb_wm_comp_mgr_xrender_shadow_setup_part (mgr,
 					    &ximage, &priv->shadow_n_pic, &pxm,
 					    pwidth, pheight);
@@ -666,9 +1117,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 
   for (y = 0; y < pheight; y++)
     {
-      d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					       center, y - center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[y];
       for (x = 0; x < pwidth; x++)
 	data[y * pwidth + x] = d;
     }
@@ -686,9 +1135,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 
   for (y = 0; y < pheight; y++)
     {
-      d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					       center, y - center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[y];
       for (x = 0; x < pwidth; x++)
 	data[(pheight - y - 1) * pwidth + x] = d;
     }
@@ -706,9 +1153,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 
   for (x = 0; x < pwidth; x++)
     {
-      d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					       x - center, center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[x];
       for (y = 0; y < pheight; y++)
 	data[y * pwidth + (pwidth - x - 1)] = d;
     }
@@ -723,9 +1168,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 
   for (x = 0; x < pwidth; x++)
     {
-      d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					       x - center, center,
-					       WIDTH, HEIGHT);
+      d = shadow->edge[x];
       for (y = 0; y < pheight; y++)
 	data[y * pwidth + x] = d;
     }
@@ -744,9 +1187,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	data[y * pwidth + x] = d;
       }
@@ -763,9 +1204,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	data[(pheight - y - 1) * pwidth + x] = d;
       }
@@ -782,9 +1221,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-						 x-center, y-center,
-						 WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	data[(pheight - y - 1) * pwidth + (pwidth - x -1)] = d;
       }
@@ -801,8 +1238,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
       {
-	d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					 x-center, y-center, WIDTH, HEIGHT);
+	d = shadow->corner[y * pwidth + x];
 
 	data[y * pwidth + (pwidth - x -1)] = d;
       }
@@ -819,8 +1255,7 @@ mb_wm_comp_mgr_xrender_shadow_setup (MBWMCompMgr * mgr)
 
   data = (unsigned char*)ximage->data;
 
-  d = mb_wm_comp_mgr_xrender_sum_gaussian (mgr, opacity,
-					   center, center, WIDTH, HEIGHT);
+  d = shadow->center;
 
   for (x = 0; x < pwidth; x++)
     for (y = 0; y < pheight; y++)
@@ -930,9 +1365,111 @@ mb_wm_comp_mgr_xrender_shadow_gaussian_make_picture (MBWMCompMgr * mgr,
   return pic;
 }
 
-static XserverRegion
-mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient *client)
-{
+/*
+ * Drops least recently used shadows that are not in use by any client, so
+ * that at most SHADOW_CACHE_SIZE are kept.
+ */
+static void
+mb_wm_comp_mgr_xrender_shadow_cache_trim (MBWMCompMgr * mgr)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMList                  * l;
+
+  l = mb_wm_util_list_get_last (priv->shadow_cache);
+
+  while (l && priv->n_shadows > SHADOW_CACHE_SIZE)
+    {
+      MBWMCompMgrDefaultShadow * shadow = l->data;
+      MBWMList                 * prev   = l->prev;
+
+      if (!shadow->refs)
+	{
+	  XRenderFreePicture (mgr->wm->xdpy, shadow->picture);
+	  free (shadow);
+
+	  if (prev)
+	    prev->next = l->next;
+	  else
+	    priv->shadow_cache = l->next;
+
+	  if (l->next)
+	    l->next->prev = prev;
+
+	  free (l);
+	  priv->n_shadows--;
+	}
+
+      l = prev;
+    }
+}
+
+/*
+ * Returns a reference to the gaussian shadow picture of the given size,
+ * creating it if it is not in the cache.
+ */
+static MBWMCompMgrDefaultShadow *
+mb_wm_comp_mgr_xrender_shadow_ref (MBWMCompMgr * mgr, int width, int height)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultShadow  * shadow;
+  MBWMList                  * l;
+
+  for (l = priv->shadow_cache; l; l = l->next)
+    {
+      shadow = l->data;
+
+      if (shadow->width == width && shadow->height == height)
+	{
+	  /* Move to the front */
+	  if (l->prev)
+	    {
+	      l->prev->next = l->next;
+
+	      if (l->next)
+		l->next->prev = l->prev;
+
+	      l->prev = NULL;
+	      l->next = priv->shadow_cache;
+	      priv->shadow_cache->prev = l;
+	      priv->shadow_cache = l;
+	    }
+
+	  shadow->refs++;
+	  return shadow;
+	}
+    }
+
+  shadow          = mb_wm_util_malloc0 (sizeof (MBWMCompMgrDefaultShadow));
+  shadow->width   = width;
+  shadow->height  = height;
+  shadow->refs    = 1;
+  shadow->picture =
+    mb_wm_comp_mgr_xrender_shadow_gaussian_make_picture (mgr, width, height);
+
+  priv->shadow_cache = mb_wm_util_list_prepend (priv->shadow_cache, shadow);
+  priv->n_shadows++;
+
+  mb_wm_comp_mgr_xrender_shadow_cache_trim (mgr);
+
+  return shadow;
+}
+
+static void
+mb_wm_comp_mgr_xrender_shadow_unref (MBWMCompMgr              *mgr,
+				     MBWMCompMgrDefaultShadow *shadow)
+{
+  if (!mgr || !shadow)
+    return;
+
+  shadow->refs--;
+
+  mb_wm_comp_mgr_xrender_shadow_cache_trim (mgr);
+}
+
+static void
+mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient * client,
+				       XRectangle        * extents)
+{
   MBWindowManagerClient     *wm_client = client->wm_client;
   MBWindowManager           *wm = client->wm;
   MBWMCompMgr               *mgr = wm->comp_mgr;
@@ -940,9 +1477,8 @@ mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient *client)
   MBGeometry                 geom;
   XRectangle	             r;
   MBWMClientType             ctype = MB_WM_CLIENT_CLIENT_TYPE (wm_client);
-  XserverRegion              extents;
 
-  mb_wm_client_get_coverage (wm_client, &geom);
+  mb_wm_comp_mgr_xrender_client_get_geometry (client, &geom);
 
   r.x      = geom.x;
   r.y      = geom.y;
@@ -970,44 +1506,102 @@ mb_wm_comp_mgr_xrender_client_extents (MBWMCompMgrClient *client)
 	}
     }
 
-  extents = XFixesCreateRegion (wm->xdpy, &r, 1);
+  *extents = r;
+}
+
+/*
+ * Fetches the bounding region of the window, translated by x, y, into the
+ * client side region dest.
+ */
+static void
+mb_wm_comp_mgr_xrender_client_window_region (MBWMCompMgrClient  *client,
+					     Window xwin, int x, int y,
+					     Region dest)
+{
+  MBWindowManager * wm = client->wm;
+  XserverRegion     region;
+  XRectangle      * rects, bounds;
+  int               i, n_rects = 0;
+
+  region =
+    XFixesCreateRegionFromWindow (wm->xdpy, xwin, WindowRegionBounding);
+
+  rects = XFixesFetchRegionAndBounds (wm->xdpy, region, &n_rects, &bounds);
+
+  for (i = 0; i < n_rects; ++i)
+    {
+      rects[i].x += x;
+      rects[i].y += y;
+
+      XUnionRectWithRegion (&rects[i], dest, dest);
+    }
+
+  if (rects)
+    XFree (rects);
 
-  return extents;
+  XFixesDestroyRegion (wm->xdpy, region);
 }
 
-static XserverRegion
-mb_wm_comp_mgr_xrender_client_border_size (MBWMCompMgrClient  * client,
-					   int x, int y)
+/*
+ * Returns the bounding region of the client in root coordinates; the
+ * region is owned by the client and kept until it is resized. Like the
+ * decors below, it is kept client side, so that the scenes can take a copy.
+ */
+static Region
+mb_wm_comp_mgr_xrender_client_border_size (MBWMCompMgrClient  * client)
 {
-  MBWindowManagerClient * wm_client = client->wm_client;
-  MBWindowManager       * wm        = client->wm;
-  XserverRegion           border;
+  MBWMCompMgrDefaultClient * dclient   = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManagerClient    * wm_client = client->wm_client;
+
+  if (!dclient->border)
+    {
+      dclient->border = XCreateRegion ();
+
+      mb_wm_comp_mgr_xrender_client_window_region (client,
+						   wm_client->xwin_frame ?
+						   wm_client->xwin_frame :
+						   wm_client->window->xwindow,
+						   dclient->geom.x,
+						   dclient->geom.y,
+						   dclient->border);
+    }
 
-  border = XFixesCreateRegionFromWindow (wm->xdpy,
-					 wm_client->xwin_frame ?
-					 wm_client->xwin_frame :
-					 wm_client->window->xwindow,
-					 WindowRegionBounding);
-  /* translate this */
-  XFixesTranslateRegion (wm->xdpy, border, x, y);
-  return border;
+  return dclient->border;
 }
 
-static XserverRegion
-mb_wm_comp_mgr_xrender_client_window_region (MBWMCompMgrClient  *client,
-					     Window xwin, int x, int y)
+/*
+ * Returns the region covered by the decors in root coordinates; like the
+ * border, it is owned by the client.
+ */
+static Region
+mb_wm_comp_mgr_xrender_client_decor_region (MBWMCompMgrClient * client)
 {
-  MBWindowManagerClient * wm_client = client->wm_client;
-  MBWindowManager       * wm        = client->wm;
-  XserverRegion           region;
+  MBWMCompMgrDefaultClient * dclient   = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManagerClient    * wm_client = client->wm_client;
 
-  region =
-    XFixesCreateRegionFromWindow (wm->xdpy, xwin, WindowRegionBounding);
+  if (!dclient->decors)
+    {
+      MBWMList * l = wm_client->decor;
+
+      dclient->decors = XCreateRegion ();
+
+      while (l)
+	{
+	  MBWMDecor * d = l->data;
+
+	  if (d->xwin)
+	    mb_wm_comp_mgr_xrender_client_window_region (client, d->xwin,
+							 dclient->geom.x +
+							 d->geom.x,
+							 dclient->geom.y +
+							 d->geom.y,
+							 dclient->decors);
 
-  /* translate this */
-  XFixesTranslateRegion (wm->xdpy, region, x, y);
+	  l = l->next;
+	}
+    }
 
-  return region;
+  return dclient->decors;
 }
 
 static Visual*
@@ -1144,19 +1738,27 @@ mb_wm_comp_mgr_xrender_init_pictures (MBWMCompMgr *mgr)
   XRenderFillRectangle (wm->xdpy, PictOpSrc, priv->lowlight_picture,
                         &c, 0, 0, 1, 1);
 
+  XSubtractRegion (priv->damage, priv->damage, priv->damage);
+}
 
-  pa.repeat = False;
+static void
+mb_wm_comp_mgr_xrender_renderer_init (MBWMCompMgrDefaultRenderer * r,
+				      Display                    * xdpy,
+				      MBWindowManager            * wm);
 
-  priv->root_picture
-    = XRenderCreatePicture (wm->xdpy, rwin,
-			    XRenderFindVisualFormat (wm->xdpy,
-						     DefaultVisual (wm->xdpy,
-								wm->xscreen)),
-			    CPSubwindowMode,
-			    &pa);
+#ifdef HAVE_XPRESENT
+static Bool
+mb_wm_comp_mgr_xrender_present_event (XEvent * xev, void * userdata);
+#endif
 
-  priv->all_damage = None;
-}
+#ifdef HAVE_PTHREAD
+static MBWMCompMgrDefaultRenderThread *
+mb_wm_comp_mgr_xrender_render_thread_new (MBWMCompMgr *mgr);
+
+static void
+mb_wm_comp_mgr_xrender_render_thread_free (MBWMCompMgr                    *mgr,
+					   MBWMCompMgrDefaultRenderThread *t);
+#endif
 
 /* Shuts the compositing down */
 static void
@@ -1181,24 +1783,46 @@ mb_wm_comp_mgr_xrender_turn_off_real (MBWMCompMgr *mgr)
   /*
    *  really shut down the composite manager.
    */
-  XCompositeUnredirectSubwindows (wm->xdpy, rwin, CompositeRedirectManual);
+  if (!priv->unredirected)
+    XCompositeUnredirectSubwindows (wm->xdpy, rwin, CompositeRedirectManual);
+
+  priv->unredirected = None;
+
+#ifdef HAVE_PTHREAD
+  if (priv->thread)
+    {
+      mb_wm_comp_mgr_xrender_render_thread_free (mgr, priv->thread);
+      priv->thread = NULL;
+    }
+#endif
 
-  if (priv->root_picture)
+#ifdef HAVE_XPRESENT
+  if (priv->present_handler_id)
     {
-      XRenderFreePicture (wm->xdpy, priv->root_picture);
-      priv->root_picture = None;
+      mb_wm_main_context_x_event_handler_remove (wm->main_ctx, GenericEvent,
+						 priv->present_handler_id);
+      priv->present_handler_id = 0;
     }
+#endif
 
-  if (priv->root_buffer)
+  priv->frame_pending = False;
+
+  mb_wm_comp_mgr_xrender_renderer_fini (&priv->renderer);
+
+  XSubtractRegion (priv->damage, priv->damage, priv->damage);
+
+  if (priv->deferred_id)
     {
-      XRenderFreePicture (wm->xdpy, priv->root_buffer);
-      priv->root_buffer  = None;
+      mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+						 priv->deferred_id);
+      priv->deferred_id = 0;
     }
 
-  if (priv->all_damage)
+  if (priv->retry_id)
     {
-      XDamageDestroy (wm->xdpy, priv->all_damage);
-      priv->all_damage = None;
+      mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+						 priv->retry_id);
+      priv->retry_id = 0;
     }
 
   /* Free up any client composite resources */
@@ -1222,7 +1846,7 @@ mb_wm_comp_mgr_xrender_turn_off_real (MBWMCompMgr *mgr)
 }
 
 static void
-mb_wm_comp_mgr_xrender_render_region (MBWMCompMgr *mgr, XserverRegion region);
+mb_wm_comp_mgr_xrender_render_scene (MBWMCompMgr *mgr);
 
 static void
 mb_wm_comp_mgr_xrender_turn_on_real (MBWMCompMgr *mgr)
@@ -1250,6 +1874,24 @@ mb_wm_comp_mgr_xrender_turn_on_real (MBWMCompMgr *mgr)
 
   XSync (wm->xdpy, False);
 
+#ifdef HAVE_PTHREAD
+  if (wm->flags & MBWindowManagerFlagThreadedCompositor)
+    priv->thread = mb_wm_comp_mgr_xrender_render_thread_new (mgr);
+
+  if (!priv->thread)
+#endif
+    mb_wm_comp_mgr_xrender_renderer_init (&priv->renderer, wm->xdpy, wm);
+
+#ifdef HAVE_XPRESENT
+  if (priv->renderer.present)
+    priv->present_handler_id =
+      mb_wm_main_context_x_event_handler_add (wm->main_ctx, None,
+					      GenericEvent,
+					      (MBWMXEventFunc)
+					      mb_wm_comp_mgr_xrender_present_event,
+					      mgr);
+#endif
+
   mgr->disabled = False;
 
   if (!mb_wm_stack_empty (wm))
@@ -1262,7 +1904,10 @@ mb_wm_comp_mgr_xrender_turn_on_real (MBWMCompMgr *mgr)
 	  mb_wm_comp_mgr_xrender_client_show_real (c->cm_client);
 	}
 
-      mb_wm_comp_mgr_xrender_render_region (mgr, None);
+      /* The client pictures must exist before another connection uses them */
+      XSync (wm->xdpy, False);
+
+      mb_wm_comp_mgr_xrender_render_scene (mgr);
     }
 }
 
@@ -1274,97 +1919,218 @@ mb_wm_comp_mgr_xrender_client_get_translucency (MBWMCompMgrClient *client)
   return wm_client->window->translucency;
 }
 
+/*
+ * Adds rect, in root coordinates, to the damage repainted by the next
+ * render; the damage is accumulated client side and only turned into a
+ * server region once per frame.
+ */
 static void
-mb_wm_comp_mgr_xrender_add_damage (MBWMCompMgr * mgr, XserverRegion damage)
+mb_wm_comp_mgr_xrender_add_damage (MBWMCompMgr * mgr, XRectangle * rect)
 {
   MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
-  MBWindowManager    * wm = mgr->wm;
+  MBWindowManager           * wm   = mgr->wm;
 
-  if (priv->all_damage)
-    {
-      XFixesUnionRegion (wm->xdpy, priv->all_damage, priv->all_damage,
-			 damage);
+  if (!rect->width || !rect->height)
+    return;
 
-      XFixesDestroyRegion (wm->xdpy, damage);
-    }
-    else
-      priv->all_damage = damage;
+  XUnionRectWithRegion (rect, priv->damage, priv->damage);
 
   mb_wm_display_sync_queue (wm, MBWMSyncVisibility);
 }
 
+/*
+ * Damages all of the client; damage reported by the server is added
+ * rectangle by rectangle in mb_wm_comp_mgr_xrender_handle_damage ().
+ */
 static void
 mb_wm_comp_mgr_xrender_client_repair_real (MBWMCompMgrClient * client)
 {
-  MBWindowManagerClient * wm_client = client->wm_client;
   MBWindowManager       * wm        = client->wm;
   MBWMCompMgr           * mgr       = wm->comp_mgr;
-  XserverRegion           parts;
   MBGeometry              geom;
+  XRectangle              r;
 
-  parts = XFixesCreateRegion (wm->xdpy, 0, 0);
+  mb_wm_comp_mgr_xrender_client_get_geometry (client, &geom);
 
-  /* translate region */
-  XDamageSubtract (wm->xdpy, MB_WM_COMP_MGR_DEFAULT_CLIENT (client)->damage,
-		   None, parts);
+  r.x      = geom.x;
+  r.y      = geom.y;
+  r.width  = geom.width;
+  r.height = geom.height;
 
-  mb_wm_client_get_coverage (wm_client, &geom);
+  MB_WM_COMP_MGR_DEFAULT_CLIENT (client)->damaged = True;
 
-  XFixesTranslateRegion (wm->xdpy, parts, geom.x, geom.y);
-  mb_wm_comp_mgr_xrender_add_damage (mgr, parts);
+  mb_wm_comp_mgr_xrender_add_damage (mgr, &r);
 }
 
+/*
+ * The geometry passed in is not always that of the frame, so we work with
+ * the client coverage instead.
+ */
 static void
 mb_wm_comp_mgr_xrender_client_configure_real (MBWMCompMgrClient * client,
                                               MBGeometry * geometry)
 {
   MBWMCompMgrDefaultClient * dclient  = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
-  MBWindowManagerClient    * wm_client = client->wm_client;
   MBWindowManager          * wm        = client->wm;
   MBWMCompMgr              * mgr       = wm->comp_mgr;
-  XserverRegion              damage    = None;
-  XserverRegion              extents;
-  MBGeometry                 old_geom;
-  XRenderPictureAttributes   pa;
+  XRectangle                 extents;
+  MBGeometry                 geom;
+
+  mb_wm_comp_mgr_xrender_client_get_geometry (client, &geom);
+
+  if (geom.x == dclient->geom.x && geom.y == dclient->geom.y &&
+      geom.width == dclient->geom.width &&
+      geom.height == dclient->geom.height)
+    return;
+
+  if (geom.width != dclient->geom.width ||
+      geom.height != dclient->geom.height)
+    {
+      /*
+       * The window pixmap gets reallocated, so start afresh.
+       */
+      if (dclient->shadow)
+	{
+	  mb_wm_comp_mgr_xrender_shadow_unref (mgr, dclient->shadow);
+	  dclient->shadow = NULL;
+	}
+
+      if (dclient->picture)
+	{
+	  mb_wm_comp_mgr_xrender_picture_unref (wm->xdpy, dclient->picture);
+	  mb_wm_comp_mgr_xrender_client_create_picture (client);
+	}
 
-  extents = mb_wm_comp_mgr_xrender_client_extents (client);
+      if (dclient->border)
+	{
+	  XDestroyRegion (dclient->border);
+	  dclient->border = NULL;
+	}
 
-  mb_wm_client_get_coverage (wm_client, &old_geom);
-  if ((dclient->picture) &&
-      ((old_geom.x != geometry->x) || (old_geom.y != geometry->y) ||
-       (old_geom.width != geometry->width) ||
-       (old_geom.height != geometry->height)))
+      mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, client);
+    }
+  else
     {
-      XRenderFreePicture (wm->xdpy, dclient->picture);
-      dclient->picture = None;
+      /*
+       * Just moved; the picture stays valid and the cached regions only
+       * need translating.
+       */
+      int dx = geom.x - dclient->geom.x;
+      int dy = geom.y - dclient->geom.y;
+
+      if (dclient->opaque)
+	XOffsetRegion (dclient->opaque, dx, dy);
+
+      if (dclient->border)
+	XOffsetRegion (dclient->border, dx, dy);
+
+      if (dclient->decors)
+	XOffsetRegion (dclient->decors, dx, dy);
+
+      mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, NULL);
     }
 
-  if (!dclient->picture)
+  dclient->geom = geom;
+
+  mb_wm_comp_mgr_xrender_client_extents (client, &extents);
+
+  /* Damage both the old and the new extents */
+  if (dclient->extents.width)
+    mb_wm_comp_mgr_xrender_add_damage (mgr, &dclient->extents);
+
+  dclient->extents = extents;
+
+  mb_wm_comp_mgr_xrender_add_damage (mgr, &extents);
+}
+
+/*
+ * Moves the client on the screen only; the picture and the cached regions
+ * are just translated, as for a real move. A NULL geometry puts the client
+ * back where its window is.
+ */
+static void
+mb_wm_comp_mgr_xrender_client_move_real (MBWMCompMgrClient * client,
+					 MBGeometry        * geometry)
+{
+  MBWMCompMgrDefaultClient * dclient = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+
+  if (geometry)
     {
-      pa.subwindow_mode = IncludeInferiors;
-      dclient->picture = XRenderCreatePicture
-        (wm->xdpy,
-         wm_client->xwin_frame ?
-         wm_client->xwin_frame : wm_client->window->xwindow,
-         client->is_argb32 ?
-         XRenderFindStandardFormat (wm->xdpy, PictStandardARGB32)
-         : XRenderFindVisualFormat (wm->xdpy, wm_client->window->visual),
-         CPSubwindowMode, &pa);
+      dclient->moving = True;
+      dclient->move_x = geometry->x;
+      dclient->move_y = geometry->y;
     }
+  else
+    dclient->moving = False;
+
+  mb_wm_comp_mgr_xrender_client_configure_real (client, NULL);
+}
+
+/*
+ * Folds the damage deferred by the rate limiting into the next frame.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_deferred_timeout (void *userdata)
+{
+  MBWMCompMgr               * mgr  = userdata;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
+  MBWindowManagerClient     * c;
+  Bool                        damaged = False;
+
+  priv->deferred_id = 0;
+
+  mb_wm_stack_enumerate (wm, c)
+    {
+      MBWMCompMgrDefaultClient * dc =
+	MB_WM_COMP_MGR_DEFAULT_CLIENT (c->cm_client);
+
+      if (!dc || !dc->deferred || XEmptyRegion (dc->deferred))
+	continue;
+
+      XUnionRegion (priv->damage, dc->deferred, priv->damage);
+      XSubtractRegion (dc->deferred, dc->deferred, dc->deferred);
 
-  damage = XFixesCreateRegion (wm->xdpy, 0, 0);
+      mb_wm_comp_mgr_client_damage_frame_start (c->cm_client);
+      damaged = True;
+    }
 
-  if (dclient->extents)
+  if (damaged && !mgr->disabled)
     {
-      XFixesCopyRegion (wm->xdpy, damage, dclient->extents);
-      XFixesDestroyRegion (wm->xdpy, dclient->extents);
+      mb_wm_display_sync_queue (wm, MBWMSyncVisibility);
+
+#if USE_GLIB_MAINLOOP
+      mb_wm_sync (wm);
+#endif
     }
 
-  XFixesUnionRegion (wm->xdpy, damage, damage, extents);
+  return False;
+}
 
-  dclient->extents = extents;
+/*
+ * Holds back damage from a client that has exceeded its damage budget for
+ * the current frame.
+ */
+static void
+mb_wm_comp_mgr_xrender_defer_damage (MBWMCompMgr       * mgr,
+				     MBWMCompMgrClient * client,
+				     XRectangle        * rect)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultClient  * dc   = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManager           * wm   = mgr->wm;
+
+  if (!dc->deferred)
+    dc->deferred = XCreateRegion ();
+
+  XUnionRectWithRegion (rect, dc->deferred, dc->deferred);
 
-  mb_wm_comp_mgr_xrender_add_damage (mgr, damage);
+  if (!priv->deferred_id)
+    priv->deferred_id =
+      mb_wm_main_context_timeout_handler_add (wm->main_ctx,
+					      MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL,
+					      mb_wm_comp_mgr_xrender_deferred_timeout,
+					      mgr);
 }
 
 static Bool
@@ -1379,6 +2145,10 @@ mb_wm_comp_mgr_xrender_handle_damage (XDamageNotifyEvent * de,
 
   if (c && c->cm_client)
     {
+      MBWMCompMgrDefaultClient * dc = MB_WM_COMP_MGR_DEFAULT_CLIENT (c->cm_client);
+      MBGeometry                 geom;
+      XRectangle                 r;
+
       MBWM_NOTE (COMPOSITOR,
 		 "Reparing window %x, a %d,%d;%dx%d, g %d,%d;%dx%d\n",
 		 de->drawable,
@@ -1391,7 +2161,24 @@ mb_wm_comp_mgr_xrender_handle_damage (XDamageNotifyEvent * de,
 		 de->geometry.width,
 		 de->geometry.height);
 
-      mb_wm_comp_mgr_xrender_client_repair_real (c->cm_client);
+      /*
+       * We get an event for each rectangle the damage grows by, relative
+       * to the drawable.
+       */
+      mb_wm_comp_mgr_xrender_client_get_geometry (c->cm_client, &geom);
+
+      r.x      = geom.x + de->area.x;
+      r.y      = geom.y + de->area.y;
+      r.width  = de->area.width;
+      r.height = de->area.height;
+
+      dc->damaged = True;
+
+      if (mb_wm_comp_mgr_client_damage_account (c->cm_client,
+						r.width * r.height))
+	mb_wm_comp_mgr_xrender_add_damage (mgr, &r);
+      else
+	mb_wm_comp_mgr_xrender_defer_damage (mgr, c->cm_client, &r);
     }
   else
     {
@@ -1402,448 +2189,1772 @@ mb_wm_comp_mgr_xrender_handle_damage (XDamageNotifyEvent * de,
   return False;
 }
 
-static void
-_render_a_client (MBWMCompMgrClient * client,
-		  XserverRegion       region,
-		  int                 lowlight_type) /*0 none, 1 app, 2 full*/
+/*
+ * Translucency only done for dialogs and overides; anything else without an
+ * alpha channel is painted solid.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_client_is_solid (MBWMCompMgrClient * client)
 {
-  MBWMCompMgrDefaultClient * dclient  = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
-  MBWindowManagerClient     * wm_client = client->wm_client;
-  MBWindowManager           * wm        = client->wm;
-  MBWMCompMgr               * mgr       = wm->comp_mgr;
-  MBWMCompMgrDefaultPrivate * priv      = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
-  MBWMClientType              ctype     = MB_WM_CLIENT_CLIENT_TYPE (wm_client);
-  MBGeometry                  geom;
+  MBWMClientType ctype = MB_WM_CLIENT_CLIENT_TYPE (client->wm_client);
+
+  return (!client->is_argb32 &&
+	  (ctype == MBWMClientTypeApp     ||
+	   ctype == MBWMClientTypeDesktop ||
+	   ctype == MBWMClientTypeInput   ||
+	   ctype == MBWMClientTypePanel   ||
+	   mb_wm_comp_mgr_xrender_client_get_translucency (client) == -1));
+}
 
-  if (!dclient->picture)
-    return;
+/*
+ * Builds the client side region, in root coordinates, covering the pixels
+ * the client paints with PictOpSrc: the whole window for solid clients, the
+ * decors only for translucent ones.
+ */
+static Region
+mb_wm_comp_mgr_xrender_client_opaque_region (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrDefaultClient * dclient   = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWindowManagerClient    * wm_client = client->wm_client;
+  MBWindowManager          * wm        = client->wm;
+  Region                     opaque    = XCreateRegion ();
+  Region                     shape     = NULL;
+  MBGeometry                 geom;
+  XRectangle                 r;
 
-  mb_wm_client_get_coverage (wm_client, &geom);
+  mb_wm_comp_mgr_xrender_client_get_geometry (client, &geom);
 
-  /* Translucency only done for dialogs and overides */
-  if ( !client->is_argb32 &&
-       (ctype == MBWMClientTypeApp     ||
-	ctype == MBWMClientTypeDesktop ||
-	ctype == MBWMClientTypeInput   ||
-	ctype == MBWMClientTypePanel   ||
-	mb_wm_comp_mgr_xrender_client_get_translucency (client) == -1))
+#ifdef HAVE_XEXT
+  /*
+   * Only query the shape when it can differ from the coverage, i.e., for
+   * shaped themes and for unframed clients that may shape themselves.
+   */
+  if (!wm_client->xwin_frame ||
+      mb_wm_theme_is_client_shaped (wm->theme, wm_client))
     {
-      XserverRegion winborder;
+      XRectangle * rects;
+      int          count, order, i;
+
+      rects = XShapeGetRectangles (wm->xdpy,
+				   wm_client->xwin_frame ?
+				   wm_client->xwin_frame :
+				   wm_client->window->xwindow,
+				   ShapeBounding, &count, &order);
 
-      winborder = mb_wm_comp_mgr_xrender_client_border_size (client,
-							     geom.x, geom.y);
+      if (rects)
+	{
+	  shape = XCreateRegion ();
 
-      XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, region);
+	  for (i = 0; i < count; ++i)
+	    XUnionRectWithRegion (&rects[i], shape, shape);
 
-      XFixesSubtractRegion (wm->xdpy, region, region, winborder);
+	  XOffsetRegion (shape, geom.x, geom.y);
+	  XFree (rects);
+	}
+    }
+#endif
 
-      XRenderComposite (wm->xdpy, PictOpSrc,
-			dclient->picture,
-			None, priv->root_buffer,
-			0, 0, 0, 0,
-			geom.x, geom.y, geom.width, geom.height);
+  if (dclient->solid)
+    {
+      r.x      = geom.x;
+      r.y      = geom.y;
+      r.width  = geom.width;
+      r.height = geom.height;
 
-      XFixesDestroyRegion (wm->xdpy, winborder);
+      XUnionRectWithRegion (&r, opaque, opaque);
     }
-  else if (client->is_argb32 ||
-	   mb_wm_comp_mgr_xrender_client_get_translucency (client) != -1)
+  else
     {
-      /*
-       * If the client is translucent, paint the decors only (solid).
-       */
       MBWMList * l = wm_client->decor;
 
       while (l)
 	{
-	  MBWMDecor     * d = l->data;
-	  MBGeometry    * g = & d->geom;
-	  XserverRegion   r;
+	  MBWMDecor  * d = l->data;
+	  MBGeometry * g = & d->geom;
 
-	  r = mb_wm_comp_mgr_xrender_client_window_region (client, d->xwin,
-							   g->x, g->y);
+	  r.x      = geom.x + g->x;
+	  r.y      = geom.y + g->y;
+	  r.width  = g->width;
+	  r.height = g->height;
 
-	  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, r);
-	  XFixesSubtractRegion (wm->xdpy, region, region, r);
-
-	  XRenderComposite (wm->xdpy, PictOpSrc,
-			    dclient->picture,
-			    None, priv->root_buffer,
-			    0, 0, 0, 0,
-			    geom.x + g->x, geom.y + g->y,
-			    g->width, g->height);
-
-	  XFixesDestroyRegion (wm->xdpy, r);
+	  XUnionRectWithRegion (&r, opaque, opaque);
 
 	  l = l->next;
 	}
     }
 
-
-  /* Render lowlight dialog modal for app */
-  if (lowlight_type == 1 &&
-      (ctype & (MBWMClientTypeApp | MBWMClientTypeDesktop)))
-    {
-      int title_offset = 0;
-
-      if (ctype == MBWMClientTypeApp)
-	title_offset = mb_wm_client_title_height (wm_client);
-
-      XRenderComposite (wm->xdpy, PictOpOver, priv->lowlight_picture, None,
-			priv->root_buffer,
-			0, 0, 0, 0, geom.x, geom.y + title_offset,
-			geom.width, geom.height - title_offset);
-    }
-  else if (lowlight_type == 2 /* && client->win_modal_blocker == None */)
-    {
-      /* Render lowlight dialog modal for root - e.g lowlight everything */
-      XRenderComposite (wm->xdpy, PictOpOver, priv->lowlight_picture, None,
-			priv->root_buffer,
-			0, 0, 0, 0, geom.x, geom.y,
-			geom.width, geom.height);
-    }
-
-  if (dclient->border_clip)
+  if (shape)
     {
-      XFixesDestroyRegion (wm->xdpy, dclient->border_clip);
-      dclient->border_clip = None;
+      XIntersectRegion (opaque, shape, opaque);
+      XDestroyRegion (shape);
     }
 
-  dclient->border_clip = XFixesCreateRegion (wm->xdpy, 0, 0);
-  XFixesCopyRegion (wm->xdpy, dclient->border_clip, region);
+  return opaque;
 }
 
-static void
-mb_wm_comp_mgr_xrender_render_real (MBWMCompMgr *mgr)
+/*
+ * Uploads a client side region into the server region dest, creating it if
+ * necessary.
+ */
+static XserverRegion
+mb_wm_comp_mgr_xrender_region_upload (Display       * xdpy,
+				      XserverRegion   dest,
+				      Region          src)
 {
-  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  XRectangle * rects = NULL;
+  int          i;
 
-  mb_wm_comp_mgr_xrender_render_region (mgr, priv->all_damage);
+  if (src->numRects)
+    rects = malloc (src->numRects * sizeof (XRectangle));
 
-  if (priv->all_damage)
+  for (i = 0; i < src->numRects; ++i)
     {
-      XDamageDestroy (mgr->wm->xdpy, priv->all_damage);
-      priv->all_damage = None;
+      BOX * b = &src->rects[i];
+
+      rects[i].x      = b->x1;
+      rects[i].y      = b->y1;
+      rects[i].width  = b->x2 - b->x1;
+      rects[i].height = b->y2 - b->y1;
     }
+
+  if (dest)
+    XFixesSetRegion (xdpy, dest, rects, src->numRects);
+  else
+    dest = XFixesCreateRegion (xdpy, rects, src->numRects);
+
+  if (rects)
+    free (rects);
+
+  return dest;
+}
+
+/*
+ * Returns a copy of the client side region src, NULL if there is none.
+ */
+static Region
+mb_wm_comp_mgr_xrender_region_copy (Region src)
+{
+  Region copy;
+
+  if (!src)
+    return NULL;
+
+  copy = XCreateRegion ();
+  XUnionRegion (src, copy, copy);
+
+  return copy;
+}
+
+/*
+ * Works out the kind of lowlight the modal dialogs above the top main
+ * client call for (0 none, 1 app, 2 full).
+ */
+static int
+mb_wm_comp_mgr_xrender_lowlight_type (MBWindowManager       * wm,
+				      MBWindowManagerClient * wmc_top)
+{
+  MBWindowManagerClient * c;
+
+  mb_wm_stack_enumerate_reverse (wm, c)
+    {
+      if (MB_WM_CLIENT_CLIENT_TYPE (c) == MBWMClientTypeDialog &&
+	  mb_wm_client_is_modal (c))
+	{
+	  switch (mb_wm_get_modality_type (wm))
+	    {
+	    case MBWMModalityNormal:
+	    default:
+	      return 1;
+	    case MBWMModalitySystem:
+	      return 2;
+	    case MBWMModalityNone:
+	      return 0;
+	    }
+	}
+
+      if (c == wmc_top)
+	break;
+    }
+
+  return 0;
+}
+
+/*
+ * Works out, front to back, which part of the screen each client is
+ * visible in, and which clients are hidden entirely by opaque clients
+ * above them, along with the top main client, the lowlight and how each
+ * client is to be painted. The result is cached until the stacking, the
+ * geometry, the mapping, the translucency or the modal state of a client
+ * changes, so that a frame with nothing but damage does none of this.
+ */
+static void
+mb_wm_comp_mgr_xrender_update_visibility (MBWMCompMgr *mgr)
+{
+  MBWindowManager           * wm   = mgr->wm;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManagerClient     * wmc_top, * c;
+  Region                      screen, covered;
+  XRectangle                  r;
+  Bool                        seen_top = False;
+  Bool                        done = False;
+
+  if (!priv->visibility_dirty)
+    return;
+
+  r.x      = 0;
+  r.y      = 0;
+  r.width  = wm->xdpy_width;
+  r.height = wm->xdpy_height;
+
+  screen  = XCreateRegion ();
+  covered = XCreateRegion ();
+
+  XUnionRectWithRegion (&r, screen, screen);
+
+  wmc_top = mb_wm_get_visible_main_client (wm);
+
+  priv->solid_client    = NULL;
+  priv->top_client      = wmc_top;
+  priv->top_translucent =
+    (wmc_top && wmc_top->cm_client &&
+     mb_wm_comp_mgr_xrender_client_get_translucency(wmc_top->cm_client) == -1);
+  priv->lowlight        = mb_wm_comp_mgr_xrender_lowlight_type (wm, wmc_top);
+
+  mb_wm_stack_enumerate_reverse (wm, c)
+    {
+      MBWMCompMgrClient        * client = c->cm_client;
+      MBWMCompMgrDefaultClient * dc;
+      MBGeometry                 geom;
+      Bool                       solid;
+
+      if (!client)
+	continue;
+
+      dc = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+
+      dc->translucent =
+	(client->is_argb32 ||
+	 mb_wm_comp_mgr_xrender_client_get_translucency (client) != -1);
+
+      /* Nothing below the first solid main client gets painted */
+      if (done || !dc->picture)
+	{
+	  dc->occluded = True;
+	  continue;
+	}
+
+      mb_wm_comp_mgr_xrender_client_get_geometry (c->cm_client, &geom);
+
+      dc->occluded =
+	(XRectInRegion (covered, geom.x, geom.y, geom.width, geom.height)
+	 == RectangleIn);
+
+      if (!dc->paint_clip)
+	dc->paint_clip = XCreateRegion ();
+
+      XSubtractRegion (screen, covered, dc->paint_clip);
+
+      solid = mb_wm_comp_mgr_xrender_client_is_solid (client);
+
+      if (!dc->opaque || dc->solid != solid)
+	{
+	  if (dc->opaque)
+	    XDestroyRegion (dc->opaque);
+
+	  dc->solid  = solid;
+	  dc->opaque = mb_wm_comp_mgr_xrender_client_opaque_region (client);
+	}
+
+      XUnionRegion (covered, dc->opaque, covered);
+
+      if (!dc->shadow_clip)
+	dc->shadow_clip = XCreateRegion ();
+
+      XSubtractRegion (screen, covered, dc->shadow_clip);
+
+      /*
+       * Stop at the first client on/below the top which is not translucent
+       * and is either and application or desktop (to have adequate
+       * coverage).
+       */
+      if (c == wmc_top)
+	seen_top = True;
+
+      if (seen_top &&
+	  (MB_WM_CLIENT_CLIENT_TYPE (c) &
+	   (MBWMClientTypeApp | MBWMClientTypeDesktop)) &&
+	  !dc->translucent)
+	{
+	  priv->solid_client = c;
+	  done = True;
+	}
+    }
+
+  if (!priv->uncovered)
+    priv->uncovered = XCreateRegion ();
+
+  XSubtractRegion (screen, covered, priv->uncovered);
+
+  priv->fully_covered = XEmptyRegion (priv->uncovered);
+
+  XDestroyRegion (covered);
+  XDestroyRegion (screen);
+
+  priv->visibility_dirty = False;
+
+  MBWM_NOTE (COMPOSITOR, "visibility updated, screen %s covered\n",
+	     priv->fully_covered ? "fully" : "partially");
+}
+
+static void
+_render_a_client (MBWMCompMgrDefaultRenderer * r,
+		  MBWMCompMgrDefaultPrivate  * priv,
+		  MBWMCompMgrDefaultScene    * scene,
+		  int                          index)
+{
+  MBWMCompMgrDefaultSceneClient * sc   = &scene->clients[index];
+  Display                       * xdpy = r->xdpy;
+  MBGeometry                    * geom = &sc->geom;
+
+  /*
+   * The part of the damage not covered by anything opaque above this
+   * client and the client itself; used to clip shadows and translucent
+   * contents later on.
+   */
+  mb_wm_comp_mgr_xrender_region_upload (xdpy, r->clip, sc->shadow_clip);
+  XFixesIntersectRegion (xdpy, r->border_clips[index], r->damage, r->clip);
+
+  if (sc->flags & MBWMCompMgrDefaultSceneOccluded)
+    {
+      MBWM_NOTE (COMPOSITOR, "skipping occluded client picture %x\n",
+		 sc->picture);
+      return;
+    }
+
+  mb_wm_comp_mgr_xrender_region_upload (xdpy, r->clip, sc->paint_clip);
+  XFixesIntersectRegion (xdpy, r->paint, r->damage, r->clip);
+
+  if (sc->flags & MBWMCompMgrDefaultSceneSolid)
+    {
+      XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, r->paint);
+    }
+  else
+    {
+      /*
+       * If the client is translucent, paint the decors only (solid).
+       */
+      mb_wm_comp_mgr_xrender_region_upload (xdpy, r->clip, sc->decors);
+      XFixesIntersectRegion (xdpy, r->scratch, r->clip, r->paint);
+      XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, r->scratch);
+    }
+
+  XRenderComposite (xdpy, PictOpSrc,
+		    sc->picture,
+		    None, r->buffer,
+		    0, 0, 0, 0,
+		    geom->x, geom->y, geom->width, geom->height);
+
+  if (!(sc->flags & MBWMCompMgrDefaultSceneSolid))
+    XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, r->paint);
+
+  /* Render lowlight dialog modal for app */
+  if (scene->lowlight == 1 &&
+      (sc->flags & MBWMCompMgrDefaultSceneLowlight))
+    {
+      XRenderComposite (xdpy, PictOpOver, priv->lowlight_picture, None,
+			r->buffer,
+			0, 0, 0, 0, geom->x, geom->y + sc->title_offset,
+			geom->width, geom->height - sc->title_offset);
+    }
+  else if (scene->lowlight == 2 /* && client->win_modal_blocker == None */)
+    {
+      /* Render lowlight dialog modal for root - e.g lowlight everything */
+      XRenderComposite (xdpy, PictOpOver, priv->lowlight_picture, None,
+			r->buffer,
+			0, 0, 0, 0, geom->x, geom->y,
+			geom->width, geom->height);
+    }
+}
+
+/*
+ * With Present the screen is shown in the overlay window, which has to get
+ * out of the way of an unredirected window.
+ */
+static void
+mb_wm_comp_mgr_xrender_show_overlay (MBWMCompMgr *mgr, Bool show)
+{
+#ifdef HAVE_XPRESENT
+  MBWMCompMgrDefaultPrivate * priv    = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManager           * wm      = mgr->wm;
+  Window                      overlay = priv->renderer.overlay;
+  XserverRegion               empty;
+
+#ifdef HAVE_PTHREAD
+  if (priv->thread)
+    overlay = priv->thread->renderer.overlay;
+#endif
+
+  if (!overlay)
+    return;
+
+  if (show)
+    {
+      XFixesSetWindowShapeRegion (wm->xdpy, overlay, ShapeBounding, 0, 0,
+				  None);
+    }
+  else
+    {
+      empty = XFixesCreateRegion (wm->xdpy, NULL, 0);
+      XFixesSetWindowShapeRegion (wm->xdpy, overlay, ShapeBounding, 0, 0,
+				  empty);
+      XFixesDestroyRegion (wm->xdpy, empty);
+    }
+#endif
+}
+
+/*
+ * Returns the client that can be left unredirected, if any: the top
+ * visible client, provided it is fullscreen, covers the whole screen and
+ * is painted solid.
+ */
+static MBWindowManagerClient *
+mb_wm_comp_mgr_xrender_unredirect_candidate (MBWMCompMgr *mgr)
+{
+  MBWindowManager          * wm = mgr->wm;
+  MBWindowManagerClient    * c;
+  MBWMCompMgrDefaultClient * dc = NULL;
+  MBGeometry                 geom;
+
+  mb_wm_comp_mgr_xrender_update_visibility (mgr);
+
+  mb_wm_stack_enumerate_reverse (wm, c)
+    {
+      dc = MB_WM_COMP_MGR_DEFAULT_CLIENT (c->cm_client);
+
+      if (dc && dc->picture)
+	break;
+    }
+
+  if (!c || !dc ||
+      !(c->window->ewmh_state & MBWMClientWindowEWMHStateFullscreen) ||
+      dc->translucent)
+    return NULL;
+
+  mb_wm_comp_mgr_xrender_client_get_geometry (c->cm_client, &geom);
+
+  if (geom.x > 0 || geom.y > 0 ||
+      geom.x + geom.width < wm->xdpy_width ||
+      geom.y + geom.height < wm->xdpy_height)
+    return NULL;
+
+  return c;
+}
+
+/*
+ * Unredirects the windows while an opaque fullscreen client is on the top,
+ * and redirects them again when that changes; returns True while the
+ * compositing is paused.
+ *
+ * Composite only allows redirection set up with RedirectSubwindows to be
+ * lifted for all the subwindows together, so that is what we do; nothing
+ * else is visible anyway.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_check_unredirect (MBWMCompMgr *mgr)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
+  MBWindowManagerClient     * c;
+  Window                      xwin = None;
+
+  c = mb_wm_comp_mgr_xrender_unredirect_candidate (mgr);
+
+  if (c)
+    xwin = c->xwin_frame ? c->xwin_frame : c->window->xwindow;
+
+  if (xwin != None && xwin == priv->unredirected)
+    {
+      /* Paused; nothing we would paint is visible */
+      XSubtractRegion (priv->damage, priv->damage, priv->damage);
+      return True;
+    }
+
+  if (priv->unredirected)
+    {
+      MBWM_NOTE (COMPOSITOR, "redirecting windows again\n");
+
+      XCompositeRedirectSubwindows (wm->xdpy, wm->root_win->xwindow,
+				    CompositeRedirectManual);
+
+      mb_wm_comp_mgr_xrender_show_overlay (mgr, True);
+
+      priv->unredirected = None;
+
+      /*
+       * Repaint everything straight away, so that the screen does not show
+       * stale contents.
+       */
+      XSubtractRegion (priv->damage, priv->damage, priv->damage);
+      mb_wm_comp_mgr_xrender_invalidate_visibility (mgr, NULL);
+    }
+
+  if (xwin != None)
+    {
+      MBWM_NOTE (COMPOSITOR, "unredirecting for fullscreen window %x\n",
+		 xwin);
+
+      XCompositeUnredirectSubwindows (wm->xdpy, wm->root_win->xwindow,
+				      CompositeRedirectManual);
+
+      mb_wm_comp_mgr_xrender_show_overlay (mgr, False);
+
+      priv->unredirected = xwin;
+
+      XSubtractRegion (priv->damage, priv->damage, priv->damage);
+      return True;
+    }
+
+  return False;
+}
+
+/*
+ * Adds the client to the scene, below the clients already in it.
+ */
+static void
+mb_wm_comp_mgr_xrender_scene_add_client (MBWMCompMgr             * mgr,
+					 MBWMCompMgrDefaultScene * scene,
+					 MBWindowManagerClient   * c)
+{
+  MBWMCompMgrDefaultPrivate     * priv   = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrClient             * client = c->cm_client;
+  MBWMCompMgrDefaultClient      * dc     = MB_WM_COMP_MGR_DEFAULT_CLIENT (client);
+  MBWMCompMgrDefaultSceneClient * sc     = &scene->clients[scene->n_clients++];
+  MBWMClientType                  ctype  = MB_WM_CLIENT_CLIENT_TYPE (c);
+  Bool                            is_translucent = dc->translucent;
+
+  mb_wm_comp_mgr_xrender_client_get_geometry (c->cm_client, &sc->geom);
+
+  sc->win_geom    = c->window->geometry;
+  sc->picture_ref = dc->picture;
+  sc->picture     = dc->picture->picture;
+  sc->paint_clip  = mb_wm_comp_mgr_xrender_region_copy (dc->paint_clip);
+  sc->shadow_clip = mb_wm_comp_mgr_xrender_region_copy (dc->shadow_clip);
+
+  dc->picture->refs++;
+
+  if (dc->solid)
+    sc->flags |= MBWMCompMgrDefaultSceneSolid;
+  else
+    {
+      Region decors = mb_wm_comp_mgr_xrender_client_decor_region (client);
+
+      sc->decors = mb_wm_comp_mgr_xrender_region_copy (decors);
+    }
+
+  if (dc->occluded)
+    sc->flags |= MBWMCompMgrDefaultSceneOccluded;
+
+  if (client->is_argb32)
+    sc->flags |= MBWMCompMgrDefaultSceneArgb32;
+
+  if (is_translucent)
+    sc->flags |= MBWMCompMgrDefaultSceneTranslucent;
+
+  if (ctype & (MBWMClientTypeApp | MBWMClientTypeDesktop))
+    {
+      sc->flags |= MBWMCompMgrDefaultSceneLowlight;
+
+      if (scene->lowlight == 1 && ctype == MBWMClientTypeApp)
+	sc->title_offset = mb_wm_client_title_height (c);
+    }
+
+  /*
+   * We have to process all dialogs and, if the top client is translucent,
+   * any translucent windows as well.
+   */
+  if (priv->shadow_style &&
+      mb_wm_client_is_mapped (c) &&
+      (ctype == MBWMClientTypeDialog ||
+       ctype == MBWMClientTypeMenu   ||
+       ctype == MBWMClientTypeOverride ||
+       (priv->top_translucent && is_translucent)))
+    {
+      sc->flags |= MBWMCompMgrDefaultSceneShadowed;
+
+      if (priv->shadow_style == MBWM_COMP_MGR_SHADOW_SIMPLE)
+	{
+	  Region border = mb_wm_comp_mgr_xrender_client_border_size (client);
+
+	  sc->border = mb_wm_comp_mgr_xrender_region_copy (border);
+	}
+      else if (!is_translucent)
+	{
+	  int sw = sc->geom.width + priv->shadow_padding_width;
+	  int sh = sc->geom.height + priv->shadow_padding_height;
+
+	  /* Shadows are cached, keyed by size */
+	  if (dc->shadow &&
+	      (dc->shadow->width != sw || dc->shadow->height != sh))
+	    {
+	      mb_wm_comp_mgr_xrender_shadow_unref (mgr, dc->shadow);
+	      dc->shadow = NULL;
+	    }
+
+	  if (!dc->shadow)
+	    dc->shadow = mb_wm_comp_mgr_xrender_shadow_ref (mgr, sw, sh);
+
+	  sc->shadow_ref = dc->shadow;
+	  sc->shadow     = dc->shadow->picture;
+
+	  dc->shadow->refs++;
+	}
+    }
+}
+
+/*
+ * Captures what the next frame is to show; the scene takes over the damage
+ * accumulated so far.
+ */
+static MBWMCompMgrDefaultScene *
+mb_wm_comp_mgr_xrender_scene_new (MBWMCompMgr *mgr)
+{
+  MBWindowManager           * wm   = mgr->wm;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultScene   * scene;
+  MBWindowManagerClient     * wmc_top, * wmc_solid, * wmc_start, * c;
+  int                         n_clients = 0;
+
+  mb_wm_comp_mgr_xrender_update_visibility (mgr);
+
+  mb_wm_stack_enumerate (wm, c)
+    {
+      n_clients++;
+    }
+
+  scene = mb_wm_util_malloc0 (sizeof (MBWMCompMgrDefaultScene) +
+			      n_clients *
+			      sizeof (MBWMCompMgrDefaultSceneClient));
+
+  scene->clients       = (MBWMCompMgrDefaultSceneClient *) (scene + 1);
+  scene->width         = wm->xdpy_width;
+  scene->height        = wm->xdpy_height;
+  scene->lowlight      = priv->lowlight;
+  scene->fully_covered = priv->fully_covered;
+  scene->uncovered     = mb_wm_comp_mgr_xrender_region_copy (priv->uncovered);
+  scene->shadow_start  = -1;
+
+  if (!XEmptyRegion (priv->damage))
+    {
+      scene->damage = priv->damage;
+      priv->damage  = XCreateRegion ();
+    }
+
+  /*
+   * Render top -> bottom, until we reach first client on/below the top
+   * which is not translucent and is either and application or desktop;
+   * shadows and any translucent clients are then rendered bottom -> top,
+   * starting from the that client, so that any translucent windows on the
+   * top of the stack get correctly rendered.
+   */
+  wmc_top   = priv->top_client;
+  wmc_solid = priv->solid_client;
+  wmc_start = wmc_solid ? wmc_solid : wmc_top ? wmc_top : wm->stack_bottom;
+
+  mb_wm_stack_enumerate_reverse (wm, c)
+    {
+      MBWMCompMgrDefaultClient * dc =
+	MB_WM_COMP_MGR_DEFAULT_CLIENT (c->cm_client);
+
+      if (dc && dc->picture)
+	mb_wm_comp_mgr_xrender_scene_add_client (mgr, scene, c);
+
+      if (c == wmc_start)
+	scene->shadow_start = scene->n_clients - 1;
+
+      if (c == wmc_solid)
+	break;
+    }
+
+  return scene;
+}
+
+/*
+ * Frees the scene along with its references; only ever called on the wm
+ * thread, once the renderer is done with the scene.
+ */
+static void
+mb_wm_comp_mgr_xrender_scene_free (MBWMCompMgr             * mgr,
+				   MBWMCompMgrDefaultScene * scene)
+{
+  int i;
+
+  for (i = 0; i < scene->n_clients; ++i)
+    {
+      MBWMCompMgrDefaultSceneClient * sc = &scene->clients[i];
+
+      mb_wm_comp_mgr_xrender_picture_unref (mgr->wm->xdpy, sc->picture_ref);
+
+      if (sc->shadow_ref)
+	mb_wm_comp_mgr_xrender_shadow_unref (mgr, sc->shadow_ref);
+
+      if (sc->paint_clip)
+	XDestroyRegion (sc->paint_clip);
+
+      if (sc->shadow_clip)
+	XDestroyRegion (sc->shadow_clip);
+
+      if (sc->border)
+	XDestroyRegion (sc->border);
+
+      if (sc->decors)
+	XDestroyRegion (sc->decors);
+    }
+
+  if (scene->uncovered)
+    XDestroyRegion (scene->uncovered);
+
+  if (scene->damage)
+    XDestroyRegion (scene->damage);
+
+  free (scene);
+}
+
+#ifdef HAVE_XPRESENT
+/*
+ * Sets up presentation through the Present extension, if the server has
+ * it; otherwise frames get copied to the root window as soon as they are
+ * painted.
+ */
+static void
+mb_wm_comp_mgr_xrender_renderer_init_present (MBWMCompMgrDefaultRenderer * r,
+					      MBWindowManager            * wm)
+{
+  Display       * xdpy = r->xdpy;
+  int             ev_base, err_base, major = 1, minor = 0, i;
+  XserverRegion   empty;
+  XRectangle      screen;
+
+  if (!XPresentQueryExtension (xdpy, &r->present_opcode, &ev_base, &err_base)
+      || !XPresentQueryVersion (xdpy, &major, &minor))
+    {
+      MBWM_NOTE (COMPOSITOR, "no Present extension, presenting directly\n");
+      return;
+    }
+
+  /*
+   * Present clips by the children of the window presented to, so we use
+   * the overlay window rather than the root; it must let the input through.
+   */
+  r->overlay = XCompositeGetOverlayWindow (xdpy, r->root);
+
+  empty = XFixesCreateRegion (xdpy, NULL, 0);
+  XFixesSetWindowShapeRegion (xdpy, r->overlay, ShapeInput, 0, 0, empty);
+  XFixesDestroyRegion (xdpy, empty);
+
+  screen.x      = 0;
+  screen.y      = 0;
+  screen.width  = wm->xdpy_width;
+  screen.height = wm->xdpy_height;
+
+  for (i = 0; i < 2; ++i)
+    {
+      r->back[i] = XCreatePixmap (xdpy, r->root,
+				  screen.width, screen.height, r->depth);
+
+      r->back_picture[i] = XRenderCreatePicture (xdpy, r->back[i], r->format,
+						 0, 0);
+
+      /* Nothing has been painted in there yet */
+      r->missed[i] = XCreateRegion ();
+      XUnionRectWithRegion (&screen, r->missed[i], r->missed[i]);
+    }
+
+  r->update      = XFixesCreateRegion (xdpy, NULL, 0);
+  r->present_eid = XPresentSelectInput (xdpy, r->overlay,
+					PresentCompleteNotifyMask |
+					PresentIdleNotifyMask);
+  r->present     = True;
+
+  MBWM_NOTE (COMPOSITOR, "presenting through Present %d.%d\n", major, minor);
+}
+
+static void
+mb_wm_comp_mgr_xrender_renderer_fini_present (MBWMCompMgrDefaultRenderer * r)
+{
+  Display * xdpy = r->xdpy;
+  int       i;
+
+  if (!r->present)
+    return;
+
+  XPresentFreeInput (xdpy, r->overlay, r->present_eid);
+
+  for (i = 0; i < 2; ++i)
+    {
+      XRenderFreePicture (xdpy, r->back_picture[i]);
+      XFreePixmap (xdpy, r->back[i]);
+      XDestroyRegion (r->missed[i]);
+
+      r->back[i]      = None;
+      r->back_busy[i] = False;
+    }
+
+  XFixesDestroyRegion (xdpy, r->update);
+  XCompositeReleaseOverlayWindow (xdpy, r->root);
+
+  r->overlay         = None;
+  r->present         = False;
+  r->present_pending = False;
+}
+#endif
+
+static Bool
+mb_wm_comp_mgr_xrender_renderer_ready (MBWMCompMgrDefaultRenderer * r);
+
+/*
+ * Handles an event on the renderer connection; returns True if it
+ * completed a frame and the renderer is ready for the next one.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_renderer_handle_event (MBWMCompMgrDefaultRenderer * r,
+					      XEvent                     * xev)
+{
+#ifdef HAVE_XPRESENT
+  XGenericEventCookie * cookie = &xev->xcookie;
+  int                   i;
+
+  if (!r->present || xev->type != GenericEvent ||
+      cookie->extension != r->present_opcode ||
+      !XGetEventData (r->xdpy, cookie))
+    return False;
+
+  switch (cookie->evtype)
+    {
+    case PresentCompleteNotify:
+      {
+	XPresentCompleteNotifyEvent * ce = cookie->data;
+
+	if (r->last_msc && ce->msc > r->last_msc)
+	  r->refresh_interval =
+	    (ce->ust - r->last_ust) / (ce->msc - r->last_msc);
+
+	r->last_ust = ce->ust;
+	r->last_msc = ce->msc;
+	r->n_completed++;
+
+	if (ce->serial_number == r->present_serial)
+	  r->present_pending = False;
+      }
+      break;
+    case PresentIdleNotify:
+      {
+	XPresentIdleNotifyEvent * ie = cookie->data;
+
+	for (i = 0; i < 2; ++i)
+	  if (ie->pixmap == r->back[i])
+	    r->back_busy[i] = False;
+      }
+      break;
+    default:
+      break;
+    }
+
+  XFreeEventData (r->xdpy, cookie);
+
+  return mb_wm_comp_mgr_xrender_renderer_ready (r);
+#else
+  return False;
+#endif
+}
+
+/*
+ * With Present, frames are throttled to one per vertical blank and need
+ * a free back buffer; otherwise the renderer is always ready.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_renderer_ready (MBWMCompMgrDefaultRenderer * r)
+{
+#ifdef HAVE_XPRESENT
+  if (r->present)
+    return !r->present_pending && !r->back_busy[r->current ^ 1];
+#endif
+
+  return True;
+}
+
+/*
+ * Uploads damage into the server region dest, as the bounding box if it
+ * has too many rectangles.
+ */
+static void
+mb_wm_comp_mgr_xrender_renderer_upload (MBWMCompMgrDefaultRenderer * r,
+					XserverRegion                dest,
+					Region                       damage)
+{
+  if (damage->numRects > MAX_DAMAGE_RECTS)
+    {
+      XRectangle box;
+
+      MBWM_NOTE (COMPOSITOR, "%ld damage rectangles, using bounding box\n",
+		 damage->numRects);
+
+      XClipBox (damage, &box);
+      XFixesSetRegion (r->xdpy, dest, &box, 1);
+    }
+  else
+    mb_wm_comp_mgr_xrender_region_upload (r->xdpy, dest, damage);
+}
+
+static void
+mb_wm_comp_mgr_xrender_renderer_init (MBWMCompMgrDefaultRenderer * r,
+				      Display                    * xdpy,
+				      MBWindowManager            * wm)
+{
+  XRenderPictureAttributes pa;
+
+  r->xdpy   = xdpy;
+  r->root   = wm->root_win->xwindow;
+  r->depth  = DefaultDepth (xdpy, wm->xscreen);
+  r->format = XRenderFindVisualFormat (xdpy,
+				       DefaultVisual (xdpy, wm->xscreen));
+
+  pa.subwindow_mode = IncludeInferiors;
+
+  r->root_picture = XRenderCreatePicture (xdpy, r->root, r->format,
+					  CPSubwindowMode, &pa);
+
+  r->damage  = XFixesCreateRegion (xdpy, NULL, 0);
+  r->paint   = XFixesCreateRegion (xdpy, NULL, 0);
+  r->scratch = XFixesCreateRegion (xdpy, NULL, 0);
+  r->clip    = XFixesCreateRegion (xdpy, NULL, 0);
+
+#ifdef HAVE_XPRESENT
+  mb_wm_comp_mgr_xrender_renderer_init_present (r, wm);
+#endif
+}
+
+/*
+ * Frees the server resources of the renderer; the statistics are kept.
+ */
+static void
+mb_wm_comp_mgr_xrender_renderer_fini (MBWMCompMgrDefaultRenderer * r)
+{
+  Display * xdpy = r->xdpy;
+  int       i;
+
+  if (!xdpy)
+    return;
+
+#ifdef HAVE_XPRESENT
+  mb_wm_comp_mgr_xrender_renderer_fini_present (r);
+#endif
+
+  XRenderFreePicture (xdpy, r->root_picture);
+
+  if (r->root_buffer)
+    XRenderFreePicture (xdpy, r->root_buffer);
+
+  XFixesDestroyRegion (xdpy, r->damage);
+  XFixesDestroyRegion (xdpy, r->paint);
+  XFixesDestroyRegion (xdpy, r->scratch);
+  XFixesDestroyRegion (xdpy, r->clip);
+
+  for (i = 0; i < r->n_border_clips; ++i)
+    XFixesDestroyRegion (xdpy, r->border_clips[i]);
+
+  free (r->border_clips);
+
+  r->xdpy           = NULL;
+  r->root_picture   = None;
+  r->root_buffer    = None;
+  r->buffer         = None;
+  r->border_clips   = NULL;
+  r->n_border_clips = 0;
+}
+
+/*
+ * Paints the damaged part of the scene into the back buffer and gets the
+ * damage shown on the screen.
+ */
+static void
+mb_wm_comp_mgr_xrender_renderer_render (MBWMCompMgrDefaultRenderer * r,
+					MBWMCompMgrDefaultPrivate  * priv,
+					MBWMCompMgrDefaultScene    * scene)
+{
+  Display    * xdpy = r->xdpy;
+  XRectangle   screen, box, fill;
+  Region       paint;
+  int          i;
+
+  screen.x      = 0;
+  screen.y      = 0;
+  screen.width  = scene->width;
+  screen.height = scene->height;
+
+  paint = XCreateRegion ();
+
+  if (scene->damage)
+    {
+      int x2, y2;
+
+      XUnionRegion (paint, scene->damage, paint);
+      XClipBox (scene->damage, &box);
+
+      /*
+       * Work out the area to present, i.e., the damage bounds clipped to the
+       * screen.
+       */
+      x2 = box.x + box.width;
+      y2 = box.y + box.height;
+
+      if (box.x < 0)
+	box.x = 0;
+
+      if (box.y < 0)
+	box.y = 0;
+
+      if (x2 > screen.width)
+	x2 = screen.width;
+
+      if (y2 > screen.height)
+	y2 = screen.height;
+
+      box.width  = x2 > box.x ? x2 - box.x : 0;
+      box.height = y2 > box.y ? y2 - box.y : 0;
+    }
+  else
+    {
+      /*
+       * Fullscreen render
+       */
+      XUnionRectWithRegion (&screen, paint, paint);
+      box = screen;
+    }
+
+#ifdef HAVE_XPRESENT
+  if (r->present)
+    {
+      /*
+       * The screen only changes where damaged, but the back buffer also
+       * needs whatever it missed while the other one was in use.
+       */
+      int target = r->current ^ 1;
+
+      mb_wm_comp_mgr_xrender_renderer_upload (r, r->update, paint);
+
+      XUnionRegion (r->missed[r->current], paint, r->missed[r->current]);
+      XUnionRegion (paint, r->missed[target], paint);
+      XSubtractRegion (r->missed[target], r->missed[target],
+		       r->missed[target]);
+
+      r->buffer = r->back_picture[target];
+    }
+  else
+#endif
+    {
+      if (!r->root_buffer)
+	{
+	  Pixmap rootPixmap =
+	    XCreatePixmap (xdpy, r->root, screen.width, screen.height,
+			   r->depth);
+
+	  r->root_buffer = XRenderCreatePicture (xdpy, rootPixmap, r->format,
+						 0, 0);
+
+	  XFreePixmap (xdpy, rootPixmap);
+	}
+
+      r->buffer = r->root_buffer;
+    }
+
+  mb_wm_comp_mgr_xrender_renderer_upload (r, r->damage, paint);
+  XClipBox (paint, &fill);
+  XDestroyRegion (paint);
+
+  if (r->n_border_clips < scene->n_clients)
+    {
+      r->border_clips = realloc (r->border_clips,
+				 scene->n_clients * sizeof (XserverRegion));
+
+      for (i = r->n_border_clips; i < scene->n_clients; ++i)
+	r->border_clips[i] = XFixesCreateRegion (xdpy, NULL, 0);
+
+      r->n_border_clips = scene->n_clients;
+    }
+
+  XFixesSetPictureClipRegion (xdpy, r->root_picture, 0, 0, r->damage);
+
+  /*
+   * Only the parts of the screen no opaque client paints need clearing;
+   * render block of boring black there.
+   */
+  if (!scene->fully_covered)
+    {
+      mb_wm_comp_mgr_xrender_region_upload (xdpy, r->clip, scene->uncovered);
+      XFixesIntersectRegion (xdpy, r->paint, r->damage, r->clip);
+      XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, r->paint);
+
+      XRenderComposite (xdpy, PictOpSrc, priv->black_picture,
+			None, r->buffer, 0, 0, 0, 0,
+			fill.x, fill.y, fill.width, fill.height);
+    }
+
+  for (i = 0; i < scene->n_clients; ++i)
+    _render_a_client (r, priv, scene, i);
+
+  XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, None);
+
+  /*
+   * Now render shadows and any translucent clients but bottom -> top this
+   * time
+   */
+  for (i = scene->shadow_start; i >= 0; --i)
+    {
+      MBWMCompMgrDefaultSceneClient * sc          = &scene->clients[i];
+      XserverRegion                   border_clip = r->border_clips[i];
+      MBGeometry                    * geom        = &sc->geom;
+      MBGeometry                    * win_geom    = &sc->win_geom;
+      Bool                            is_translucent;
+
+      if (!(sc->flags & MBWMCompMgrDefaultSceneShadowed))
+	continue;
+
+      is_translucent = (sc->flags & MBWMCompMgrDefaultSceneTranslucent);
+
+      if (priv->shadow_style == MBWM_COMP_MGR_SHADOW_SIMPLE)
+	{
+	  XserverRegion shadow_region = r->scratch;
+
+	  /* Grab 'shape' region of window */
+	  mb_wm_comp_mgr_xrender_region_upload (xdpy, r->clip, sc->border);
+	  XFixesCopyRegion (xdpy, shadow_region, r->clip);
+
+	  /* Offset it. */
+	  XFixesTranslateRegion (xdpy, shadow_region,
+				 priv->shadow_dx,
+				 priv->shadow_dy);
+
+	  /* Intersect it, so only border remains */
+	  XFixesIntersectRegion (xdpy, shadow_region,
+				 border_clip,
+				 shadow_region );
+
+	  XFixesSetPictureClipRegion (xdpy, r->buffer,
+				      0, 0, shadow_region);
+
+	  /* now paint them */
+	  if (sc->flags & MBWMCompMgrDefaultSceneArgb32)
+	    {
+	      XRenderComposite (xdpy, PictOpOver,
+				priv->black_picture,
+				sc->picture,
+				r->buffer,
+				0, 0, 0, 0,
+				geom->x + priv->shadow_dx,
+				geom->y + priv->shadow_dy,
+				geom->width +
+				priv->shadow_padding_width,
+				geom->height +
+				priv->shadow_padding_height);
+	    }
+	  else
+	    {
+	      XRenderComposite (xdpy, PictOpOver,
+				priv->black_picture,
+				None,
+				r->buffer,
+				0, 0, 0, 0,
+				geom->x + priv->shadow_dx,
+				geom->y + priv->shadow_dy,
+				geom->width +
+				priv->shadow_padding_width,
+				geom->height +
+				priv->shadow_padding_height);
+	    }
+
+	  /* Paint any translucent window contents, but no the
+	   * decors.
+	   */
+	  if (is_translucent)
+	    {
+	      XFixesIntersectRegion (xdpy, shadow_region,
+				     r->clip, border_clip);
+
+	      XFixesSetPictureClipRegion (xdpy, r->buffer,
+					  0, 0, shadow_region);
+
+	      if (sc->flags & MBWMCompMgrDefaultSceneArgb32)
+		XRenderComposite (xdpy, PictOpOver,
+				  sc->picture, None,
+				  r->buffer,
+				  win_geom->x, win_geom->y, 0, 0,
+				  win_geom->x + geom->x,
+				  win_geom->y + geom->y,
+				  win_geom->width, win_geom->height);
+	      else
+		XRenderComposite (xdpy, PictOpOver,
+				  sc->picture, priv->trans_picture,
+				  r->buffer,
+				  win_geom->x, win_geom->y, 0, 0,
+				  win_geom->x + geom->x,
+				  win_geom->y + geom->y,
+				  win_geom->width, win_geom->height);
+	    }
+	}
+      else 		/* GAUSSIAN */
+	{
+	  XFixesSetPictureClipRegion (xdpy, r->buffer,
+				      0, 0, border_clip);
+
+	  if (is_translucent)
+	    {
+	      /* No shadows currently for transparent windows */
+	      XRenderComposite (xdpy, PictOpOver,
+				sc->picture, priv->trans_picture,
+				r->buffer,
+				win_geom->x, win_geom->y, 0, 0,
+				win_geom->x + geom->x,
+				win_geom->y + geom->y,
+				win_geom->width, win_geom->height);
+	    }
+	  else if (sc->shadow)
+	    {
+	      XRenderComposite (xdpy, PictOpOver,
+				priv->black_picture,
+				sc->shadow,
+				r->buffer,
+				win_geom->x, win_geom->y, 0, 0,
+				geom->x + priv->shadow_dx,
+				geom->y + priv->shadow_dy,
+				geom->width +
+				priv->shadow_padding_width,
+				geom->height +
+				priv->shadow_padding_height);
+	    }
+	}
+    }
+
+  XFixesSetPictureClipRegion (xdpy, r->buffer, 0, 0, None);
+
+#ifdef HAVE_XPRESENT
+  if (r->present)
+    {
+      /* Shown at the next vertical blank, again only where damaged */
+      r->current ^= 1;
+      r->back_busy[r->current] = True;
+      r->present_pending       = True;
+
+      XPresentPixmap (xdpy, r->overlay, r->back[r->current],
+		      ++r->present_serial, None, r->update, 0, 0,
+		      None, None, None, PresentOptionNone, 0, 0, 0, NULL, 0);
+    }
+  else
+#endif
+    {
+      /* Only copy what has changed to the screen */
+      XRenderComposite (xdpy, PictOpSrc, r->root_buffer, None,
+			r->root_picture,
+			box.x, box.y, 0, 0, box.x, box.y,
+			box.width, box.height);
+    }
+
+  r->n_frames++;
+  r->presented_pixels += (unsigned long) box.width * box.height;
+  r->last_present      = box;
+
+  MBWM_NOTE (COMPOSITOR, "presented %dx%d+%d+%d (%lu pixels in %lu frames)\n",
+	     box.width, box.height, box.x, box.y,
+	     r->presented_pixels, r->n_frames);
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * The scenes own everything they refer to, so errors on the render thread
+ * connection are bugs; they get reported, but do not bring the wm down.
+ * Errors on any other connection go to the handler installed before us.
+ */
+static Display * render_thread_xdpy = NULL;
+static int (*render_thread_old_error_handler) (Display *, XErrorEvent *);
+
+static int
+mb_wm_comp_mgr_xrender_render_thread_error_handler (Display     * xdpy,
+						    XErrorEvent * error)
+{
+  if (xdpy == render_thread_xdpy)
+    {
+      char msg[128];
+
+      XGetErrorText (xdpy, error->error_code, msg, sizeof (msg));
+
+      mb_wm_util_warn ("render thread X error: %s (request %d.%d, "
+		       "resource 0x%lx)", msg, error->request_code,
+		       error->minor_code, error->resourceid);
+      return 0;
+    }
+
+  if (render_thread_old_error_handler)
+    return render_thread_old_error_handler (xdpy, error);
+
+  return 0;
+}
+
+static Bool
+mb_wm_comp_mgr_xrender_scene_queue_push (MBWMCompMgrDefaultSceneQueue * q,
+					 MBWMCompMgrDefaultScene      * s)
+{
+  unsigned int tail = q->tail;
+  char         c    = 0;
+
+  if (tail - q->head == RENDER_QUEUE_SIZE)
+    return False;
+
+  q->scenes[tail & (RENDER_QUEUE_SIZE - 1)] = s;
+
+  /* The scene must be in place before the consumer can see it */
+  __sync_synchronize ();
+  q->tail = tail + 1;
+
+  /* If the pipe is full the consumer has plenty of wake ups pending anyway */
+  while (write (q->fds[1], &c, 1) < 0 && errno == EINTR);
+
+  return True;
+}
+
+static MBWMCompMgrDefaultScene *
+mb_wm_comp_mgr_xrender_scene_queue_pop (MBWMCompMgrDefaultSceneQueue * q)
+{
+  unsigned int              head = q->head;
+  MBWMCompMgrDefaultScene * s;
+
+  if (head == q->tail)
+    return NULL;
+
+  __sync_synchronize ();
+  s = q->scenes[head & (RENDER_QUEUE_SIZE - 1)];
+
+  /* Done with the slot before the producer can reuse it */
+  __sync_synchronize ();
+  q->head = head + 1;
+
+  return s;
 }
 
 static void
-mb_wm_comp_mgr_xrender_render_region (MBWMCompMgr *mgr, XserverRegion region)
+mb_wm_comp_mgr_xrender_scene_queue_drain (MBWMCompMgrDefaultSceneQueue * q)
 {
-  MBWindowManager            * wm   = mgr->wm;
-  MBWMCompMgrDefaultPrivate  * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
-  MBWindowManagerClient      * wmc_top, * wmc_temp, * wmc_solid = NULL;
-  int                          lowlight = 0;
-  int                          destroy_region = 0;
-  Bool                         done;
-  Bool                         top_translucent = False;
+  char    c[16];
+  ssize_t n;
 
-  if (mgr->disabled)
-    return;
+  do
+    n = read (q->fds[0], c, sizeof (c));
+  while (n > 0 || (n < 0 && errno == EINTR));
+}
+
+static Bool
+mb_wm_comp_mgr_xrender_scene_queue_init (MBWMCompMgrDefaultSceneQueue * q)
+{
+  if (pipe (q->fds))
+    return False;
+
+  fcntl (q->fds[0], F_SETFL, O_NONBLOCK);
+  fcntl (q->fds[1], F_SETFL, O_NONBLOCK);
+
+  return True;
+}
+
+static void
+mb_wm_comp_mgr_xrender_scene_queue_fini (MBWMCompMgrDefaultSceneQueue * q)
+{
+  close (q->fds[0]);
+  close (q->fds[1]);
+}
+
+static void *
+mb_wm_comp_mgr_xrender_render_thread (void *data)
+{
+  MBWMCompMgrDefaultRenderThread * t     = data;
+  Display                        * xdpy  = t->renderer.xdpy;
+  MBWMCompMgrDefaultScene        * scene = NULL, * s;
+  struct pollfd                    fds[2];
+
+  fds[0].fd     = t->queue.fds[0];
+  fds[0].events = POLLIN;
+  fds[1].fd     = ConnectionNumber (xdpy);
+  fds[1].events = POLLIN;
 
-  if (!region)
+  for (;;)
     {
+      /* Xlib may have read events off the connection already */
+      if (!XEventsQueued (xdpy, QueuedAlready))
+	{
+	  if (poll (fds, 2, -1) < 0)
+	    continue;
+
+	  if (fds[0].revents & POLLIN)
+	    mb_wm_comp_mgr_xrender_scene_queue_drain (&t->queue);
+	}
+
+      /* Present notifications, and errors */
+      while (XPending (xdpy))
+	{
+	  XEvent xev;
+
+	  XNextEvent (xdpy, &xev);
+	  mb_wm_comp_mgr_xrender_renderer_handle_event (&t->renderer, &xev);
+	}
+
+      if (t->quit)
+	break;
+
       /*
-       * Fullscreen render
+       * If we have fallen behind, only the latest scene gets painted, with
+       * the damage of the ones skipped.
        */
-      XRectangle  r;
+      while ((s = mb_wm_comp_mgr_xrender_scene_queue_pop (&t->queue)))
+	{
+	  if (scene)
+	    {
+	      if (scene->damage && s->damage)
+		XUnionRegion (s->damage, scene->damage, s->damage);
+	      else if (s->damage)
+		{
+		  XDestroyRegion (s->damage);
+		  s->damage = NULL;
+		}
+
+	      mb_wm_comp_mgr_xrender_scene_queue_push (&t->retired, scene);
+	    }
+
+	  scene = s;
+	}
+
+      /* Otherwise wait for the previous frame to be shown */
+      if (!scene || !mb_wm_comp_mgr_xrender_renderer_ready (&t->renderer))
+	continue;
+
+      mb_wm_comp_mgr_xrender_renderer_render (&t->renderer, t->priv, scene);
 
-      r.x      = 0;
-      r.y      = 0;
-      r.width  = wm->xdpy_width;
-      r.height = wm->xdpy_height;
+      /*
+       * Once the server has processed the frame, the wm is free to let go
+       * of the pictures the scene refers to.
+       */
+      XSync (xdpy, False);
 
-      region = XFixesCreateRegion (wm->xdpy, &r, 1);
-      destroy_region = 1;
+      mb_wm_comp_mgr_xrender_scene_queue_push (&t->retired, scene);
+      scene = NULL;
     }
 
-  wmc_top = mb_wm_get_visible_main_client (wm);
+  if (scene)
+    mb_wm_comp_mgr_xrender_scene_queue_push (&t->retired, scene);
+
+  return NULL;
+}
+
+/*
+ * Frees the scenes the render thread is done with.
+ */
+static void
+mb_wm_comp_mgr_xrender_render_thread_collect (MBWMCompMgr                    * mgr,
+					      MBWMCompMgrDefaultRenderThread * t)
+{
+  MBWMCompMgrDefaultScene * s;
 
-  if (wmc_top)
-    top_translucent =
-      (mb_wm_comp_mgr_xrender_client_get_translucency(wmc_top->cm_client) == -1);
+  mb_wm_comp_mgr_xrender_scene_queue_drain (&t->retired);
 
-  if (!priv->root_buffer)
+  while ((s = mb_wm_comp_mgr_xrender_scene_queue_pop (&t->retired)))
     {
-      Pixmap rootPixmap =
-	XCreatePixmap (wm->xdpy, wm->root_win->xwindow,
-		       wm->xdpy_width, wm->xdpy_height,
-		       DefaultDepth (wm->xdpy, wm->xscreen));
+      mb_wm_comp_mgr_xrender_scene_free (mgr, s);
+      t->n_scenes--;
+    }
+}
+
+static Bool
+mb_wm_comp_mgr_xrender_render_thread_retired (MBWMIOChannel   * channel,
+					      MBWMIOCondition   events,
+					      void            * userdata)
+{
+  MBWMCompMgr               * mgr  = userdata;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+
+  if (priv->thread)
+    mb_wm_comp_mgr_xrender_render_thread_collect (mgr, priv->thread);
+
+  return True;
+}
+
+/*
+ * Starts the render thread, with a connection of its own to the display.
+ * Each of the two connections is only used by one thread; Xlib has been
+ * made thread safe all the same, see mb_wm_process_cmdline (). Returns
+ * NULL if the thread cannot be set up.
+ */
+static MBWMCompMgrDefaultRenderThread *
+mb_wm_comp_mgr_xrender_render_thread_new (MBWMCompMgr *mgr)
+{
+  MBWindowManager                * wm   = mgr->wm;
+  MBWMCompMgrDefaultPrivate      * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultRenderThread * t;
+  Display                        * xdpy;
+  int                              ev_base, err_base;
 
-      priv->root_buffer =
-	XRenderCreatePicture (wm->xdpy, rootPixmap,
-			      XRenderFindVisualFormat (wm->xdpy,
-						DefaultVisual (wm->xdpy,
-							       wm->xscreen)),
-			      0, 0);
+  if (render_thread_xdpy)
+    return NULL;
 
-      XFreePixmap (wm->xdpy, rootPixmap);
+  if (!(xdpy = XOpenDisplay (DisplayString (wm->xdpy))))
+    {
+      MBWM_NOTE (COMPOSITOR, "failed to open render thread connection\n");
+      return NULL;
     }
 
-  XFixesSetPictureClipRegion (wm->xdpy, priv->root_picture, 0, 0, region);
-  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, region);
+  if (!XFixesQueryExtension (xdpy, &ev_base, &err_base))
+    {
+      XCloseDisplay (xdpy);
+      return NULL;
+    }
 
-  XRenderComposite (wm->xdpy, PictOpSrc, priv->black_picture,
-		    None, priv->root_buffer, 0, 0, 0, 0, 0, 0,
-		    wm->xdpy_width, wm->xdpy_height);
+  t = mb_wm_util_malloc0 (sizeof (MBWMCompMgrDefaultRenderThread));
+  t->priv = priv;
 
-  /*
-   * Check initially to see what kind of lowlight todo ( if any )
-   */
-  mb_wm_stack_enumerate_reverse (wm, wmc_temp)
+  if (!mb_wm_comp_mgr_xrender_scene_queue_init (&t->queue))
     {
-      MBWMClientType type = MB_WM_CLIENT_CLIENT_TYPE (wmc_temp);
-      Bool is_modal = mb_wm_client_is_modal (wmc_temp);
+      XCloseDisplay (xdpy);
+      free (t);
+      return NULL;
+    }
 
-      if (type == MBWMClientTypeDialog && is_modal)
-	{
-	  MBWMModality modality = mb_wm_get_modality_type (wm);
-	  switch (modality)
-	    {
-	    case MBWMModalityNormal:
-	    default:
-	      lowlight = 1;
-	      break;
-	    case MBWMModalitySystem:
-	      lowlight = 2;
-	      break;
-	    case MBWMModalityNone:
-	      lowlight = 0;
-	      break;
-	    }
-	}
+  if (!mb_wm_comp_mgr_xrender_scene_queue_init (&t->retired))
+    {
+      mb_wm_comp_mgr_xrender_scene_queue_fini (&t->queue);
+      XCloseDisplay (xdpy);
+      free (t);
+      return NULL;
+    }
 
-      if (wmc_temp == wmc_top)
-	break;
+  mb_wm_comp_mgr_xrender_renderer_init (&t->renderer, xdpy, wm);
+  XSync (xdpy, False);
+
+  render_thread_xdpy = xdpy;
+  render_thread_old_error_handler =
+    XSetErrorHandler (mb_wm_comp_mgr_xrender_render_thread_error_handler);
+
+  if (pthread_create (&t->thread, NULL,
+		      mb_wm_comp_mgr_xrender_render_thread, t))
+    {
+      XSetErrorHandler (render_thread_old_error_handler);
+      render_thread_xdpy = NULL;
+
+      mb_wm_comp_mgr_xrender_renderer_fini (&t->renderer);
+      XCloseDisplay (xdpy);
+      mb_wm_comp_mgr_xrender_scene_queue_fini (&t->queue);
+      mb_wm_comp_mgr_xrender_scene_queue_fini (&t->retired);
+      free (t);
+      return NULL;
+    }
+
+  t->channel  = mb_wm_main_context_io_channel_new (t->retired.fds[0]);
+  t->watch_id =
+    mb_wm_main_context_fd_watch_add (wm->main_ctx, t->channel,
+#if USE_GLIB_MAINLOOP
+				     G_IO_IN,
+#else
+				     POLLIN,
+#endif
+				     mb_wm_comp_mgr_xrender_render_thread_retired,
+				     mgr);
+
+  MBWM_NOTE (COMPOSITOR, "rendering on a separate thread\n");
+
+  return t;
+}
+
+/*
+ * Stops the render thread; any scenes still queued are dropped.
+ */
+static void
+mb_wm_comp_mgr_xrender_render_thread_free (MBWMCompMgr                    * mgr,
+					   MBWMCompMgrDefaultRenderThread * t)
+{
+  MBWMCompMgrDefaultScene * s;
+  Display                 * xdpy = t->renderer.xdpy;
+  char                      c    = 0;
+
+  mb_wm_main_context_fd_watch_remove (mgr->wm->main_ctx, t->watch_id);
+  mb_wm_main_context_io_channel_destroy (t->channel);
+
+  t->quit = True;
+  __sync_synchronize ();
+
+  while (write (t->queue.fds[1], &c, 1) < 0 && errno == EINTR);
+
+  pthread_join (t->thread, NULL);
+
+  /* The connection goes away first, so nothing refers to the pictures */
+  mb_wm_comp_mgr_xrender_renderer_fini (&t->renderer);
+  XCloseDisplay (xdpy);
+
+  XSetErrorHandler (render_thread_old_error_handler);
+  render_thread_xdpy = NULL;
+
+  while ((s = mb_wm_comp_mgr_xrender_scene_queue_pop (&t->queue)))
+    mb_wm_comp_mgr_xrender_scene_free (mgr, s);
+
+  mb_wm_comp_mgr_xrender_render_thread_collect (mgr, t);
+
+  mb_wm_comp_mgr_xrender_scene_queue_fini (&t->queue);
+  mb_wm_comp_mgr_xrender_scene_queue_fini (&t->retired);
+  free (t);
+}
+#endif
+
+/*
+ * Retries a frame the render thread had no room for.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_render_retry (void *userdata)
+{
+  MBWMCompMgr               * mgr  = userdata;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
+
+  priv->retry_id = 0;
+
+  if (!mgr->disabled)
+    {
+      mb_wm_display_sync_queue (wm, MBWMSyncVisibility);
+
+#if USE_GLIB_MAINLOOP
+      mb_wm_sync (wm);
+#endif
     }
 
-  /* Render top -> bottom */
-  done = False;
-  mb_wm_stack_enumerate_reverse (wm, wmc_temp)
+  return False;
+}
+
+/*
+ * Captures the scene and gets it painted, either right away or by the
+ * render thread.
+ */
+static void
+mb_wm_comp_mgr_xrender_render_scene (MBWMCompMgr *mgr)
+{
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultScene   * scene;
+
+  if (mgr->disabled)
+    return;
+
+#ifdef HAVE_PTHREAD
+  if (priv->thread)
     {
-      _render_a_client(wmc_temp->cm_client, region, lowlight);
+      MBWindowManager                * wm = mgr->wm;
+      MBWMCompMgrDefaultRenderThread * t  = priv->thread;
 
-      /*
-       * Render clients until we reach first client on/below the top
-       * which is not translucent and is either and application or desktop
-       * (to have adequate coverage).
-       */
-      if (wmc_temp == wmc_top)
-	{
-	  done = True;
-	}
+      mb_wm_comp_mgr_xrender_render_thread_collect (mgr, t);
 
-      if (done &&
-	  (MB_WM_CLIENT_CLIENT_TYPE (wmc_temp) &
-	   (MBWMClientTypeApp | MBWMClientTypeDesktop)) &&
-	 !wmc_temp->cm_client->is_argb32 &&
-	  mb_wm_comp_mgr_xrender_client_get_translucency (wmc_temp->cm_client)
-	  == -1)
+      if (t->n_scenes < RENDER_QUEUE_SIZE)
 	{
-	  wmc_solid = wmc_temp;
-	  break;
+	  scene = mb_wm_comp_mgr_xrender_scene_new (mgr);
+
+	  /*
+	   * The render thread must not get ahead of the requests creating
+	   * the resources the scene refers to; within mb_wm_sync () the
+	   * server grab sees to that once they are flushed.
+	   */
+	  XFlush (wm->xdpy);
+
+	  mb_wm_comp_mgr_xrender_scene_queue_push (&t->queue, scene);
+	  t->n_scenes++;
+	  return;
 	}
+
+      /* The damage stays with us for the next attempt */
+      MBWM_NOTE (COMPOSITOR, "render queue full, retrying later\n");
+
+      if (!priv->retry_id)
+	priv->retry_id =
+	  mb_wm_main_context_timeout_handler_add (wm->main_ctx,
+						  MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL,
+						  mb_wm_comp_mgr_xrender_render_retry,
+						  mgr);
+      return;
     }
+#endif
 
-  if (!wmc_top)
+  if (!mb_wm_comp_mgr_xrender_renderer_ready (&priv->renderer))
     {
-      /* Render block of boring black in case of no top app or desktop */
-      XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, region);
+      /* The damage waits until the previous frame has been shown */
+      priv->frame_pending = True;
+      return;
+    }
+
+  scene = mb_wm_comp_mgr_xrender_scene_new (mgr);
+
+  mb_wm_comp_mgr_xrender_renderer_render (&priv->renderer, priv, scene);
+  mb_wm_comp_mgr_xrender_scene_free (mgr, scene);
+}
+
+#ifdef HAVE_XPRESENT
+/*
+ * Present notifications for the renderer on the wm connection; renders
+ * any frame held back while the previous one was being shown.
+ */
+static Bool
+mb_wm_comp_mgr_xrender_present_event (XEvent * xev, void * userdata)
+{
+  MBWMCompMgr               * mgr  = userdata;
+  MBWMCompMgrDefaultPrivate * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWindowManager           * wm   = mgr->wm;
 
-      XRenderComposite (wm->xdpy, PictOpSrc, priv->black_picture,
-			None, priv->root_buffer, 0, 0, 0, 0, 0, 0,
-			wm->xdpy_width, wm->xdpy_height);
+  if (mb_wm_comp_mgr_xrender_renderer_handle_event (&priv->renderer, xev) &&
+      priv->frame_pending)
+    {
+      priv->frame_pending = False;
 
-      XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, None);
+      mb_wm_display_sync_queue (wm, MBWMSyncVisibility);
 
-      wmc_top = wm->stack_bottom;
+#if USE_GLIB_MAINLOOP
+      mb_wm_sync (wm);
+#endif
     }
 
+  return True;
+}
+#endif
+
+static void
+mb_wm_comp_mgr_xrender_render_real (MBWMCompMgr *mgr)
+{
+  MBWindowManager           * wm   = mgr->wm;
+  MBWindowManagerClient     * c;
 
-  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, None);
+  if (mb_wm_comp_mgr_xrender_check_unredirect (mgr))
+    return;
 
   /*
-   * Now render shadows and any translucent clients but bottom -> top this
-   * time
-   *
-   * We start from the first solid client on the stack, so that any
-   * translucent windows on the top of the stack get correctly rendered.
+   * Clear the server side damage of the clients we got notified about, so
+   * that further damage to the same areas is reported again, and close the
+   * damage frames this render takes in.
    */
-  for (wmc_temp = wmc_solid ? wmc_solid : wmc_top;
-       wmc_temp; wmc_temp=wmc_temp->stacked_above)
+  mb_wm_stack_enumerate (wm, c)
     {
-      MBWMClientType             type = MB_WM_CLIENT_CLIENT_TYPE (wmc_temp);
-      MBWMCompMgrClient        * c    = wmc_temp->cm_client;
-      MBWMCompMgrDefaultClient * dc   = MB_WM_COMP_MGR_DEFAULT_CLIENT (c);
-      Bool                       is_translucent;
+      MBWMCompMgrDefaultClient * dc =
+	MB_WM_COMP_MGR_DEFAULT_CLIENT (c->cm_client);
 
-      if (!dc || !dc->picture)
+      if (!dc)
 	continue;
 
-      /*
-       * We have to process all dialogs and, if the top client is translucent,
-       * any translucent windows as well.
-       */
-      is_translucent = (c->is_argb32 ||
-			mb_wm_comp_mgr_xrender_client_get_translucency (c)
-			!= -1);
-
-      if (mb_wm_client_is_mapped (wmc_temp) &&
-	  (type == MBWMClientTypeDialog ||
-	   type == MBWMClientTypeMenu   ||
-	   type == MBWMClientTypeOverride ||
-	   (top_translucent && is_translucent)))
+      if (dc->damaged)
 	{
-	  if (priv->shadow_style)
-	    {
-	      Picture    shadow_pic;
-	      MBGeometry geom;
+	  if (dc->damage)
+	    XDamageSubtract (wm->xdpy, dc->damage, None, None);
 
-	      mb_wm_client_get_coverage (wmc_temp, &geom);
-
-	      if (priv->shadow_style == MBWM_COMP_MGR_SHADOW_SIMPLE)
-		{
-		  XserverRegion shadow_region;
-
-		  /* Grab 'shape' region of window */
-		  shadow_region =
-		    mb_wm_comp_mgr_xrender_client_border_size (c,
-							       geom.x, geom.y);
-
-		  /* Offset it. */
-		  XFixesTranslateRegion (wm->xdpy, shadow_region,
-					 priv->shadow_dx,
-					 priv->shadow_dy);
-
-		  /* Intersect it, so only border remains */
-		  XFixesIntersectRegion (wm->xdpy, shadow_region,
-					 dc->border_clip,
-					 shadow_region );
-
-		  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer,
-					      0, 0, shadow_region);
-
-		  /* now paint them */
-		  if (wmc_temp->cm_client->is_argb32)
-		    {
-		      XRenderComposite (wm->xdpy, PictOpOver,
-					priv->black_picture,
-					dc->picture,
- 					priv->root_buffer,
-					0, 0, 0, 0,
-					geom.x + priv->shadow_dx,
-					geom.y + priv->shadow_dy,
-					geom.width +
-					priv->shadow_padding_width,
-					geom.height +
-					priv->shadow_padding_height);
-		    }
-		  else
-		    {
-		      XRenderComposite (wm->xdpy, PictOpOver,
-					priv->black_picture,
-					None,
-					priv->root_buffer,
-					0, 0, 0, 0,
-					geom.x + priv->shadow_dx,
-					geom.y + priv->shadow_dy,
-					geom.width +
-					priv->shadow_padding_width,
-					geom.height +
-					priv->shadow_padding_height);
-		    }
-
-		  /* Paint any translucent window contents, but no the
-		   * decors.
-		   */
-		  if (is_translucent)
-		    {
-		      MBGeometry * win_geom = & wmc_temp->window->geometry;
-
-		      XFixesDestroyRegion (wm->xdpy, shadow_region);
-
-		      shadow_region =
-			mb_wm_comp_mgr_xrender_client_border_size (c,
-								   geom.x, geom.y);
-
-		      XFixesIntersectRegion (wm->xdpy, shadow_region,
-					     dc->border_clip, shadow_region );
-
-		      XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer,
-						  0, 0, shadow_region);
-
-		      if (c->is_argb32)
-			XRenderComposite (wm->xdpy, PictOpOver,
-					  dc->picture, None,
-					  priv->root_buffer,
-					  win_geom->x, win_geom->y, 0, 0,
-					  win_geom->x + geom.x,
-					  win_geom->y + geom.y,
-					  win_geom->width, win_geom->height);
-		      else
-			XRenderComposite (wm->xdpy, PictOpOver,
-					  dc->picture, priv->trans_picture,
-					  priv->root_buffer,
-					  win_geom->x, win_geom->y, 0, 0,
-					  win_geom->x + geom.x,
-					  win_geom->y + geom.y,
-					  win_geom->width, win_geom->height);
-		    }
-
-		  XFixesDestroyRegion (wm->xdpy, shadow_region);
-		}
-	      else 		/* GAUSSIAN */
-		{
-		  MBGeometry * win_geom = & wmc_temp->window->geometry;
-
-		  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer,
-					      0, 0, dc->border_clip);
-
-		  if (is_translucent)
-		    {
-		      /* No shadows currently for transparent windows */
-		      XRenderComposite (wm->xdpy, PictOpOver,
-					dc->picture, priv->trans_picture,
-					priv->root_buffer,
-					win_geom->x, win_geom->y, 0, 0,
-					win_geom->x + geom.x,
-					win_geom->y + geom.y,
-					win_geom->width, win_geom->height);
-		    }
-		  else
-		    {
-		      /* Combine pregenerated shadow tiles */
-		      shadow_pic =
-			mb_wm_comp_mgr_xrender_shadow_gaussian_make_picture (mgr,
-				geom.width + priv->shadow_padding_width,
-				geom.height + priv->shadow_padding_height);
-
-		      XRenderComposite (wm->xdpy, PictOpOver,
-					priv->black_picture,
-					shadow_pic,
-					priv->root_buffer,
-					win_geom->x, win_geom->y, 0, 0,
-					geom.x + priv->shadow_dx,
-					geom.y + priv->shadow_dy,
-					geom.width +
-					priv->shadow_padding_width,
-					geom.height +
-					priv->shadow_padding_height);
-
-		      XRenderFreePicture (wm->xdpy, shadow_pic);
-		    }
-		}
-	    }
+	  dc->damaged = False;
 	}
-    }
-
-  XFixesSetPictureClipRegion (wm->xdpy, priv->root_buffer, 0, 0, None);
 
-  XRenderComposite (wm->xdpy, PictOpSrc, priv->root_buffer, None,
-		    priv->root_picture,
-		    0, 0, 0, 0, 0, 0, wm->xdpy_width, wm->xdpy_height);
+      mb_wm_comp_mgr_client_damage_frame_end (c->cm_client);
+    }
 
-  if (destroy_region)
-    XDamageDestroy (wm->xdpy, region);
+  mb_wm_comp_mgr_xrender_render_scene (mgr);
 }
 
 MBWMCompMgr *
@@ -1856,3 +3967,65 @@ mb_wm_comp_mgr_xrender_new (MBWindowManager *wm)
   return MB_WM_COMP_MGR (mgr);
 }
 
+void
+mb_wm_comp_mgr_xrender_get_present_stats (MBWMCompMgr   * mgr,
+					  unsigned long * frames,
+					  unsigned long * pixels,
+					  MBGeometry    * last)
+{
+  MBWMCompMgrDefaultPrivate  * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultRenderer * r    = &priv->renderer;
+
+#ifdef HAVE_PTHREAD
+  if (priv->thread)
+    r = &priv->thread->renderer;
+#endif
+
+  if (frames)
+    *frames = r->n_frames;
+
+  if (pixels)
+    *pixels = r->presented_pixels;
+
+  if (last)
+    {
+      last->x      = r->last_present.x;
+      last->y      = r->last_present.y;
+      last->width  = r->last_present.width;
+      last->height = r->last_present.height;
+    }
+}
+
+Bool
+mb_wm_comp_mgr_xrender_get_present_timing (MBWMCompMgr        * mgr,
+					   unsigned long      * completed,
+					   unsigned long long * ust,
+					   unsigned long long * msc,
+					   unsigned long      * interval)
+{
+  MBWMCompMgrDefaultPrivate  * priv = MB_WM_COMP_MGR_DEFAULT (mgr)->priv;
+  MBWMCompMgrDefaultRenderer * r    = &priv->renderer;
+
+#ifdef HAVE_PTHREAD
+  if (priv->thread)
+    r = &priv->thread->renderer;
+#endif
+
+  if (completed)
+    *completed = r->n_completed;
+
+  if (ust)
+    *ust = r->last_ust;
+
+  if (msc)
+    *msc = r->last_msc;
+
+  if (interval)
+    *interval = r->refresh_interval;
+
+#ifdef HAVE_XPRESENT
+  return r->present;
+#else
+  return False;
+#endif
+}
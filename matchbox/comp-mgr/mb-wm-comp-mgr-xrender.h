@@ -49,6 +49,29 @@ mb_wm_comp_mgr_xrender_class_type ();
 MBWMCompMgr*
 mb_wm_comp_mgr_xrender_new (MBWindowManager *wm);
 
+/*
+ * Number of frames rendered, and the number of pixels copied to the screen
+ * by them in total and by the last one.
+ */
+void
+mb_wm_comp_mgr_xrender_get_present_stats (MBWMCompMgr   * mgr,
+					  unsigned long * frames,
+					  unsigned long * pixels,
+					  MBGeometry    * last);
+
+/*
+ * Timing of the frames shown through the Present extension: the number of
+ * frames completed, the time (in microseconds) and the vertical blank count
+ * at which the last one was shown, and the measured refresh interval in
+ * microseconds. Returns False if frames are not shown through Present.
+ */
+Bool
+mb_wm_comp_mgr_xrender_get_present_timing (MBWMCompMgr        * mgr,
+					   unsigned long      * completed,
+					   unsigned long long * ust,
+					   unsigned long long * msc,
+					   unsigned long      * interval);
+
 struct MBWMCompMgrDefaultClientClass
 {
   MBWMCompMgrClientClass  parent;
@@ -148,6 +148,88 @@ mb_wm_comp_mgr_client_configure (MBWMCompMgrClient * client,
   klass->configure (client, geometry);
 }
 
+/*
+ * Shows the client at a new position without moving the window itself, for
+ * interactive moves; the window is expected to be moved for real by the time
+ * mb_wm_comp_mgr_client_move_end () is called. Returns False if the
+ * compositor cannot do this, in which case the window has to be moved.
+ */
+Bool
+mb_wm_comp_mgr_client_move (MBWMCompMgrClient * client, int x, int y)
+{
+  MBWMCompMgrClientClass *klass;
+  MBGeometry              geom;
+
+  if (!client)
+    return False;
+
+  klass = MB_WM_COMP_MGR_CLIENT_CLASS (MB_WM_OBJECT_GET_CLASS (client));
+
+  if (!klass->move)
+    return False;
+
+  mb_wm_client_get_coverage (client->wm_client, &geom);
+
+  geom.x = x;
+  geom.y = y;
+
+  klass->move (client, &geom);
+
+  return True;
+}
+
+void
+mb_wm_comp_mgr_client_move_end (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrClientClass *klass;
+
+  if (!client)
+    return;
+
+  klass = MB_WM_COMP_MGR_CLIENT_CLASS (MB_WM_OBJECT_GET_CLASS (client));
+
+  if (klass->move)
+    klass->move (client, NULL);
+}
+
+/*
+ * Frees whatever the compositor holds for a hidden client that it can build
+ * again when the client is shown; does nothing for a client on the screen.
+ */
+void
+mb_wm_comp_mgr_client_release (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrClientClass *klass;
+
+  if (!client)
+    return;
+
+  klass = MB_WM_COMP_MGR_CLIENT_CLASS (MB_WM_OBJECT_GET_CLASS (client));
+
+  if (klass->release)
+    klass->release (client);
+}
+
+/*
+ * Returns the server side memory, in bytes, the compositor holds for the
+ * client, as far as it can tell.
+ */
+unsigned long
+mb_wm_comp_mgr_client_get_resource_bytes (MBWMCompMgrClient * client)
+{
+  MBWMCompMgrClientClass *klass;
+
+  if (!client)
+    return 0;
+
+  klass = MB_WM_COMP_MGR_CLIENT_CLASS (MB_WM_OBJECT_GET_CLASS (client));
+
+  if (!klass->resource_bytes)
+    return 0;
+
+  return klass->resource_bytes (client);
+}
+
 void
 mb_wm_comp_mgr_client_repair (MBWMCompMgrClient * client)
 {
@@ -162,6 +244,99 @@ mb_wm_comp_mgr_client_repair (MBWMCompMgrClient * client)
   klass->repair (client);
 }
 
+/*
+ * Starts a new damage frame for the client, i.e., the client has damage
+ * waiting to be rendered; any further damage goes into the same frame.
+ */
+void
+mb_wm_comp_mgr_client_damage_frame_start (MBWMCompMgrClient * client)
+{
+  if (!client)
+    return;
+
+  client->damage_frame_pending = True;
+
+  client->damage_stats.frame_events = 0;
+  client->damage_stats.frame_area   = 0;
+}
+
+/*
+ * Ends the damage frame of the client, if any; called by the compositor
+ * once the frame that took in the damage has been rendered.
+ */
+void
+mb_wm_comp_mgr_client_damage_frame_end (MBWMCompMgrClient * client)
+{
+  if (!client || !client->damage_frame_pending)
+    return;
+
+  gettimeofday (&client->damage_frame_end, NULL);
+
+  client->damage_frame_pending = False;
+  client->damage_stats.frames++;
+}
+
+/*
+ * Records a damage event of the given area for the client. Returns True if
+ * the damage can be repainted straight away, or False if it should be held
+ * back: that is, if the last frame the client caused was rendered less than
+ * MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL ms ago, in which case the compositor
+ * is expected to hold the damage back until that interval has passed. All
+ * the damage arriving before the frame it started is rendered goes into
+ * that frame.
+ */
+Bool
+mb_wm_comp_mgr_client_damage_account (MBWMCompMgrClient * client, int area)
+{
+  MBWMCompMgrClientDamageStats * stats;
+  struct timeval                 now;
+  long                           elapsed;
+
+  if (!client)
+    return True;
+
+  stats = &client->damage_stats;
+
+  stats->events++;
+  stats->area += area;
+
+  if (client->damage_frame_pending)
+    {
+      stats->frame_events++;
+      stats->frame_area += area;
+      return True;
+    }
+
+  gettimeofday (&now, NULL);
+
+  elapsed = (now.tv_sec - client->damage_frame_end.tv_sec) * 1000 +
+    (now.tv_usec - client->damage_frame_end.tv_usec) / 1000;
+
+  /* elapsed < 0 if the clock went backwards */
+  if (elapsed >= 0 && elapsed < MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL)
+    {
+      stats->deferred++;
+      return False;
+    }
+
+  mb_wm_comp_mgr_client_damage_frame_start (client);
+
+  stats->frame_events = 1;
+  stats->frame_area   = area;
+
+  return True;
+}
+
+void
+mb_wm_comp_mgr_client_get_damage_stats (MBWMCompMgrClient            * client,
+					MBWMCompMgrClientDamageStats * stats)
+{
+  if (!client || !stats)
+    return;
+
+  *stats = client->damage_stats;
+}
+
 
 /*
  * MBWMCompMgr object
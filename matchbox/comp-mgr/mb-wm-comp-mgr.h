@@ -21,6 +21,7 @@
 #ifndef _HAVE_MB_WM_COMP_MGR_H
 #define _HAVE_MB_WM_COMP_MGR_H
 
+#include <sys/time.h>
 #include <X11/extensions/Xdamage.h>
 #include <matchbox/core/mb-wm-types.h>
 
@@ -32,6 +33,13 @@
 #define MB_WM_COMP_MGR_CLIENT_CLASS(c) ((MBWMCompMgrClientClass*)(c))
 #define MB_WM_TYPE_COMP_MGR_CLIENT (mb_wm_comp_mgr_client_class_type ())
 
+/*
+ * Shortest interval, in ms, between two frames a single client can cause
+ * to be repainted; damage arriving sooner after the last frame the client
+ * was repainted in is deferred.
+ */
+#define MBWM_COMP_MGR_CLIENT_DAMAGE_INTERVAL 16
+
 struct MBWMCompMgr
 {
   MBWMObject           parent;
@@ -120,6 +128,17 @@ mb_wm_comp_mgr_select_desktop (MBWMCompMgr * mgr,
 			       int           desktop,
 			       int           old_desktop);
 
+typedef struct MBWMCompMgrClientDamageStats
+{
+  unsigned long events;       /* damage events received */
+  unsigned long area;         /* pixels damaged, overlaps counted twice */
+  unsigned long deferred;     /* events deferred to a later frame */
+  unsigned long frames;       /* frames the client caused */
+
+  int           frame_events; /* events going into the current frame */
+  int           frame_area;
+} MBWMCompMgrClientDamageStats;
+
 struct MBWMCompMgrClient
 {
   MBWMObject              parent;
@@ -129,6 +148,10 @@ struct MBWMCompMgrClient
 
   /* Make private ? */
   Bool                    is_argb32;
+
+  MBWMCompMgrClientDamageStats damage_stats;
+  struct timeval          damage_frame_end;     /* last frame rendered */
+  Bool                    damage_frame_pending; /* damage awaits a frame */
 };
 
 struct MBWMCompMgrClientClass
@@ -139,6 +162,10 @@ struct MBWMCompMgrClientClass
   void (*hide)      (MBWMCompMgrClient * client);
   void (*repair)    (MBWMCompMgrClient * client);
   void (*configure) (MBWMCompMgrClient * client, MBGeometry * geometry);
+  void (*move)      (MBWMCompMgrClient * client, MBGeometry * geometry);
+
+  void          (*release)        (MBWMCompMgrClient * client);
+  unsigned long (*resource_bytes) (MBWMCompMgrClient * client);
 };
 
 int
@@ -157,5 +184,30 @@ void
 mb_wm_comp_mgr_client_configure (MBWMCompMgrClient * client,
                                  MBGeometry * geometry);
 
+Bool
+mb_wm_comp_mgr_client_move (MBWMCompMgrClient * client, int x, int y);
+
+void
+mb_wm_comp_mgr_client_move_end (MBWMCompMgrClient * client);
+
+void
+mb_wm_comp_mgr_client_release (MBWMCompMgrClient * client);
+
+unsigned long
+mb_wm_comp_mgr_client_get_resource_bytes (MBWMCompMgrClient * client);
+
+Bool
+mb_wm_comp_mgr_client_damage_account (MBWMCompMgrClient * client, int area);
+
+void
+mb_wm_comp_mgr_client_damage_frame_start (MBWMCompMgrClient * client);
+
+void
+mb_wm_comp_mgr_client_damage_frame_end (MBWMCompMgrClient * client);
+
+void
+mb_wm_comp_mgr_client_get_damage_stats (MBWMCompMgrClient            * client,
+					MBWMCompMgrClientDamageStats * stats);
+
 
 #endif
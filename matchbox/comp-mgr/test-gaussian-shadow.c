@@ -0,0 +1,209 @@
+/*
+ *  Matchbox Window Manager - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Checks the tiles of mb_wm_comp_mgr_gaussian_shadow_get () against the
+ * shadow computed the way the xrender compositor used to do it, by summing
+ * the 2D gaussian kernel over the window rectangle for every pixel.
+ */
+
+#include "mb-wm.h"
+#include "mb-wm-comp-mgr-shadow.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WIDTH  320
+#define HEIGHT 320
+
+/* Off by one is allowed for the rounding of the separable sums */
+#define MAX_ERROR 1
+
+typedef struct MBGaussianMap
+{
+  int     size;
+  double *data;
+} MBGaussianMap;
+
+static double
+gaussian (double r, double x, double y)
+{
+  return ((1 / (sqrt (2 * M_PI * r))) *
+	  exp ((- (x * x + y * y)) / (2 * r * r)));
+}
+
+static MBGaussianMap *
+make_gaussian_map (double r)
+{
+  MBGaussianMap  *c;
+  int	          size = ((int) ceil ((r * 3)) + 1) & ~1;
+  int	          center = size / 2;
+  int	          x, y;
+  double          t = 0.0;
+  double          g;
+
+  c = malloc (sizeof (MBGaussianMap) + size * size * sizeof (double));
+  c->size = size;
+
+  c->data = (double *) (c + 1);
+
+  for (y = 0; y < size; y++)
+    for (x = 0; x < size; x++)
+      {
+	g = gaussian (r, (double) (x - center), (double) (y - center));
+	t += g;
+	c->data[y * size + x] = g;
+      }
+
+  for (y = 0; y < size; y++)
+    for (x = 0; x < size; x++)
+      c->data[y*size + x] /= t;
+
+  return c;
+}
+
+static unsigned char
+sum_gaussian (MBGaussianMap * map, double opacity,
+	      int x, int y, int width, int height)
+{
+  int	           fx, fy;
+  double         * g_data;
+  double         * g_line = map->data;
+  int	           g_size = map->size;
+  int	           center = g_size / 2;
+  int	           fx_start, fx_end;
+  int	           fy_start, fy_end;
+  double           v;
+
+  fx_start = center - x;
+  if (fx_start < 0)
+    fx_start = 0;
+  fx_end = width + center - x;
+  if (fx_end > g_size)
+    fx_end = g_size;
+
+  fy_start = center - y;
+  if (fy_start < 0)
+    fy_start = 0;
+  fy_end = height + center - y;
+  if (fy_end > g_size)
+    fy_end = g_size;
+
+  g_line = g_line + fy_start * g_size + fx_start;
+
+  v = 0;
+  for (fy = fy_start; fy < fy_end; fy++)
+    {
+      g_data = g_line;
+      g_line += g_size;
+
+      for (fx = fx_start; fx < fx_end; fx++)
+	v += *g_data++;
+    }
+  if (v > 1)
+    v = 1;
+
+  return ((unsigned int) (v * opacity * 255.0));
+}
+
+static int
+check (const char *what, double radius, double opacity, int x, int y,
+       unsigned char got, unsigned char expected)
+{
+  if (abs ((int) got - (int) expected) <= MAX_ERROR)
+    return 0;
+
+  fprintf (stderr, "radius %g, opacity %g: %s [%d, %d] is %d, expected %d\n",
+	   radius, opacity, what, x, y, got, expected);
+  return 1;
+}
+
+static int
+test_shadow (double radius, double opacity)
+{
+  const MBWMCompMgrGaussianShadow * shadow;
+  MBGaussianMap                   * map;
+  int                               tile = MB_WM_COMP_MGR_SHADOW_TILE_SZ;
+  int                               center, x, y;
+  int                               failed = 0;
+
+  shadow = mb_wm_comp_mgr_gaussian_shadow_get (radius, opacity);
+  map    = make_gaussian_map (radius);
+  center = map->size / 2;
+
+  if (shadow->size != map->size)
+    {
+      fprintf (stderr, "radius %g: size is %d, expected %d\n",
+	       radius, shadow->size, map->size);
+      free (map);
+      return 1;
+    }
+
+  if (mb_wm_comp_mgr_gaussian_shadow_get (radius, opacity) != shadow)
+    {
+      fprintf (stderr, "radius %g, opacity %g: not cached\n",
+	       radius, opacity);
+      failed++;
+    }
+
+  for (y = 0; y < tile; y++)
+    for (x = 0; x < tile; x++)
+      failed += check ("corner", radius, opacity, x, y,
+		       shadow->corner[y * tile + x],
+		       sum_gaussian (map, opacity, x - center, y - center,
+				     WIDTH, HEIGHT));
+
+  /* The top and left edges, which the other two mirror */
+  for (x = 0; x < tile; x++)
+    {
+      failed += check ("top edge", radius, opacity, 0, x, shadow->edge[x],
+		       sum_gaussian (map, opacity, center, x - center,
+				     WIDTH, HEIGHT));
+
+      failed += check ("left edge", radius, opacity, x, 0, shadow->edge[x],
+		       sum_gaussian (map, opacity, x - center, center,
+				     WIDTH, HEIGHT));
+    }
+
+  failed += check ("center", radius, opacity, 0, 0, shadow->center,
+		   sum_gaussian (map, opacity, center, center,
+				 WIDTH, HEIGHT));
+
+  free (map);
+
+  return failed;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const double radii[]     = { 2, 4, 6, 10 };
+  static const double opacities[] = { 0.25, 0.75, 0.9, 1.0 };
+  int                 failed = 0;
+  int                 i, j;
+
+  for (i = 0; i < sizeof (radii) / sizeof (radii[0]); i++)
+    for (j = 0; j < sizeof (opacities) / sizeof (opacities[0]); j++)
+      failed += test_shadow (radii[i], opacities[j]);
+
+  if (failed)
+    fprintf (stderr, "%d mismatches\n", failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+/*
+ *  Matchbox Window Manager - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Runs the xrender compositor on $DISPLAY (normally an Xvfb started by
+ * test-present.sh) and keeps damaging an override redirect window until
+ * enough frames have been shown. With the Present extension on the server
+ * the frames have to be shown through it, with completed frames and a
+ * refresh interval reported by mb_wm_comp_mgr_xrender_get_present_timing();
+ * without it the compositor has to fall back to copying to the overlay.
+ *
+ * Exits with 77 (skipped) if there is no display or no compositing.
+ */
+
+#include "mb-wm.h"
+#include "mb-wm-comp-mgr.h"
+#include "mb-wm-comp-mgr-xrender.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TICK_MS    20
+#define MAX_TICKS  250		/* Give up after 5 seconds */
+#define MIN_FRAMES 3
+
+static MBWindowManager *wm;
+static Window           win;
+static GC               gc;
+static Bool             have_present;
+static int              ticks;
+
+static Bool
+test_present_tick (void *userdata)
+{
+  unsigned long      completed = 0, interval = 0;
+  unsigned long      frames = 0, pixels = 0;
+  unsigned long long ust = 0, msc = 0;
+  MBGeometry         last;
+  Bool               timing;
+
+  /* Damage a part of the window for the next frame */
+  XSetForeground (wm->xdpy, gc, (ticks & 1) ?
+		  BlackPixel (wm->xdpy, wm->xscreen) :
+		  WhitePixel (wm->xdpy, wm->xscreen));
+  XFillRectangle (wm->xdpy, win, gc, 0, 0, 50, 50);
+  XFlush (wm->xdpy);
+
+  ticks++;
+
+  timing = mb_wm_comp_mgr_xrender_get_present_timing (wm->comp_mgr,
+						      &completed, &ust, &msc,
+						      &interval);
+  mb_wm_comp_mgr_xrender_get_present_stats (wm->comp_mgr,
+					    &frames, &pixels, &last);
+
+  if (have_present)
+    {
+      if (timing && completed >= MIN_FRAMES && interval)
+	{
+	  printf ("present: %lu frames completed, msc %llu, interval %lu us\n",
+		  completed, msc, interval);
+	  exit (0);
+	}
+    }
+  else
+    {
+      if (timing)
+	{
+	  fprintf (stderr, "present timing reported without Present\n");
+	  exit (1);
+	}
+
+      if (frames >= MIN_FRAMES)
+	{
+	  printf ("fallback: %lu frames, %lu pixels\n", frames, pixels);
+	  exit (0);
+	}
+    }
+
+  if (ticks == MAX_TICKS)
+    {
+      fprintf (stderr,
+	       "timed out (%s): %lu frames, %lu completed, interval %lu us\n",
+	       have_present ? "present" : "fallback",
+	       frames, completed, interval);
+      exit (1);
+    }
+
+  return True;
+}
+
+int
+main (int argc, char **argv)
+{
+  XSetWindowAttributes attr;
+  Display             *dpy;
+
+  if ((dpy = XOpenDisplay (NULL)) == NULL)
+    {
+      fprintf (stderr, "no display, skipping\n");
+      return 77;
+    }
+
+  XCloseDisplay (dpy);
+
+  mb_wm_object_init ();
+
+  wm = mb_wm_new (argc, argv);
+  mb_wm_init (wm);
+  mb_wm_compositing_on (wm);
+
+  if (!mb_wm_compositing_enabled (wm))
+    {
+      fprintf (stderr, "no compositing, skipping\n");
+      return 77;
+    }
+
+#if HAVE_XPRESENT
+  {
+    int major, event, error;
+
+    have_present = XQueryExtension (wm->xdpy, "Present",
+				    &major, &event, &error);
+  }
+#endif
+
+  attr.override_redirect = True;
+  attr.background_pixel  = WhitePixel (wm->xdpy, wm->xscreen);
+
+  win = XCreateWindow (wm->xdpy, wm->root_win->xwindow, 10, 10, 200, 200, 0,
+		       CopyFromParent, InputOutput, CopyFromParent,
+		       CWOverrideRedirect | CWBackPixel, &attr);
+  gc = XCreateGC (wm->xdpy, win, 0, NULL);
+
+  XMapWindow (wm->xdpy, win);
+
+  mb_wm_main_context_timeout_handler_add (wm->main_ctx, TICK_MS,
+					  test_present_tick, NULL);
+
+  mb_wm_main_loop (wm);
+
+  return 1;
+}
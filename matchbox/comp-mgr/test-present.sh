@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Runs test-present on an Xvfb with the Present extension and on one
+# without it. Skipped if Xvfb is not installed.
+
+XVFB=${XVFB:-Xvfb}
+
+if ! command -v "$XVFB" >/dev/null 2>&1; then
+  echo "$XVFB not found, skipping"
+  exit 77
+fi
+
+run ()
+{
+  dpyfile=`mktemp`
+
+  "$XVFB" -displayfd 3 -screen 0 640x480x24 -nolisten tcp "$@" \
+    3>"$dpyfile" >/dev/null 2>&1 &
+  pid=$!
+
+  i=0
+  while [ ! -s "$dpyfile" ] && [ $i -lt 50 ]; do
+    sleep 0.1
+    i=`expr $i + 1`
+  done
+
+  if [ -s "$dpyfile" ]; then
+    DISPLAY=:`cat "$dpyfile"` ./test-present
+    status=$?
+  else
+    echo "$XVFB did not start, skipping"
+    status=77
+  fi
+
+  kill $pid 2>/dev/null
+  wait $pid 2>/dev/null
+  rm -f "$dpyfile"
+
+  return $status
+}
+
+result=77
+
+for args in "" "-extension Present"; do
+  run $args
+  status=$?
+
+  case $status in
+    0)  [ $result = 77 ] && result=0 ;;
+    77) ;;
+    *)  result=1 ;;
+  esac
+done
+
+exit $result
@@ -277,11 +277,15 @@ mb_wm_class_init (MBWMObjectClass *klass)
 #endif
 }
 
+static void
+mb_wm_theme_repaint_clear (MBWindowManager *wm);
+
 static void
 mb_wm_destroy (MBWMObject *this)
 {
   MBWindowManager * wm = MB_WINDOW_MANAGER (this);
   MBWMList *l = wm->clients;
+  int       i;
 
   while (l)
     {
@@ -293,6 +297,21 @@ mb_wm_destroy (MBWMObject *this)
       free (old);
     }
 
+  for (i = 0; i < wm->n_desktop_clients; i++)
+    mb_wm_util_list_free (wm->desktop_clients[i]);
+
+  free (wm->desktop_clients);
+
+  mb_wm_theme_load_cancel (wm->theme_loader);
+  mb_wm_theme_repaint_clear (wm);
+
+  if (wm->release_cb_id)
+    {
+      mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+						 wm->release_cb_id);
+      wm->release_cb_id = 0;
+    }
+
   mb_wm_object_unref (MB_WM_OBJECT (wm->root_win));
   mb_wm_object_unref (MB_WM_OBJECT (wm->theme));
   mb_wm_object_unref (MB_WM_OBJECT (wm->layout));
@@ -362,9 +381,7 @@ mb_wm_handle_key_press (XKeyEvent       *xev,
 {
   MBWindowManager *wm = (MBWindowManager*)userdata;
 
-  mb_wm_keys_press (wm,
-		    XKeycodeToKeysym(wm->xdpy, xev->keycode, 0),
-		    xev->state);
+  mb_wm_keys_press (wm, xev->keycode, xev->state);
 
   return True;
 }
@@ -890,6 +907,7 @@ mb_wm_sync (MBWindowManager *wm)
 {
   /* Sync all changes to display */
   MBWindowManagerClient *client = NULL;
+  Bool                   batch;
 
   MBWM_MARK();
   MBWM_TRACE ();
@@ -924,10 +942,26 @@ mb_wm_sync (MBWindowManager *wm)
    * If an item in the stack needs visibilty sync, then we have to force it
    * for all items that are above it on the stack.
    */
+  /*
+   * Batched client syncs leave the round trip to us, so that all their
+   * requests go out in one go; the errors they cause only turn up with
+   * it, so a single trap has to cover the lot.
+   */
+  batch = (wm->sync_type & MBWMSyncBatch);
+
+  if (batch)
+    mb_wm_util_trap_x_errors();
+
   mb_wm_stack_enumerate(wm, client)
     if (mb_wm_client_needs_sync (client))
       mb_wm_client_display_sync (client);
 
+  if (batch)
+    {
+      XSync(wm->xdpy, False);
+      mb_wm_util_untrap_x_errors();
+    }
+
 #if ENABLE_COMPOSITE
   if (mb_wm_comp_mgr_enabled (wm->comp_mgr))
     mb_wm_comp_mgr_render (wm->comp_mgr);
@@ -1138,6 +1172,7 @@ mb_wm_unmanage_client (MBWindowManager       *wm,
   if (destroy)
     wm->clients = mb_wm_util_list_remove (wm->clients, (void*)client);
 
+  mb_wm_desktop_clients_remove (wm, client);
   mb_wm_stack_remove (client);
   mb_wm_update_root_win_lists (wm);
 
@@ -1465,6 +1500,8 @@ mb_wm_init_xdpy (MBWindowManager * wm, const char * display)
   wm->xdpy_width  = DisplayWidth(wm->xdpy, wm->xscreen);
   wm->xdpy_height = DisplayHeight(wm->xdpy, wm->xscreen);
 
+  mb_wm_util_set_x_error_display (wm->xdpy);
+
   return 1;
 }
 
@@ -1712,6 +1749,17 @@ mb_wm_cmdline_help (const char *arg0, Bool quit)
   fprintf (f, "  -theme-always-reload  : Reload theme even if it matches the currently\n"
               "                          loaded theme.\n");
   fprintf (f, "  -theme theme          : Load the specified theme\n");
+  fprintf (f, "  -threaded-compositor  : Render the composited screen on a separate\n"
+              "                          thread and X connection, where supported.\n");
+  fprintf (f, "  -texture-budget kb    : Release the textures of hidden windows once the\n"
+              "                          compositor textures take more than this many\n"
+              "                          kilobytes, where supported.\n");
+  fprintf (f, "  -clipped-redraws      : Only redraw the damaged parts of the composited\n"
+              "                          screen, where supported; needs a driver that\n"
+              "                          preserves the back buffer across swaps.\n");
+  fprintf (f, "  -release-delay ms     : Release the decor pixmaps and compositor\n"
+              "                          resources of windows that have been minimized\n"
+              "                          or on another desktop for this long.\n");
 
   if (quit)
     exit (0);
@@ -1723,6 +1771,7 @@ mb_wm_process_cmdline (MBWindowManager *wm)
   int i;
   char ** argv = wm->argv;
   int     argc = wm->argc;
+  char  * display = NULL;
 
   for (i = 0; i < argc; ++i)
     {
@@ -1734,12 +1783,20 @@ mb_wm_process_cmdline (MBWindowManager *wm)
 	{
 	  wm->flags |= MBWindowManagerFlagAlwaysReloadTheme;
 	}
+      else if (!strcmp(argv[i], "-threaded-compositor"))
+	{
+	  wm->flags |= MBWindowManagerFlagThreadedCompositor;
+	}
+      else if (!strcmp(argv[i], "-clipped-redraws"))
+	{
+	  wm->flags |= MBWindowManagerFlagClippedRedraws;
+	}
       else if (i < argc - 1)
 	{
 	  /* These need to have a value after the name parameter */
 	  if (!strcmp(argv[i], "-display"))
 	    {
-	      mb_wm_init_xdpy (wm, argv[++i]);
+	      display = argv[++i];
 	    }
 	  else if (!strcmp ("-sm-client-id", argv[i]))
 	    {
@@ -1749,13 +1806,44 @@ mb_wm_process_cmdline (MBWindowManager *wm)
 	    {
 	      wm->theme_path = argv[++i];
 	    }
+	  else if (!strcmp ("-release-delay", argv[i]))
+	    {
+	      wm->release_delay = atoi (argv[++i]);
+	    }
+#if ENABLE_COMPOSITE
+	  else if (!strcmp ("-texture-budget", argv[i]))
+	    {
+	      wm->texture_budget = strtoul (argv[++i], NULL, 10) * 1024;
+	    }
+#endif
+	}
+    }
+
+  /*
+   * The render thread of the compositor has a connection of its own, but
+   * Xlib has state shared by all connections, so it must be made thread
+   * safe before the first one is opened.
+   */
+  if (wm->flags & MBWindowManagerFlagThreadedCompositor)
+    {
+      if (wm->xdpy)
+	{
+	  mb_wm_util_warn ("display opened before XInitThreads (), "
+			   "not threading the compositor");
+	  wm->flags &= ~MBWindowManagerFlagThreadedCompositor;
+	}
+      else if (!XInitThreads ())
+	{
+	  mb_wm_util_warn ("Xlib has no thread support, not threading "
+			   "the compositor");
+	  wm->flags &= ~MBWindowManagerFlagThreadedCompositor;
 	}
     }
 
   /*
    * Anything below here needs a display conection
    */
-  if (!wm->xdpy && !mb_wm_init_xdpy (wm, NULL))
+  if (!wm->xdpy && !mb_wm_init_xdpy (wm, display))
     return;
 }
 
@@ -2063,6 +2151,101 @@ mb_wm_cycle_apps (MBWindowManager *wm, Bool reverse)
     }
 }
 
+/*
+ * After a theme change all decors need to be repainted; only the topmost
+ * clients are painted in the next sync, the rest follow a few at a time,
+ * working down the stack, so that the switch does not stall the main loop.
+ */
+#define MBWM_THEME_REPAINT_BATCH    4
+#define MBWM_THEME_REPAINT_INTERVAL 20
+
+static Bool
+mb_wm_theme_repaint_timeout (void *userdata)
+{
+  MBWindowManager *wm = userdata;
+  int              n  = 0;
+
+  while (wm->theme_repaint_queue && n < MBWM_THEME_REPAINT_BATCH)
+    {
+      MBWMList              *l = wm->theme_repaint_queue;
+      MBWindowManagerClient *client;
+
+      client = mb_wm_managed_client_from_xwindow (wm, (Window) l->data);
+
+      if (client)
+	{
+	  mb_wm_client_decor_mark_dirty (client);
+	  n++;
+	}
+
+      wm->theme_repaint_queue = l->next;
+
+      if (l->next)
+	l->next->prev = NULL;
+
+      free (l);
+    }
+
+#if USE_GLIB_MAINLOOP
+  if (wm->sync_type)
+    mb_wm_sync (wm);
+#endif
+
+  if (wm->theme_repaint_queue)
+    return True;
+
+  wm->theme_repaint_id = 0;
+  return False;
+}
+
+static void
+mb_wm_theme_repaint_clear (MBWindowManager *wm)
+{
+  if (wm->theme_repaint_id)
+    {
+      mb_wm_main_context_timeout_handler_remove (wm->main_ctx,
+						 wm->theme_repaint_id);
+      wm->theme_repaint_id = 0;
+    }
+
+  mb_wm_util_list_free (wm->theme_repaint_queue);
+  wm->theme_repaint_queue = NULL;
+}
+
+static void
+mb_wm_theme_repaint_schedule (MBWindowManager *wm)
+{
+  MBWindowManagerClient *client;
+  int                    n = 0;
+
+  mb_wm_theme_repaint_clear (wm);
+
+  if (!wm->main_ctx)
+    return;
+
+  mb_wm_stack_enumerate_reverse (wm, client)
+    {
+      if (!client->decor || !mb_wm_client_needs_decor_sync (client))
+	continue;
+
+      if (n++ < MBWM_THEME_REPAINT_BATCH)
+	continue;
+
+      mb_wm_client_decor_unmark_dirty (client);
+
+      wm->theme_repaint_queue =
+	mb_wm_util_list_append (wm->theme_repaint_queue,
+				(void *) client->window->xwindow);
+    }
+
+  if (wm->theme_repaint_queue)
+    wm->theme_repaint_id =
+      mb_wm_main_context_timeout_handler_add (wm->main_ctx,
+					      MBWM_THEME_REPAINT_INTERVAL,
+					      mb_wm_theme_repaint_timeout,
+					      wm);
+}
+
 void
 mb_wm_set_theme (MBWindowManager *wm, MBWMTheme * theme)
 {
@@ -2087,10 +2270,24 @@ mb_wm_set_theme (MBWindowManager *wm, MBWMTheme * theme)
   mb_wm_object_signal_emit (MB_WM_OBJECT (wm),
 			    MBWindowManagerSignalThemeChange);
 
+  mb_wm_theme_repaint_schedule (wm);
 
   XUngrabServer(wm->xdpy);
 }
 
+static void
+mb_wm_theme_loaded (MBWindowManager *wm, MBWMTheme *theme, void *userdata)
+{
+  wm->theme_loader = NULL;
+
+  mb_wm_set_theme (wm, theme);
+
+#if USE_GLIB_MAINLOOP
+  if (wm->sync_type)
+    mb_wm_sync (wm);
+#endif
+}
+
 void
 mb_wm_set_theme_from_path (MBWindowManager *wm, const char *theme_path)
 {
@@ -2099,6 +2296,18 @@ mb_wm_set_theme_from_path (MBWindowManager *wm, const char *theme_path)
 
   wm_class = MB_WINDOW_MANAGER_CLASS (MB_WM_OBJECT_GET_CLASS (wm));
 
+  if (wm->theme_loader)
+    {
+      const char *path = mb_wm_theme_load_get_path (wm->theme_loader);
+
+      if ((path && theme_path && !strcmp (theme_path, path)) ||
+	  (!path && !theme_path))
+	return;
+
+      mb_wm_theme_load_cancel (wm->theme_loader);
+      wm->theme_loader = NULL;
+    }
+
   if (wm->theme)
     {
       if (!(wm->flags & MBWindowManagerFlagAlwaysReloadTheme) &&
@@ -2110,6 +2319,18 @@ mb_wm_set_theme_from_path (MBWindowManager *wm, const char *theme_path)
 	return;
     }
 
+  /*
+   * The initial theme is needed straight away; on a runtime switch the
+   * theme is loaded in the background, unless the manager provides its own
+   * theme constructor.
+   */
+  if (wm->theme && wm_class->theme_new == mb_wm_real_theme_new)
+    {
+      wm->theme_loader = mb_wm_theme_load_async (wm, theme_path,
+						 mb_wm_theme_loaded, NULL);
+      return;
+    }
+
   theme = wm_class->theme_new (wm, theme_path);
 
   mb_wm_set_theme (wm, theme);
@@ -2229,7 +2450,9 @@ mb_wm_select_desktop (MBWindowManager *wm, int desktop)
 {
   long                 card32 = desktop;
   MBWindowManagerClient *c;
+  const MBWMList        *l;
   int                    old_desktop;
+  int                    i;
 
   if (desktop == wm->active_desktop)
     return;
@@ -2243,8 +2466,25 @@ mb_wm_select_desktop (MBWindowManager *wm, int desktop)
       mb_wm_set_n_desktops (wm, desktop + 1);
     }
 
-  mb_wm_stack_enumerate (wm, c)
-    mb_wm_client_desktop_change (c, desktop);
+  /*
+   * Only the clients on the old and new desktops change; sticky clients are
+   * not indexed. The maps and unmaps happen in the next sync, which we ask
+   * to do with a single round trip for all of them.
+   */
+  for (i = 0; i < 2; i++)
+    {
+      l = mb_wm_get_desktop_clients (wm, i ? desktop : old_desktop);
+
+      while (l)
+	{
+	  c = l->data;
+	  l = l->next;
+
+	  mb_wm_client_desktop_change (c, desktop);
+	}
+    }
+
+  mb_wm_display_sync_queue (wm, MBWMSyncBatch);
 
   XChangeProperty(wm->xdpy, wm->root_win->xwindow,
 		  wm->atoms[MBWM_ATOM_NET_CURRENT_DESKTOP],
@@ -2257,3 +2497,54 @@ mb_wm_select_desktop (MBWindowManager *wm, int desktop)
 #endif
 }
 
+/*
+ * Returns the managed clients on the given desktop, in no particular order;
+ * sticky clients are not on any desktop.
+ */
+const MBWMList *
+mb_wm_get_desktop_clients (MBWindowManager *wm, int desktop)
+{
+  if (desktop < 0 || desktop >= wm->n_desktop_clients)
+    return NULL;
+
+  return wm->desktop_clients[desktop];
+}
+
+void
+mb_wm_desktop_clients_add (MBWindowManager *wm, MBWindowManagerClient *client)
+{
+  int desktop = client->desktop;
+
+  if (desktop < 0)
+    return;
+
+  if (desktop >= wm->n_desktop_clients)
+    {
+      int n = desktop + 1;
+
+      wm->desktop_clients = realloc (wm->desktop_clients,
+				     n * sizeof (MBWMList *));
+
+      memset (wm->desktop_clients + wm->n_desktop_clients, 0,
+	      (n - wm->n_desktop_clients) * sizeof (MBWMList *));
+
+      wm->n_desktop_clients = n;
+    }
+
+  wm->desktop_clients[desktop] =
+    mb_wm_util_list_prepend (wm->desktop_clients[desktop], client);
+}
+
+void
+mb_wm_desktop_clients_remove (MBWindowManager       *wm,
+			      MBWindowManagerClient *client)
+{
+  int desktop = client->desktop;
+
+  if (desktop < 0 || desktop >= wm->n_desktop_clients)
+    return;
+
+  wm->desktop_clients[desktop] =
+    mb_wm_util_list_remove (wm->desktop_clients[desktop], client);
+}
+
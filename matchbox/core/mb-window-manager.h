@@ -37,6 +37,8 @@ typedef enum MBWindowManagerFlag
 {
   MBWindowManagerFlagDesktop           = (1<<0),
   MBWindowManagerFlagAlwaysReloadTheme = (1<<1),
+  MBWindowManagerFlagThreadedCompositor = (1<<2),
+  MBWindowManagerFlagClippedRedraws     = (1<<3),
 } MBWindowManagerFlag;
 
 typedef enum
@@ -79,17 +81,25 @@ struct MBWindowManager
   MBWMSyncType                 sync_type;
   int                          client_type_cnt;
   int                          stack_n_clients;
+  MBWMList                   **desktop_clients; /* managed clients by desktop */
+  int                          n_desktop_clients;
   MBWMRootWindow              *root_win;
 
   const char                  *sm_client_id;
 
   MBWMTheme                   *theme;
+  MBWMThemeLoader             *theme_loader;
+  MBWMList                    *theme_repaint_queue;
+  unsigned long                theme_repaint_id;
   MBWMLayout                  *layout;
   MBWMMainContext             *main_ctx;
   MBWindowManagerFlag          flags;
+  int                          release_delay; /* ms, 0 to keep resources */
+  unsigned long                release_cb_id;
 #if ENABLE_COMPOSITE
   MBWMCompMgr                 *comp_mgr;
   int                          damage_event_base;
+  unsigned long                texture_budget; /* bytes, 0 for no limit */
 #endif
 
   MBWindowManagerCursor        cursor;
@@ -228,4 +238,14 @@ mb_wm_set_n_desktops (MBWindowManager *wm, int n_desktops);
 void
 mb_wm_select_desktop (MBWindowManager *wm, int desktop);
 
+const MBWMList *
+mb_wm_get_desktop_clients (MBWindowManager *wm, int desktop);
+
+void
+mb_wm_desktop_clients_add (MBWindowManager *wm, MBWindowManagerClient *client);
+
+void
+mb_wm_desktop_clients_remove (MBWindowManager       *wm,
+			      MBWindowManagerClient *client);
+
 #endif
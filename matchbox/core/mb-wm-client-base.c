@@ -302,6 +302,7 @@ mb_wm_client_base_set_state_props (MBWindowManagerClient *c)
   long            card32[2];
   Atom              ewmh_state [MBWMClientWindowEWHMStatesCount];
   int               ewmh_i = 0;
+  int               desktop;
 
   card32[1] = None;
 
@@ -351,6 +352,14 @@ mb_wm_client_base_set_state_props (MBWindowManagerClient *c)
 		     (void*) &ewmh_state[0], ewmh_i);
   else
     XDeleteProperty (xdpy, xwin, wm->atoms[MBWM_ATOM_NET_WM_STATE]);
+
+  /* Sticky clients are on all desktops */
+  desktop = mb_wm_client_get_desktop (c);
+  card32[0] = desktop < 0 ? 0xffffffff : desktop;
+
+  XChangeProperty (xdpy, xwin, wm->atoms[MBWM_ATOM_NET_WM_DESKTOP],
+		   XA_CARDINAL, 32, PropModeReplace,
+		   (void *)&card32[0], 1);
 }
 
 static void
@@ -653,9 +662,13 @@ mb_wm_client_base_display_sync (MBWindowManagerClient *client)
 
   mb_wm_util_untrap_x_errors();
 
-  mb_wm_util_trap_x_errors();
-  XSync(wm->xdpy, False);
-  mb_wm_util_untrap_x_errors();
+  /* In a batched sync the window manager does the round trip for us */
+  if (!(wm->sync_type & MBWMSyncBatch))
+    {
+      mb_wm_util_trap_x_errors();
+      XSync(wm->xdpy, False);
+      mb_wm_util_untrap_x_errors();
+    }
 }
 
 /* Note request geometry always called by layout manager */
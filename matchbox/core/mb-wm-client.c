@@ -23,9 +23,11 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <sys/time.h>
 
 #if ENABLE_COMPOSITE
 #include <X11/extensions/Xrender.h>
+#include "mb-wm-comp-mgr.h"
 #endif
 
 struct MBWindowManagerClientPriv
@@ -34,9 +36,18 @@ struct MBWindowManagerClientPriv
   Bool          mapped;
   Bool          iconizing;
   Bool          hiding_from_desktop;
+  Bool          released;
+  Bool          decor_repaint_deferred;
   MBWMSyncType  sync_state;
+
+  /* When the resources of the hidden client are due to be released */
+  Bool            release_pending;
+  struct timeval  release_time;
 };
 
+static void
+mb_wm_client_release_stop (MBWindowManagerClient *client);
+
 static void
 mb_wm_client_destroy (MBWMObject *obj)
 {
@@ -60,6 +71,7 @@ mb_wm_client_destroy (MBWMObject *obj)
    * segfault in the timeout list manipulation
    */
   mb_wm_client_ping_stop (client);
+  mb_wm_client_release_stop (client);
 
 #if ENABLE_COMPOSITE
   if (mb_wm_compositing_enabled (wm))
@@ -279,10 +291,29 @@ mb_wm_client_decor_mark_dirty (MBWindowManagerClient *client)
   mb_wm_display_sync_queue (client->wmref, MBWMSyncDecor);
 
   client->priv->sync_state |= MBWMSyncDecor;
+  client->priv->decor_repaint_deferred = False;
 
   MBWM_DBG(" sync state: %i", client->priv->sync_state);
 }
 
+/*
+ * Postpones the repaint of the decors until the client is marked dirty
+ * again; the decors themselves stay dirty, and resizing them does not
+ * bring the repaint forward.
+ */
+void
+mb_wm_client_decor_unmark_dirty (MBWindowManagerClient *client)
+{
+  client->priv->sync_state &= ~MBWMSyncDecor;
+  client->priv->decor_repaint_deferred = True;
+}
+
+Bool
+mb_wm_client_decor_repaint_is_deferred (MBWindowManagerClient *client)
+{
+  return client->priv->decor_repaint_deferred;
+}
+
 Bool
 mb_wm_client_needs_fullscreen_sync (MBWindowManagerClient *client)
 {
@@ -390,6 +421,144 @@ mb_wm_client_needs_stack_sync (MBWindowManagerClient *client)
   return (client->priv->sync_state & MBWMSyncStacking);
 }
 
+/*
+ * All the pending releases share a single timeout, armed for the earliest
+ * of them. The delay is the same for every client, so a new release is
+ * never due before the ones already pending.
+ */
+static Bool
+mb_wm_client_release_timeout_cb (void * userdata)
+{
+  MBWindowManager * wm   = userdata;
+  struct timeval  * next = NULL;
+  struct timeval    now;
+  MBWMList        * l;
+
+  wm->release_cb_id = 0;
+
+  gettimeofday (&now, NULL);
+
+  for (l = wm->clients; l; l = l->next)
+    {
+      MBWindowManagerClient     * client = l->data;
+      MBWindowManagerClientPriv * priv   = client->priv;
+
+      if (!priv->release_pending)
+	continue;
+
+      if (!timercmp (&priv->release_time, &now, >))
+	{
+	  priv->release_pending = False;
+	  mb_wm_client_release_resources (client);
+	}
+      else if (!next || timercmp (&priv->release_time, next, <))
+	next = &priv->release_time;
+    }
+
+  if (next)
+    {
+      struct timeval delay;
+
+      timersub (next, &now, &delay);
+
+      wm->release_cb_id =
+	mb_wm_main_context_timeout_handler_add (wm->main_ctx,
+						delay.tv_sec * 1000 +
+						delay.tv_usec / 1000 + 1,
+						mb_wm_client_release_timeout_cb,
+						wm);
+    }
+
+  return False;
+}
+
+/*
+ * Schedules the resources of a client which has just been hidden to be
+ * released, if the window manager is set up to do so.
+ */
+static void
+mb_wm_client_release_start (MBWindowManagerClient *client)
+{
+  MBWindowManager           * wm   = client->wmref;
+  MBWindowManagerClientPriv * priv = client->priv;
+  struct timeval              delay;
+
+  if (!wm->release_delay || priv->release_pending || priv->released)
+    return;
+
+  delay.tv_sec  = wm->release_delay / 1000;
+  delay.tv_usec = (wm->release_delay % 1000) * 1000;
+
+  gettimeofday (&priv->release_time, NULL);
+  timeradd (&priv->release_time, &delay, &priv->release_time);
+
+  priv->release_pending = True;
+
+  if (!wm->release_cb_id)
+    wm->release_cb_id =
+      mb_wm_main_context_timeout_handler_add (wm->main_ctx, wm->release_delay,
+					      mb_wm_client_release_timeout_cb,
+					      wm);
+}
+
+/*
+ * Cancels a pending release; the shared timeout is left alone, and just
+ * finds nothing to do for the client.
+ */
+static void
+mb_wm_client_release_stop (MBWindowManagerClient *client)
+{
+  client->priv->release_pending = False;
+}
+
+/*
+ * Frees the decor pixmaps and theme data of a hidden client, and whatever
+ * the compositor holds for it; all of it is built again when the client is
+ * shown. Does nothing for a client that is shown.
+ */
+void
+mb_wm_client_release_resources (MBWindowManagerClient *client)
+{
+  if (client->priv->mapped || client->priv->released)
+    return;
+
+  MBWM_NOTE (CLIENT, "releasing %lu bytes for %x",
+	     mb_wm_client_get_resource_bytes (client),
+	     client->window->xwindow);
+
+  mb_wm_util_list_foreach (client->decor,
+			   (MBWMListForEachCB)mb_wm_decor_release,
+			   NULL);
+
+#if ENABLE_COMPOSITE
+  if (mb_wm_compositing_enabled (client->wmref))
+    mb_wm_comp_mgr_client_release (client->cm_client);
+#endif
+
+  client->priv->released = True;
+}
+
+/*
+ * Estimates the server side memory, in bytes, held on behalf of the client
+ * by the window manager, its theme and the compositor.
+ */
+unsigned long
+mb_wm_client_get_resource_bytes (MBWindowManagerClient *client)
+{
+  unsigned long     bytes = 0;
+  MBWMList        * l;
+
+  for (l = client->decor; l; l = l->next)
+    bytes += mb_wm_decor_get_resource_bytes (l->data);
+
+#if ENABLE_COMPOSITE
+  if (mb_wm_compositing_enabled (client->wmref))
+    bytes += mb_wm_comp_mgr_client_get_resource_bytes (client->cm_client);
+#endif
+
+  return bytes;
+}
+
 void
 mb_wm_client_show (MBWindowManagerClient *client)
 {
@@ -402,6 +571,18 @@ mb_wm_client_show (MBWindowManagerClient *client)
 
   client->priv->mapped = True;
 
+  mb_wm_client_release_stop (client);
+
+  /*
+   * The decors were left dirty when released, so this repaints them and the
+   * theme creates its data again; the compositor does its own rebuilding.
+   */
+  if (client->priv->released)
+    {
+      client->priv->released = False;
+      mb_wm_client_decor_mark_dirty (client);
+    }
+
   /* Make sure any Hidden state flag is cleared */
   mb_wm_client_set_state (client,
 			  MBWM_ATOM_NET_WM_STATE_HIDDEN,
@@ -425,6 +606,7 @@ mb_wm_client_hide (MBWindowManagerClient *client)
 
       mb_wm_unfocus_client (client->wmref, client);
       mb_wm_client_visibility_mark_dirty (client);
+      mb_wm_client_release_start (client);
     }
 }
 
@@ -1068,7 +1250,11 @@ mb_wm_client_is_argb32 (MBWindowManagerClient *client)
 void
 mb_wm_client_set_desktop (MBWindowManagerClient * client, int desktop)
 {
+  MBWindowManager * wm = client->wmref;
+
+  mb_wm_desktop_clients_remove (wm, client);
   client->desktop = desktop;
+  mb_wm_desktop_clients_add (wm, client);
 }
 
 int
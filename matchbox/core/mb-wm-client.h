@@ -286,6 +286,12 @@ mb_wm_client_visibility_mark_dirty (MBWindowManagerClient *client);
 void
 mb_wm_client_decor_mark_dirty (MBWindowManagerClient *client);
 
+void
+mb_wm_client_decor_unmark_dirty (MBWindowManagerClient *client);
+
+Bool
+mb_wm_client_decor_repaint_is_deferred (MBWindowManagerClient *client);
+
 void
 mb_wm_client_add_transient (MBWindowManagerClient *client,
 			    MBWindowManagerClient *transient);
@@ -348,6 +354,12 @@ mb_wm_client_reset_iconizing (MBWindowManagerClient *client);
 void
 mb_wm_client_iconize (MBWindowManagerClient *client);
 
+void
+mb_wm_client_release_resources (MBWindowManagerClient *client);
+
+unsigned long
+mb_wm_client_get_resource_bytes (MBWindowManagerClient *client);
+
 int
 mb_wm_client_title_height (MBWindowManagerClient *client);
 
@@ -21,6 +21,16 @@
 #include "mb-wm.h"
 #include "mb-wm-theme.h"
 
+#if ENABLE_COMPOSITE
+# include "mb-wm-comp-mgr.h"
+#endif
+
+/*
+ * While dragging a window with a compositor, how often (ms) the window is
+ * actually moved; in between only the composited image moves.
+ */
+#define MBWM_DECOR_DRAG_CONFIGURE_INTERVAL 250
+
 static void
 mb_wm_decor_destroy (MBWMObject *obj);
 
@@ -226,6 +236,9 @@ mb_wm_decor_press_handler (XButtonEvent    *xev,
       MBGeometry geom;
       int        orig_x, orig_y;
       int        orig_p_x, orig_p_y;
+      Time       last_configure = xev->time;
+      Bool       previewing = False;
+      Bool       configured = True;
 
       mb_wm_client_get_coverage (decor->parent_client, &geom);
 
@@ -279,37 +292,78 @@ mb_wm_decor_press_handler (XButtonEvent    *xev,
 		{
 		case MotionNotify:
 		  {
-		    Bool events_pending;
-		    int  event_count = 5; /*Limit how much we spin the loop*/
 		    XMotionEvent *pev = (XMotionEvent*)&ev;
-		    int diff_x = pev->x_root - orig_p_x;
-		    int diff_y = pev->y_root - orig_p_y;
+		    int diff_x, diff_y;
+
+		    /* Only the latest of the queued up motions matters */
+		    while (XEventsQueued (wm->xdpy, QueuedAfterReading))
+		      {
+			XEvent next;
+
+			XPeekEvent (wm->xdpy, &next);
+
+			if (next.type != MotionNotify)
+			  break;
+
+			XNextEvent (wm->xdpy, &ev);
+		      }
+
+		    diff_x = pev->x_root - orig_p_x;
+		    diff_y = pev->y_root - orig_p_y;
 
 		    geom.x = orig_x + diff_x;
 		    geom.y = orig_y + diff_y;
 
-		    mb_wm_client_request_geometry (decor->parent_client,
+#if ENABLE_COMPOSITE
+		    /*
+		     * With a compositor, the composited image follows the
+		     * pointer and the window itself only every now and then,
+		     * so that the client is not flooded with configures.
+		     */
+		    if (mb_wm_compositing_enabled (wm))
+		      previewing =
+			mb_wm_comp_mgr_client_move (
+					   decor->parent_client->cm_client,
+					   geom.x, geom.y);
+#endif
+
+		    if (!previewing ||
+			pev->time - last_configure >=
+			MBWM_DECOR_DRAG_CONFIGURE_INTERVAL)
+		      {
+			mb_wm_client_request_geometry (decor->parent_client,
 					   &geom,
 					   MBWMClientReqGeomIsViaUserAction);
 
-		    do
-		      {
-			events_pending =
-			  mb_wm_main_context_spin_loop (wm->main_ctx);
+			last_configure = pev->time;
+			configured = True;
+		      }
+		    else
+		      configured = False;
 
-			--event_count;
-		      } while (events_pending && event_count);
+		    /* One pass of the loop per compressed motion */
+		    mb_wm_main_context_spin_loop (wm->main_ctx);
 		  }
 		  break;
 		case ButtonRelease:
-		  {
-		    XUngrabPointer (wm->xdpy, CurrentTime);
-		    return False;
-		  }
+		  mb_wm_decor_release_handler ((XButtonEvent*)&ev, decor);
+		  retval = False;
+		  break;
 		default:
 		  ;
 		}
 	    }
+
+	  /* Now move the window to where it was dropped */
+	  if (!configured)
+	    mb_wm_client_request_geometry (decor->parent_client,
+					   &geom,
+					   MBWMClientReqGeomIsViaUserAction);
+
+#if ENABLE_COMPOSITE
+	  if (previewing)
+	    mb_wm_comp_mgr_client_move_end (decor->parent_client->cm_client);
+#endif
 	}
     }
 
@@ -537,8 +591,14 @@ mb_wm_decor_handle_resize (MBWMDecor *decor)
   /* Fire resize callback */
   mb_wm_decor_resize(decor);
 
-  /* Fire repaint callback */
-  mb_wm_decor_mark_dirty (decor);
+  /*
+   * Fire repaint callback; if the repaint of the client decors has been
+   * put off, as after a theme change, the decor is painted when it is due.
+   */
+  if (mb_wm_client_decor_repaint_is_deferred (decor->parent_client))
+    decor->dirty |= MBWMDecorDirtyPaint;
+  else
+    mb_wm_decor_mark_dirty (decor);
 }
 
 MBWMDecor*
@@ -682,6 +742,40 @@ mb_wm_decor_get_theme_data (MBWMDecor * decor)
   return decor->themedata;
 }
 
+/*
+ * Frees the theme data of the decor, along with the pixmap the theme paints
+ * the decor into; the next repaint of the decor creates it again.
+ */
+void
+mb_wm_decor_release (MBWMDecor *decor)
+{
+  MBWindowManagerClient *client = decor->parent_client;
+
+  if (!decor->themedata)
+    return;
+
+  /* The window background holds on to the pixmap otherwise */
+  if (client && decor->xwin)
+    XSetWindowBackgroundPixmap (client->wmref->xdpy, decor->xwin, None);
+
+  mb_wm_decor_set_theme_data (decor, NULL, NULL);
+
+  decor->dirty = MBWMDecorDirtyFull;
+}
+
+/*
+ * Estimates the server side memory, in bytes, the theme holds for the
+ * decor; the themes paint each decor into a pixmap of its size.
+ */
+unsigned long
+mb_wm_decor_get_resource_bytes (MBWMDecor *decor)
+{
+  if (!decor->themedata)
+    return 0;
+
+  return (unsigned long) decor->geom.width * decor->geom.height * 4;
+}
+
 /* Buttons */
 static void
 mb_wm_decor_button_destroy (MBWMObject* obj);
@@ -128,6 +128,12 @@ mb_wm_decor_set_theme_data (MBWMDecor * decor, void *userdata,
 void *
 mb_wm_decor_get_theme_data (MBWMDecor* decor);
 
+void
+mb_wm_decor_release (MBWMDecor *decor);
+
+unsigned long
+mb_wm_decor_get_resource_bytes (MBWMDecor *decor);
+
 typedef enum MBWMDecorButtonState
 {
   MBWMDecorButtonStateInactive = 0,
@@ -5,6 +5,21 @@ struct MBWMKeys /* FIXME: Probably do want to hide these here */
 {
   MBWMList *bindings;  /* Always points to first binding */
 
+  /*
+   * The bindings hashed by keycode and modifier mask, so a key press does
+   * not have to look at every binding.
+   */
+  MBWMList **table;
+  int        table_size;
+  int        n_bindings;
+
+  /*
+   * Bindings added since mb_wm_keys_batch_begin (), whose grabs have not
+   * been checked yet.
+   */
+  Bool       batching;
+  MBWMList  *batched;
+
   int MetaMask;
   int HyperMask;
   int SuperMask;
@@ -16,6 +31,12 @@ struct MBWMKeys /* FIXME: Probably do want to hide these here */
 
 };
 
+/* Modifiers that can be part of a binding; anything else is ignored */
+#define MBWM_KEYS_MODIFIER_MASK \
+  (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask)
+
+#define MBWM_KEYS_MIN_TABLE_SIZE 32
+
 static Bool
 keysym_needs_shift (MBWindowManager *wm, KeySym keysym)
 {
@@ -34,70 +55,100 @@ keysym_needs_shift (MBWindowManager *wm, KeySym keysym)
   return False;
 }
 
-static Bool
+static unsigned int
+key_binding_hash (MBWMKeys *keys, KeyCode keycode, int modifier_mask)
+{
+  return ((unsigned int) keycode * 33 + modifier_mask) &
+    (keys->table_size - 1);
+}
+
+static void
+key_binding_table_insert (MBWMKeys *keys, MBWMKeyBinding *binding)
+{
+  unsigned int i;
+
+  i = key_binding_hash (keys, binding->keycode, binding->modifier_mask);
+
+  keys->table[i] = mb_wm_util_list_prepend (keys->table[i], binding);
+}
+
+static void
+key_binding_table_remove (MBWMKeys *keys, MBWMKeyBinding *binding)
+{
+  unsigned int i;
+
+  i = key_binding_hash (keys, binding->keycode, binding->modifier_mask);
+
+  keys->table[i] = mb_wm_util_list_remove (keys->table[i], binding);
+}
+
+/*
+ * Rehashes all the bindings, making the table large enough for them; needed
+ * whenever the keycodes of the bindings change.
+ */
+static void
+key_binding_table_rebuild (MBWMKeys *keys)
+{
+  MBWMList *iter;
+  int       i, size = MBWM_KEYS_MIN_TABLE_SIZE;
+
+  while (size < keys->n_bindings * 2)
+    size *= 2;
+
+  for (i = 0; i < keys->table_size; i++)
+    mb_wm_util_list_free (keys->table[i]);
+
+  if (size != keys->table_size)
+    {
+      free (keys->table);
+      keys->table = mb_wm_util_malloc0 (size * sizeof (MBWMList*));
+      keys->table_size = size;
+    }
+  else
+    memset (keys->table, 0, size * sizeof (MBWMList*));
+
+  for (iter = keys->bindings; iter; iter = mb_wm_util_list_next (iter))
+    key_binding_table_insert (keys, (MBWMKeyBinding*)iter->data);
+}
+
+/*
+ * Issues the (un)grabs of the binding with every combination of the lock
+ * modifiers; the caller takes care of any errors.
+ */
+static void
 key_binding_set_grab (MBWindowManager *wm,
 		      MBWMKeyBinding  *key,
 		      Bool             ungrab)
 {
+  int lock_mask    = wm->keys->lock_mask;
   int ignored_mask = 0;
 
-  MBWM_ASSERT (wm->keys != NULL);
-
-  /* Needed to grab all Locked combo's too */
-  while (ignored_mask < (int) wm->keys->lock_mask)
+  /* Walks all the subsets of lock_mask, starting with the empty one */
+  do
     {
-      if (ignored_mask & ~(wm->keys->lock_mask))
-	{
-	  ++ignored_mask;
-	  continue;
-	}
-
       if (ungrab)
 	{
 	  MBWM_DBG("ungrabbing %i , %i",
-		   XKeysymToKeycode(wm->xdpy, key->keysym),
-		   key->modifier_mask);
+		   key->keycode, key->modifier_mask | ignored_mask);
 
-	  XUngrabKey(wm->xdpy,
-		     XKeysymToKeycode(wm->xdpy, key->keysym),
+	  XUngrabKey(wm->xdpy, key->keycode,
 		     key->modifier_mask | ignored_mask,
 		     wm->root_win->xwindow);
 	}
       else
 	{
-	  int result;
-
-	  mb_wm_util_trap_x_errors();
-
 	  MBWM_DBG ("grabbing keycode: %i, keysym %li, mask: %i",
-		   XKeysymToKeycode(wm->xdpy, key->keysym),
-		   key->keysym,
-		   key->modifier_mask | ignored_mask);
+		    key->keycode, key->keysym,
+		    key->modifier_mask | ignored_mask);
 
-	  XGrabKey(wm->xdpy, XKeysymToKeycode(wm->xdpy, key->keysym),
+	  XGrabKey(wm->xdpy, key->keycode,
 		   key->modifier_mask | ignored_mask,
 		   wm->root_win->xwindow, True, GrabModeAsync, GrabModeAsync);
-
-	  result = mb_wm_util_untrap_x_errors();
-
-	  if (result != Success)
-	    {
-	      if (result == BadAccess)
-		mb_wm_util_warn ("Some other program is already using the key %s with modifiers %x as a binding\n",
-				 (XKeysymToString(key->keysym)) ? XKeysymToString (key->keysym) : "unknown",
-				 key->modifier_mask | ignored_mask );
-	      else
-		mb_wm_util_warn ("Unable to grab the key %s with modifiers %x as a binding\n",
-				 (XKeysymToString(key->keysym)) ? XKeysymToString (key->keysym) : "unknown",
-				 key->modifier_mask | ignored_mask );
-	      return False;
-	    }
 	}
 
-      ++ignored_mask;
+      ignored_mask = (ignored_mask - lock_mask) & lock_mask;
     }
-
-  return True;
+  while (ignored_mask);
 }
 
 void
@@ -110,10 +161,50 @@ void
 mb_wm_keys_binding_remove (MBWindowManager    *wm,
 			   MBWMKeyBinding     *binding)
 {
+  MBWMKeys *keys = wm->keys;
 
   key_binding_set_grab (wm, binding, True);
+
+  key_binding_table_remove (keys, binding);
+  keys->bindings = mb_wm_util_list_remove (keys->bindings, binding);
+  keys->batched  = mb_wm_util_list_remove (keys->batched, binding);
+  keys->n_bindings--;
+
+  if (binding->destroy)
+    binding->destroy (wm, binding, binding->userdata);
+
+  free (binding);
+}
+
+static void
+key_binding_insert (MBWMKeys *keys, MBWMKeyBinding *binding)
+{
+  keys->bindings = mb_wm_util_list_append(keys->bindings, binding);
+  keys->n_bindings++;
+
+  if (keys->n_bindings * 2 > keys->table_size)
+    key_binding_table_rebuild (keys);
+  else
+    key_binding_table_insert (keys, binding);
+}
+
+static void
+key_binding_warn_grab_failed (MBWMKeyBinding *binding, int result)
+{
+  const char *name = XKeysymToString (binding->keysym);
+
+  if (result == BadAccess)
+    mb_wm_util_warn ("Some other program is already using the key %s with modifiers %x as a binding\n",
+		     name ? name : "unknown", binding->modifier_mask);
+  else
+    mb_wm_util_warn ("Unable to grab the key %s with modifiers %x as a binding\n",
+		     name ? name : "unknown", binding->modifier_mask);
 }
 
+/*
+ * Adds a key binding. Within a batch, the binding is returned before its
+ * grabs are known to have succeeded; see mb_wm_keys_batch_end ().
+ */
 MBWMKeyBinding*
 mb_wm_keys_binding_add (MBWindowManager    *wm,
 			KeySym              ks,
@@ -124,28 +215,128 @@ mb_wm_keys_binding_add (MBWindowManager    *wm,
 {
   MBWMKeyBinding *binding = NULL;
   MBWMKeys       *keys = wm->keys;
+  int             result;
 
   MBWM_ASSERT (wm->keys != NULL);
 
   binding = mb_wm_util_malloc0(sizeof(MBWMKeyBinding));
 
   binding->keysym        = ks;
+  binding->keycode       = XKeysymToKeycode (wm->xdpy, ks);
   binding->modifier_mask = mask;
   binding->pressed       = press_func;
   binding->destroy       = destroy_func;
   binding->userdata      = userdata;
 
-  if (key_binding_set_grab (wm, binding, False))
+  if (keys->batching)
+    {
+      /* Errors are caught by the trap of the batch */
+      key_binding_set_grab (wm, binding, False);
+      key_binding_insert (keys, binding);
+
+      keys->batched = mb_wm_util_list_append (keys->batched, binding);
+
+      return binding;
+    }
+
+  /* All the grabs of the binding take a single round trip */
+  mb_wm_util_trap_x_errors();
+  key_binding_set_grab (wm, binding, False);
+  XSync (wm->xdpy, False);
+  result = mb_wm_util_untrap_x_errors();
+
+  if (result == Success)
     {
-      keys->bindings = mb_wm_util_list_append(keys->bindings, binding);
+      key_binding_insert (keys, binding);
       return binding;
     }
 
-  /* Grab failed */
+  key_binding_warn_grab_failed (binding, result);
+
+  /* Grab failed; drop whichever of the grabs did succeed */
+  mb_wm_util_trap_x_errors();
+  key_binding_set_grab (wm, binding, True);
+  XSync (wm->xdpy, False);
+  mb_wm_util_untrap_x_errors();
+
   free(binding);
   return NULL;
 }
 
+/*
+ * Starts a batch of binding additions, as when loading a configuration:
+ * the grabs of all the bindings added until mb_wm_keys_batch_end () are
+ * checked with a single round trip, instead of one per binding.
+ */
+void
+mb_wm_keys_batch_begin (MBWindowManager *wm)
+{
+  MBWMKeys *keys = wm->keys;
+
+  MBWM_ASSERT (keys != NULL && !keys->batching);
+
+  keys->batching = True;
+  mb_wm_util_trap_x_errors();
+}
+
+/*
+ * Ends a batch of binding additions. If any of the grabs failed, the
+ * bindings of the batch are grabbed again one by one to find out which,
+ * and those are removed again, calling their destroy functions.
+ */
+void
+mb_wm_keys_batch_end (MBWindowManager *wm)
+{
+  MBWMKeys *keys = wm->keys;
+  MBWMList *batched, *iter;
+  int       result;
+
+  MBWM_ASSERT (keys != NULL && keys->batching);
+
+  XSync (wm->xdpy, False);
+  result = mb_wm_util_untrap_x_errors();
+
+  batched        = keys->batched;
+  keys->batched  = NULL;
+  keys->batching = False;
+
+  if (result != Success)
+    {
+      MBWM_DBG ("Some key grabs failed, checking bindings one by one");
+
+      mb_wm_util_trap_x_errors();
+
+      for (iter = batched; iter; iter = mb_wm_util_list_next (iter))
+	key_binding_set_grab (wm, (MBWMKeyBinding*)iter->data, True);
+
+      XSync (wm->xdpy, False);
+      mb_wm_util_untrap_x_errors();
+
+      for (iter = batched; iter; iter = mb_wm_util_list_next (iter))
+	{
+	  MBWMKeyBinding *binding = iter->data;
+
+	  mb_wm_util_trap_x_errors();
+	  key_binding_set_grab (wm, binding, False);
+	  XSync (wm->xdpy, False);
+	  result = mb_wm_util_untrap_x_errors();
+
+	  if (result == Success)
+	    continue;
+
+	  key_binding_warn_grab_failed (binding, result);
+
+	  /* Drops whichever of the grabs did succeed */
+	  mb_wm_util_trap_x_errors();
+	  mb_wm_keys_binding_remove (wm, binding);
+	  XSync (wm->xdpy, False);
+	  mb_wm_util_untrap_x_errors();
+	}
+    }
+
+  mb_wm_util_list_free (batched);
+}
+
 MBWMKeyBinding*
 mb_wm_keys_binding_add_with_spec (MBWindowManager    *wm,
 				  const char         *keystr,
@@ -261,64 +452,59 @@ mb_wm_keys_binding_add_with_spec (MBWindowManager    *wm,
 
 void 				/* FIXME: rename */
 mb_wm_keys_press (MBWindowManager *wm,
-		  KeySym           keysym,
+		  KeyCode          keycode,
 		  int              modifier_mask)
 {
   MBWMList       *iter;
   MBWMKeyBinding *binding;
+  MBWMKeys       *keys = wm->keys;
 
-  if (!wm->keys)
+  if (!keys)
     return;
 
-  MBWM_DBG ("Looking up keysym <%li>, ( mask %i )", keysym, modifier_mask);
+  /* The lock modifiers do not matter for matching */
+  modifier_mask &= MBWM_KEYS_MODIFIER_MASK & ~keys->lock_mask;
+
+  MBWM_DBG ("Looking up keycode <%i>, ( mask %i )", keycode, modifier_mask);
 
-  iter = wm->keys->bindings;
+  iter = keys->table[key_binding_hash (keys, keycode, modifier_mask)];
 
   while (iter)
     {
-      int ignored_mask = 0;
+      MBWMList *next = mb_wm_util_list_next(iter);
 
       binding = (MBWMKeyBinding*)iter->data;
 
-      MBWM_DBG ("Checking up keysym <%li>, ( mask %i )",
-	       binding->keysym,
-	       binding->modifier_mask);
-
       /* FIXME: Assumes multiple bindings per key */
-      while (ignored_mask < (int) wm->keys->lock_mask)
+      if (binding->pressed
+	  && binding->keycode == keycode
+	  && binding->modifier_mask == modifier_mask)
 	{
-	  if (ignored_mask & ~(wm->keys->lock_mask))
-	    {
-	      ++ignored_mask;
-	      continue;
-	    }
-
-	  if (binding->pressed
-	      && binding->keysym == keysym
-	      && binding->modifier_mask|ignored_mask == modifier_mask)
-	    {
-	      binding->pressed(wm, binding, binding->userdata);
-	      break;
-	    }
-
-	  ++ignored_mask;
+	  binding->pressed(wm, binding, binding->userdata);
 	}
 
-      iter = mb_wm_util_list_next(iter);
+      iter = next;
     }
 }
 
-
-Bool
-mb_wm_keys_init(MBWindowManager *wm)
+/*
+ * Works out which modifiers the Alt, Meta, etc. keys and the locks are on.
+ */
+static void
+mb_wm_keys_update_modifiers (MBWindowManager *wm)
 {
   int              mod_idx, mod_key, col, kpm;
   XModifierKeymap *mod_map;
-  MBWMKeys        *keys;
+  MBWMKeys        *keys = wm->keys;
 
   mod_map = XGetModifierMapping(wm->xdpy);
 
-  keys = wm->keys = mb_wm_util_malloc0(sizeof(MBWMKeys));
+  keys->MetaMask       = 0;
+  keys->HyperMask      = 0;
+  keys->SuperMask      = 0;
+  keys->AltMask        = 0;
+  keys->NumLockMask    = 0;
+  keys->ScrollLockMask = 0;
 
   /* Figure out modifier masks */
 
@@ -373,6 +559,58 @@ mb_wm_keys_init(MBWindowManager *wm)
   keys->lock_mask = keys->ScrollLockMask | keys->NumLockMask | LockMask;
 
   if (mod_map) XFreeModifiermap(mod_map);
+}
+
+/*
+ * Called when the keyboard or modifier mapping changes; the keycodes of the
+ * bindings are resolved again and all of them regrabbed in a single batch.
+ */
+void
+mb_wm_keys_mapping_notify (MBWindowManager *wm, XMappingEvent *xev)
+{
+  MBWMKeys *keys = wm->keys;
+  MBWMList *iter;
+  int       result;
+
+  if (!keys || xev->request == MappingPointer)
+    return;
+
+  XRefreshKeyboardMapping (xev);
+
+  mb_wm_util_trap_x_errors();
+
+  /* The old grabs go by the old keycodes and lock modifiers */
+  for (iter = keys->bindings; iter; iter = mb_wm_util_list_next (iter))
+    key_binding_set_grab (wm, (MBWMKeyBinding*)iter->data, True);
+
+  mb_wm_keys_update_modifiers (wm);
+
+  for (iter = keys->bindings; iter; iter = mb_wm_util_list_next (iter))
+    {
+      MBWMKeyBinding *binding = iter->data;
+
+      binding->keycode = XKeysymToKeycode (wm->xdpy, binding->keysym);
+      key_binding_set_grab (wm, binding, False);
+    }
+
+  XSync (wm->xdpy, False);
+  result = mb_wm_util_untrap_x_errors();
+
+  if (result != Success)
+    mb_wm_util_warn ("Unable to grab some of the key bindings after a keyboard mapping change\n");
+
+  key_binding_table_rebuild (keys);
+}
+
+Bool
+mb_wm_keys_init(MBWindowManager *wm)
+{
+  MBWMKeys *keys;
+
+  keys = wm->keys = mb_wm_util_malloc0(sizeof(MBWMKeys));
+
+  mb_wm_keys_update_modifiers (wm);
+  key_binding_table_rebuild (keys);
 
   return True;
 }
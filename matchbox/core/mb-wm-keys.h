@@ -37,6 +37,12 @@ mb_wm_keys_binding_add (MBWindowManager    *wm,
 			MBWMKeyDestroyFunc  destroy_func,
 			void               *userdata);
 
+void
+mb_wm_keys_batch_begin (MBWindowManager *wm);
+
+void
+mb_wm_keys_batch_end (MBWindowManager *wm);
+
 MBWMKeyBinding*
 mb_wm_keys_binding_add_with_spec (MBWindowManager    *wm,
 				  const char         *keystr,
@@ -46,9 +52,12 @@ mb_wm_keys_binding_add_with_spec (MBWindowManager    *wm,
 
 void
 mb_wm_keys_press (MBWindowManager *wm,
-		  KeySym           keysym,
+		  KeyCode          keycode,
 		  int              modifier_mask);
 
+void
+mb_wm_keys_mapping_notify (MBWindowManager *wm, XMappingEvent *xev);
+
 Bool
 mb_wm_keys_init (MBWindowManager *wm);
 
@@ -4,6 +4,7 @@
 #include <poll.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #if ENABLE_COMPOSITE
 #include <X11/extensions/Xdamage.h>
@@ -59,6 +60,9 @@ mb_wm_main_context_check_timeouts (MBWMMainContext *ctx);
 static Bool
 mb_wm_main_context_check_fd_watches (MBWMMainContext * ctx);
 
+static void
+mb_wm_main_context_setup_poll_cache (MBWMMainContext *ctx);
+
 static Bool
 mb_wm_main_context_spin_xevent (MBWMMainContext *ctx);
 
@@ -520,6 +524,27 @@ mb_wm_main_context_handle_x_event (XEvent          *xev,
 	  iter = next;
 	}
       break;
+    case MappingNotify:
+      /* Sent to every client; the key bindings depend on the mapping */
+      mb_wm_keys_mapping_notify (wm, &xev->xmapping);
+      break;
+#ifdef GenericEvent
+    case GenericEvent:
+      /* Extension events carry no window; all handlers get to see them */
+      iter = ctx->event_funcs.generic_event;
+
+      while (iter)
+	{
+	  MBWMList * next = iter->next;
+
+	  if (!(MBWMXEventFunc)XE_ITER_GET_FUNC(iter)
+	      (xev, XE_ITER_GET_DATA(iter)))
+	    break;
+
+	  iter = next;
+	}
+      break;
+#endif
     }
 
   return False;
@@ -541,18 +566,80 @@ mb_wm_main_context_spin_xevent (MBWMMainContext *ctx)
   return (XEventsQueued (wm->xdpy, QueuedAfterReading) != 0);
 }
 
-static Bool
-mb_wm_main_context_spin_xevent_blocking (MBWMMainContext *ctx)
+#if ! USE_GLIB_MAINLOOP
+/*
+ * Returns the time, in ms, until the earliest timeout is due, or -1 if there
+ * are no timeouts.
+ */
+static int
+mb_wm_main_context_next_timeout (MBWMMainContext *ctx)
 {
-  MBWindowManager * wm = ctx->wm;
-  XEvent xev;
+  MBWMList       * l = mb_wm_util_list_get_first (ctx->event_funcs.timeout);
+  struct timeval   current_time;
+  long             next = -1;
 
-  XNextEvent(wm->xdpy, &xev);
+  if (!l)
+    return -1;
 
-  mb_wm_main_context_handle_x_event (&xev, ctx);
+  gettimeofday (&current_time, NULL);
 
-  return (XEventsQueued (wm->xdpy, QueuedAfterReading) != 0);
+  for (; l; l = mb_wm_util_list_next (l))
+    {
+      MBWMTimeOutEventInfo * tinfo = l->data;
+      long                   ms;
+
+      ms = (tinfo->triggers.tv_sec - current_time.tv_sec) * 1000 +
+	(tinfo->triggers.tv_usec - current_time.tv_usec + 999) / 1000;
+
+      if (ms < 0)
+	ms = 0;
+
+      if (next < 0 || ms < next)
+	next = ms;
+    }
+
+  return next > INT_MAX ? INT_MAX : next;
+}
+
+/*
+ * Sleeps until there is an X event, one of the watched fds is ready or the
+ * next timeout is due, whichever comes first.
+ */
+static void
+mb_wm_main_context_wait (MBWMMainContext *ctx)
+{
+  Display       * xdpy = ctx->wm->xdpy;
+  struct pollfd * fds;
+  int             n_fds = ctx->n_poll_fds + 1;
+  int             timeout;
+
+  XFlush (xdpy);
+
+  if (XEventsQueued (xdpy, QueuedAlready))
+    return;
+
+  timeout = mb_wm_main_context_next_timeout (ctx);
+
+  if (!timeout)
+    return;
+
+  mb_wm_main_context_setup_poll_cache (ctx);
+
+  fds = alloca (n_fds * sizeof (struct pollfd));
+
+  if (ctx->n_poll_fds)
+    memcpy (fds, ctx->poll_fds, ctx->n_poll_fds * sizeof (struct pollfd));
+
+  fds[n_fds - 1].fd      = ConnectionNumber (xdpy);
+  fds[n_fds - 1].events  = POLLIN;
+  fds[n_fds - 1].revents = 0;
+
+  if (poll (fds, n_fds, timeout) < 0 && errno != EINTR)
+    {
+      MBWM_DBG ("Poll failed.");
+    }
 }
+#endif
 
 void
 mb_wm_main_context_loop (MBWMMainContext *ctx)
@@ -562,26 +649,16 @@ mb_wm_main_context_loop (MBWMMainContext *ctx)
 
   while (True)
     {
-      Bool sources;
+      mb_wm_main_context_check_timeouts (ctx);
+      mb_wm_main_context_check_fd_watches (ctx);
 
-      sources  = mb_wm_main_context_check_timeouts (ctx);
-      sources |= mb_wm_main_context_check_fd_watches (ctx);
-
-      if (!sources)
-	{
-	  /* No timeouts, idles, etc. -- wait for next
-	   * X event
-	   */
-	  mb_wm_main_context_spin_xevent_blocking (ctx);
-	}
-      else
-	{
-	  /* Process any pending xevents */
-	  while (mb_wm_main_context_spin_xevent (ctx));
-	}
+      /* Process any pending xevents */
+      while (mb_wm_main_context_spin_xevent (ctx));
 
       if (wm->sync_type)
 	mb_wm_sync (wm);
+
+      mb_wm_main_context_wait (ctx);
     }
 #endif
 }
@@ -679,6 +756,12 @@ mb_wm_main_context_x_event_handler_add (MBWMMainContext *ctx,
       ctx->event_funcs.client_message =
 	mb_wm_util_list_append (ctx->event_funcs.client_message, func_info);
       break;
+#ifdef GenericEvent
+    case GenericEvent:
+      ctx->event_funcs.generic_event =
+	mb_wm_util_list_append (ctx->event_funcs.generic_event, func_info);
+      break;
+#endif
 
     default:
       break;
@@ -744,6 +827,11 @@ mb_wm_main_context_x_event_handler_remove (MBWMMainContext *ctx,
     case ClientMessage:
       l_start = &ctx->event_funcs.client_message;
       break;
+#ifdef GenericEvent
+    case GenericEvent:
+      l_start = &ctx->event_funcs.generic_event;
+      break;
+#endif
 
     default:
       break;
@@ -932,7 +1020,8 @@ mb_wm_main_context_fd_watch_add (MBWMMainContext           *ctx,
     mb_wm_util_list_append (ctx->event_funcs.fd_watch, finfo);
 
   ctx->n_poll_fds++;
-  ctx->poll_fds = realloc (ctx->poll_fds, sizeof (struct pollfd));
+  ctx->poll_fds = realloc (ctx->poll_fds,
+			   sizeof (struct pollfd) * ctx->n_poll_fds);
 
   fds = ctx->poll_fds + (ctx->n_poll_fds - 1);
   fds->fd = *channel;
@@ -972,14 +1061,14 @@ mb_wm_main_context_fd_watch_remove (MBWMMainContext *ctx,
 	  free (info);
 	  free (l);
 
+	  ctx->n_poll_fds--;
+	  ctx->poll_cache_dirty = True;
+
 	  return;
 	}
 
       l = l->next;
     }
-
-  ctx->n_poll_fds--;
-  ctx->poll_cache_dirty = True;
 #else
   g_source_remove (id);
 #endif
@@ -1029,7 +1118,8 @@ mb_wm_main_context_setup_poll_cache (MBWMMainContext *ctx)
   if (!ctx->poll_cache_dirty)
     return;
 
-  ctx->poll_fds = realloc (ctx->poll_fds, ctx->n_poll_fds);
+  ctx->poll_fds = realloc (ctx->poll_fds,
+			   sizeof (struct pollfd) * ctx->n_poll_fds);
 
   while (l)
     {
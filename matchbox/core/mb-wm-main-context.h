@@ -47,6 +47,10 @@ typedef struct MBWMEventFuncs
   MBWMList *motion_notify;
   MBWMList *client_message;
 
+#ifdef GenericEvent
+  MBWMList *generic_event;
+#endif
+
 #if ENABLE_COMPOSITE
   MBWMList *damage_notify;
 #endif
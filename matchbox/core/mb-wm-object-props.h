@@ -86,6 +86,7 @@ typedef enum MBWMObjectProp
     MBWMObjectPropThemeShadowType         = _MKOPROP(23, int),
     MBWMObjectPropThemeCompositing        = _MKOPROP(24, int),
     MBWMObjectPropThemeShaped             = _MKOPROP(25, int),
+    MBWMObjectPropThemeCache              = _MKOPROP(32, void*),
 
     MBWMObjectPropCompMgrEffectType       = _MKOPROP(26, int),
     MBWMObjectPropCompMgrEffectDuration   = _MKOPROP(27, unsigned long),
@@ -92,6 +92,7 @@ typedef struct MBWMClientWindowClass       MBWMClientWindowClass;
 typedef struct MBWMTheme                   MBWMTheme;
 typedef struct MBWMThemeClass              MBWMThemeClass;
 typedef struct MBWMThemePng                MBWMThemePng;
+typedef struct MBWMThemeLoader             MBWMThemeLoader;
 typedef struct MBWMThemePngClass           MBWMThemePngClass;
 typedef enum   MBWMThemeCaps               MBWMThemeCaps;
 typedef struct MBWMDecor                   MBWMDecor;
@@ -291,6 +292,7 @@ typedef void (*MBWMKeyDestroyFunc) (MBWindowManager   *wm,
 struct MBWMKeyBinding
 {
   KeySym                   keysym;
+  KeyCode                  keycode; /* keysym resolved on the current map */
   int                      modifier_mask;
   MBWMKeyPressedFunc       pressed;
   MBWMKeyDestroyFunc       destroy;
@@ -403,6 +405,7 @@ typedef enum MBWMSyncType
   MBWMSyncDecor             = (1<<4),
   MBWMSyncConfigRequestAck  = (1<<5),
   MBWMSyncFullscreen        = (1<<6),
+  MBWMSyncBatch             = (1<<7), /* one XSync for all the clients */
 } MBWMSyncType;
 
 typedef struct MBWMColor
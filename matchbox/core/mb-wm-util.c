@@ -1,33 +1,75 @@
 #include "mb-wm.h"
 #include <stdarg.h>
 
+/*
+ * Traps only catch errors on the display of the window manager; errors on
+ * any other connection, such as the one of the compositor render thread,
+ * go to the handler installed before the outermost trap. Traps nest, each
+ * untrap returning the first error since the matching trap.
+ */
+#define MAX_TRAP_DEPTH 8
+
+static Display *TrappedDisplay = NULL;
 static int TrappedErrorCode = 0;
+static int TrapDepth = 0;
+static int OuterErrorCodes[MAX_TRAP_DEPTH];
 static int (*old_error_handler) (Display *, XErrorEvent *);
 
 static int
 error_handler(Display     *xdpy,
 	      XErrorEvent *error)
 {
-  TrappedErrorCode = error->error_code;
+  if (TrappedDisplay && xdpy != TrappedDisplay)
+    {
+      if (old_error_handler)
+	return old_error_handler (xdpy, error);
+
+      return 0;
+    }
+
+  if (!TrappedErrorCode)
+    TrappedErrorCode = error->error_code;
+
   return 0;
 }
 
+void
+mb_wm_util_set_x_error_display (Display *xdpy)
+{
+  TrappedDisplay = xdpy;
+}
+
 void
 mb_wm_util_trap_x_errors(void)
 {
   /* MBWM_DBG("### X Errors Trapped ###"); */
 
-  TrappedErrorCode  = 0;
-  old_error_handler = XSetErrorHandler(error_handler);
+  if (TrapDepth < MAX_TRAP_DEPTH)
+    OuterErrorCodes[TrapDepth] = TrappedErrorCode;
+
+  TrappedErrorCode = 0;
+
+  if (!TrapDepth++)
+    old_error_handler = XSetErrorHandler(error_handler);
 }
 
 int
 mb_wm_util_untrap_x_errors(void)
 {
+  int code = TrappedErrorCode;
+
   /* MBWM_DBG("### X Errors Untrapped (%i) ###", TrappedErrorCode); */
 
-  XSetErrorHandler(old_error_handler);
-  return TrappedErrorCode;
+  MBWM_ASSERT (TrapDepth > 0);
+
+  if (!--TrapDepth)
+    XSetErrorHandler(old_error_handler);
+
+  /* The enclosing trap sees the errors too */
+  if (TrapDepth < MAX_TRAP_DEPTH && OuterErrorCodes[TrapDepth])
+    TrappedErrorCode = OuterErrorCodes[TrapDepth];
+
+  return code;
 }
 
 
@@ -62,6 +62,9 @@ mb_geometry_intersects (MBGeometry *g1, MBGeometry *g2);
 
 /* XErrors */
 
+void
+mb_wm_util_set_x_error_display (Display *xdpy);
+
 void
 mb_wm_util_trap_x_errors(void);
 
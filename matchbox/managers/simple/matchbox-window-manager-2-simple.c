@@ -129,6 +129,8 @@ main(int argc, char **argv)
   if (wm == NULL)
     mb_wm_util_fatal_error("OOM?");
 
+  mb_wm_keys_batch_begin (wm);
+
   mb_wm_keys_binding_add_with_spec (wm,
 				    "<alt>d",
 				    key_binding_func,
@@ -147,6 +149,8 @@ main(int argc, char **argv)
 				    NULL,
 				    (void*)KEY_ACTION_PAGE_PREV);
 
+  mb_wm_keys_batch_end (wm);
+
   mb_wm_main_loop(wm);
 
   mb_wm_object_unref (MB_WM_OBJECT (wm));
@@ -0,0 +1,826 @@
+/*
+ *  Matchbox Window Manager 2 - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "mb-wm-theme-cache.h"
+#include "mb-wm-theme-xml.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define CACHE_MAGIC      "MBWMTHC"
+#define CACHE_VERSION    1
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_DIR        ".cache"
+#define CACHE_FILE       "theme.cache"
+
+/* X pixmaps cannot be any larger in either dimension */
+#define CACHE_IMG_MAX    32767
+
+/*
+ * On-disk layout; all offsets are relative to the start of the file, all
+ * values are in host byte order (a cache written on a different
+ * architecture is simply rejected). Strings are stored as offsets into a
+ * string table, whose first byte is always 0, so that offset 0 means 'no
+ * string'.
+ */
+struct cache_color
+{
+  double  r, g, b, a;
+  int32_t set;
+  int32_t pad;
+};
+
+struct cache_header
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint32_t file_size;
+
+  int64_t  xml_mtime;
+  int64_t  xml_size;
+  int64_t  img_mtime;
+  int64_t  img_size;
+
+  int32_t  theme_version;
+  int32_t  shadow_type;
+  int32_t  compositing;
+  int32_t  shaped;
+
+  struct cache_color color_lowlight;
+  struct cache_color color_shadow;
+
+  uint32_t n_clients;
+  uint32_t clients_offset;
+  uint32_t n_decors;
+  uint32_t decors_offset;
+  uint32_t n_buttons;
+  uint32_t buttons_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+
+  uint32_t engine;
+  uint32_t img;
+  uint32_t img_width;
+  uint32_t img_height;
+  uint32_t pixels_offset;
+  uint32_t pad;
+};
+
+struct cache_client
+{
+  int32_t  type;
+  int32_t  x, y, width, height;
+  int32_t  shaped;
+  int32_t  layout_hints;
+  uint32_t first_decor;
+  uint32_t n_decors;
+};
+
+struct cache_decor
+{
+  int32_t  type;
+  struct cache_color clr_fg;
+  struct cache_color clr_bg;
+  int32_t  x, y, width, height;
+  int32_t  pad_offset, pad_length;
+  int32_t  show_title;
+  int32_t  font_size;
+  int32_t  font_units;
+  uint32_t font_family;
+  uint32_t first_button;
+  uint32_t n_buttons;
+};
+
+struct cache_button
+{
+  int32_t  type;
+  int32_t  packing;
+  struct cache_color clr_fg;
+  struct cache_color clr_bg;
+  int32_t  x, y, width, height;
+  int32_t  active_x, active_y;
+  int32_t  inactive_x, inactive_y;
+  int32_t  press_activated;
+};
+
+/*
+ * Growable buffer used to assemble the cache file before writing it out
+ */
+struct cache_buf
+{
+  char   *data;
+  size_t  len;
+  size_t  alloc;
+  Bool    failed;
+};
+
+static Bool
+cache_buf_reserve (struct cache_buf *buf, size_t len)
+{
+  if (buf->len + len > buf->alloc)
+    {
+      size_t  alloc = buf->alloc ? buf->alloc : 4096;
+      char   *data;
+
+      while (alloc < buf->len + len)
+	alloc *= 2;
+
+      if (!(data = realloc (buf->data, alloc)))
+	{
+	  buf->failed = True;
+	  return False;
+	}
+
+      buf->data  = data;
+      buf->alloc = alloc;
+    }
+
+  return True;
+}
+
+static uint32_t
+cache_buf_append (struct cache_buf *buf, const void *data, size_t len)
+{
+  uint32_t offset = buf->len;
+
+  if (!cache_buf_reserve (buf, len))
+    return 0;
+
+  if (data)
+    memcpy (buf->data + buf->len, data, len);
+  else
+    memset (buf->data + buf->len, 0, len);
+
+  buf->len += len;
+
+  return offset;
+}
+
+static void
+cache_buf_align (struct cache_buf *buf, size_t align)
+{
+  size_t pad = (align - (buf->len % align)) % align;
+
+  if (pad)
+    cache_buf_append (buf, NULL, pad);
+}
+
+static void
+color_to_cache (struct cache_color *cc, const MBWMColor *clr)
+{
+  cc->r   = clr->r;
+  cc->g   = clr->g;
+  cc->b   = clr->b;
+  cc->a   = clr->a;
+  cc->set = clr->set;
+  cc->pad = 0;
+}
+
+static void
+color_from_cache (MBWMColor *clr, const struct cache_color *cc)
+{
+  clr->r   = cc->r;
+  clr->g   = cc->g;
+  clr->b   = cc->b;
+  clr->a   = cc->a;
+  clr->set = cc->set;
+}
+
+/*
+ * Returns the n-th candidate location of the cache file for the given
+ * theme.xml, or NULL when there are no more candidates; the caller frees.
+ *
+ * The first location is in the theme directory itself, the second one
+ * in the user cache directory, for themes installed read-only.
+ */
+static char *
+cache_path (const char *xml_path, int n, Bool create_dir)
+{
+  char       *dir;
+  char       *path;
+  const char *s;
+
+  if (n == 0)
+    {
+      if (!(s = strrchr (xml_path, '/')))
+	return NULL;
+
+      dir = malloc (s - xml_path + strlen (CACHE_DIR) + 2);
+      memcpy (dir, xml_path, s - xml_path + 1);
+      strcpy (dir + (s - xml_path + 1), CACHE_DIR);
+    }
+  else if (n == 1)
+    {
+      const char *cache_home = getenv ("XDG_CACHE_HOME");
+      const char *home = getenv ("HOME");
+      char       *base;
+      char       *p;
+      int         size;
+
+      if (cache_home && *cache_home)
+	{
+	  size = strlen (cache_home) + strlen ("/matchbox2") + 1;
+	  base = alloca (size);
+	  snprintf (base, size, "%s/matchbox2", cache_home);
+	}
+      else if (home)
+	{
+	  size = strlen (home) + strlen ("/.cache/matchbox2") + 1;
+	  base = alloca (size);
+	  snprintf (base, size, "%s/.cache/matchbox2", home);
+	}
+      else
+	return NULL;
+
+      if (create_dir)
+	{
+	  /* Make sure the parent exists, too */
+	  p = strrchr (base, '/');
+	  *p = 0;
+	  mkdir (base, 0700);
+	  *p = '/';
+	  mkdir (base, 0700);
+	}
+
+      /*
+       * Flatten the theme path into a directory name, so each theme gets
+       * its own directory and the cache file name is the same for both
+       * locations.
+       */
+      size = strlen (base) + strlen (xml_path) + 2;
+      dir = malloc (size);
+      snprintf (dir, size, "%s/%s", base, xml_path);
+
+      for (p = dir + strlen (base) + 1; *p; ++p)
+	if (*p == '/')
+	  *p = '_';
+    }
+  else
+    return NULL;
+
+  if (create_dir && mkdir (dir, 0755) && errno != EEXIST)
+    {
+      free (dir);
+      return NULL;
+    }
+
+  path = malloc (strlen (dir) + strlen (CACHE_FILE) + 2);
+  sprintf (path, "%s/%s", dir, CACHE_FILE);
+  free (dir);
+
+  return path;
+}
+
+MBWMThemeCache *
+mb_wm_theme_cache_new (const char *xml_path)
+{
+  MBWMThemeCache *cache = mb_wm_util_malloc0 (sizeof (MBWMThemeCache));
+
+  cache->xml_path = strdup (xml_path);
+
+  return cache;
+}
+
+void
+mb_wm_theme_cache_free (MBWMThemeCache *cache)
+{
+  if (!cache)
+    return;
+
+  /*
+   * NB: the xml_clients list is never owned by the cache; on load it is
+   * handed over to the theme.
+   */
+  if (cache->map)
+    munmap (cache->map, cache->map_size);
+
+  free (cache->pixels_buf);
+  free (cache->engine);
+  free (cache->img);
+  free (cache->xml_path);
+  free (cache);
+}
+
+static const char *
+cache_string (const struct cache_header *hdr, uint32_t offset)
+{
+  if (!offset)
+    return NULL;
+
+  return (const char *) hdr + hdr->strings_offset + offset;
+}
+
+static Bool
+cache_range_ok (const struct cache_header *hdr, size_t size,
+		uint32_t offset, uint64_t n, size_t item)
+{
+  return offset <= size && (size - offset) / item >= n;
+}
+
+static Bool
+cache_validate (const struct cache_header *hdr, size_t size)
+{
+  const char *strings;
+  uint32_t    i;
+
+  if (size < sizeof (struct cache_header)                ||
+      memcmp (hdr->magic, CACHE_MAGIC, sizeof (CACHE_MAGIC)) ||
+      hdr->version     != CACHE_VERSION                  ||
+      hdr->byte_order  != CACHE_BYTE_ORDER               ||
+      hdr->header_size != sizeof (struct cache_header)   ||
+      hdr->file_size   != size)
+    return False;
+
+  if (!cache_range_ok (hdr, size, hdr->clients_offset, hdr->n_clients,
+		       sizeof (struct cache_client)) ||
+      !cache_range_ok (hdr, size, hdr->decors_offset, hdr->n_decors,
+		       sizeof (struct cache_decor)) ||
+      !cache_range_ok (hdr, size, hdr->buttons_offset, hdr->n_buttons,
+		       sizeof (struct cache_button)) ||
+      !cache_range_ok (hdr, size, hdr->strings_offset, hdr->strings_size, 1) ||
+      hdr->img_width > CACHE_IMG_MAX || hdr->img_height > CACHE_IMG_MAX ||
+      !cache_range_ok (hdr, size, hdr->pixels_offset,
+		       (uint64_t) hdr->img_width * hdr->img_height,
+		       sizeof (uint32_t)))
+    return False;
+
+  strings = (const char *) hdr + hdr->strings_offset;
+
+  if (!hdr->strings_size || strings[0] || strings[hdr->strings_size - 1] ||
+      hdr->engine >= hdr->strings_size || hdr->img >= hdr->strings_size)
+    return False;
+
+  for (i = 0; i < hdr->n_clients; ++i)
+    {
+      const struct cache_client *c = (const struct cache_client *)
+	((const char *) hdr + hdr->clients_offset) + i;
+
+      if (c->first_decor > hdr->n_decors ||
+	  hdr->n_decors - c->first_decor < c->n_decors)
+	return False;
+    }
+
+  for (i = 0; i < hdr->n_decors; ++i)
+    {
+      const struct cache_decor *d = (const struct cache_decor *)
+	((const char *) hdr + hdr->decors_offset) + i;
+
+      if (d->first_button > hdr->n_buttons ||
+	  hdr->n_buttons - d->first_button < d->n_buttons ||
+	  d->font_family >= hdr->strings_size)
+	return False;
+    }
+
+  return True;
+}
+
+static MBWMList *
+cache_build_xml_clients (const struct cache_header *hdr)
+{
+  const struct cache_client *clients;
+  const struct cache_decor  *decors;
+  const struct cache_button *buttons;
+  MBWMList                  *xml_clients = NULL;
+  uint32_t                   i, j, k;
+
+  clients = (const struct cache_client *)
+    ((const char *) hdr + hdr->clients_offset);
+  decors  = (const struct cache_decor *)
+    ((const char *) hdr + hdr->decors_offset);
+  buttons = (const struct cache_button *)
+    ((const char *) hdr + hdr->buttons_offset);
+
+  for (i = 0; i < hdr->n_clients; ++i)
+    {
+      const struct cache_client *cc = &clients[i];
+      MBWMXmlClient             *c  = mb_wm_xml_client_new ();
+
+      c->type         = cc->type;
+      c->x            = cc->x;
+      c->y            = cc->y;
+      c->width        = cc->width;
+      c->height       = cc->height;
+      c->shaped       = cc->shaped;
+      c->layout_hints = cc->layout_hints;
+
+      for (j = 0; j < cc->n_decors; ++j)
+	{
+	  const struct cache_decor *cd = &decors[cc->first_decor + j];
+	  MBWMXmlDecor             *d  = mb_wm_xml_decor_new ();
+	  const char               *family;
+
+	  d->type       = cd->type;
+	  d->x          = cd->x;
+	  d->y          = cd->y;
+	  d->width      = cd->width;
+	  d->height     = cd->height;
+	  d->pad_offset = cd->pad_offset;
+	  d->pad_length = cd->pad_length;
+	  d->show_title = cd->show_title;
+	  d->font_size  = cd->font_size;
+	  d->font_units = cd->font_units;
+
+	  color_from_cache (&d->clr_fg, &cd->clr_fg);
+	  color_from_cache (&d->clr_bg, &cd->clr_bg);
+
+	  if ((family = cache_string (hdr, cd->font_family)))
+	    d->font_family = strdup (family);
+
+	  for (k = 0; k < cd->n_buttons; ++k)
+	    {
+	      const struct cache_button *cb = &buttons[cd->first_button + k];
+	      MBWMXmlButton             *b  = mb_wm_xml_button_new ();
+
+	      b->type            = cb->type;
+	      b->packing         = cb->packing;
+	      b->x               = cb->x;
+	      b->y               = cb->y;
+	      b->width           = cb->width;
+	      b->height          = cb->height;
+	      b->active_x        = cb->active_x;
+	      b->active_y        = cb->active_y;
+	      b->inactive_x      = cb->inactive_x;
+	      b->inactive_y      = cb->inactive_y;
+	      b->press_activated = cb->press_activated;
+
+	      color_from_cache (&b->clr_fg, &cb->clr_fg);
+	      color_from_cache (&b->clr_bg, &cb->clr_bg);
+
+	      d->buttons = mb_wm_util_list_append (d->buttons, b);
+	    }
+
+	  c->decors = mb_wm_util_list_append (c->decors, d);
+	}
+
+      xml_clients = mb_wm_util_list_append (xml_clients, c);
+    }
+
+  return xml_clients;
+}
+
+static MBWMThemeCache *
+cache_load_file (const char *xml_path, const char *path,
+		 const struct stat *xml_st)
+{
+  MBWMThemeCache            *cache;
+  const struct cache_header *hdr;
+  const char                *img;
+  struct stat                st;
+  void                      *map;
+  int                        fd;
+
+  if ((fd = open (path, O_RDONLY)) < 0)
+    return NULL;
+
+  if (fstat (fd, &st) || st.st_size < sizeof (struct cache_header))
+    {
+      close (fd);
+      return NULL;
+    }
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return NULL;
+
+  hdr = map;
+
+  if (!cache_validate (hdr, st.st_size)         ||
+      hdr->xml_mtime != (int64_t) xml_st->st_mtime ||
+      hdr->xml_size  != (int64_t) xml_st->st_size)
+    {
+      munmap (map, st.st_size);
+      return NULL;
+    }
+
+  if ((img = cache_string (hdr, hdr->img)))
+    {
+      struct stat img_st;
+
+      if (stat (img, &img_st)                         ||
+	  hdr->img_mtime != (int64_t) img_st.st_mtime ||
+	  hdr->img_size  != (int64_t) img_st.st_size)
+	{
+	  munmap (map, st.st_size);
+	  return NULL;
+	}
+    }
+
+  cache = mb_wm_theme_cache_new (xml_path);
+
+  cache->map      = map;
+  cache->map_size = st.st_size;
+  cache->saved    = True;
+
+  cache->version     = hdr->theme_version;
+  cache->shadow_type = hdr->shadow_type;
+  cache->compositing = hdr->compositing;
+  cache->shaped      = hdr->shaped;
+
+  color_from_cache (&cache->color_lowlight, &hdr->color_lowlight);
+  color_from_cache (&cache->color_shadow, &hdr->color_shadow);
+
+  if (hdr->engine)
+    cache->engine = strdup (cache_string (hdr, hdr->engine));
+
+  if (img)
+    cache->img = strdup (img);
+
+  if (hdr->img_width && hdr->img_height)
+    {
+      cache->pixels     = (const uint32_t *)
+	((const char *) map + hdr->pixels_offset);
+      cache->img_width  = hdr->img_width;
+      cache->img_height = hdr->img_height;
+    }
+
+  cache->xml_clients = cache_build_xml_clients (hdr);
+
+  return cache;
+}
+
+/*
+ * Loads the compiled cache for the given theme.xml; returns NULL if there
+ * is no cache, or the cache is stale.
+ */
+MBWMThemeCache *
+mb_wm_theme_cache_load (const char *xml_path)
+{
+  MBWMThemeCache *cache = NULL;
+  struct stat     xml_st;
+  char           *path;
+  int             i;
+
+  if (!xml_path || stat (xml_path, &xml_st))
+    return NULL;
+
+  for (i = 0; !cache && (path = cache_path (xml_path, i, False)); ++i)
+    {
+      cache = cache_load_file (xml_path, path, &xml_st);
+      free (path);
+    }
+
+  MBWM_NOTE (MISC, "theme cache for %s: %s", xml_path,
+	     cache ? "hit" : "miss");
+
+  return cache;
+}
+
+static uint32_t
+cache_add_string (struct cache_buf *strings, const char *s)
+{
+  if (!s)
+    return 0;
+
+  return cache_buf_append (strings, s, strlen (s) + 1);
+}
+
+static Bool
+cache_write_file (const char *path, const struct cache_buf *buf)
+{
+  char   *tmp = malloc (strlen (path) + 8);
+  size_t  done = 0;
+  int     fd;
+
+  sprintf (tmp, "%s.XXXXXX", path);
+
+  if ((fd = mkstemp (tmp)) < 0)
+    {
+      free (tmp);
+      return False;
+    }
+
+  while (done < buf->len)
+    {
+      ssize_t n = write (fd, buf->data + done, buf->len - done);
+
+      if (n < 0 && errno == EINTR)
+	continue;
+
+      if (n <= 0)
+	break;
+
+      done += n;
+    }
+
+  fchmod (fd, 0644);
+
+  /*
+   * Write to a temporary file and rename, so that a concurrently starting
+   * wm never sees a partially written cache.
+   */
+  if (close (fd) || done != buf->len || rename (tmp, path))
+    {
+      unlink (tmp);
+      free (tmp);
+      return False;
+    }
+
+  free (tmp);
+  return True;
+}
+
+/*
+ * Writes out the cache, using the description stored in it, and the
+ * optional theme image (premultiplied native ARGB32, stride in bytes).
+ */
+Bool
+mb_wm_theme_cache_save (MBWMThemeCache *cache,
+			const uint32_t *pixels,
+			int             width,
+			int             height,
+			int             stride)
+{
+  struct cache_header  hdr;
+  struct cache_buf     buf     = { NULL, 0, 0, False };
+  struct cache_buf     strings = { NULL, 0, 0, False };
+  struct cache_buf     clients = { NULL, 0, 0, False };
+  struct cache_buf     decors  = { NULL, 0, 0, False };
+  struct cache_buf     buttons = { NULL, 0, 0, False };
+  struct stat          st;
+  MBWMList            *lc, *ld, *lb;
+  char                *path;
+  Bool                 ret = False;
+  int                  i, y;
+
+  if (!cache || cache->saved || stat (cache->xml_path, &st))
+    return False;
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, CACHE_MAGIC, sizeof (CACHE_MAGIC));
+  hdr.version     = CACHE_VERSION;
+  hdr.byte_order  = CACHE_BYTE_ORDER;
+  hdr.header_size = sizeof (struct cache_header);
+  hdr.xml_mtime   = st.st_mtime;
+  hdr.xml_size    = st.st_size;
+
+  if (cache->img)
+    {
+      if (stat (cache->img, &st))
+	return False;
+
+      hdr.img_mtime = st.st_mtime;
+      hdr.img_size  = st.st_size;
+    }
+
+  hdr.theme_version = cache->version;
+  hdr.shadow_type   = cache->shadow_type;
+  hdr.compositing   = cache->compositing;
+  hdr.shaped        = cache->shaped;
+
+  color_to_cache (&hdr.color_lowlight, &cache->color_lowlight);
+  color_to_cache (&hdr.color_shadow, &cache->color_shadow);
+
+  /* String offset 0 is reserved for NULL */
+  cache_buf_append (&strings, NULL, 1);
+
+  hdr.engine = cache_add_string (&strings, cache->engine);
+  hdr.img    = cache_add_string (&strings, cache->img);
+
+  for (lc = cache->xml_clients; lc; lc = lc->next)
+    {
+      MBWMXmlClient       *c = lc->data;
+      struct cache_client  cc;
+
+      memset (&cc, 0, sizeof (cc));
+      cc.type         = c->type;
+      cc.x            = c->x;
+      cc.y            = c->y;
+      cc.width        = c->width;
+      cc.height       = c->height;
+      cc.shaped       = c->shaped;
+      cc.layout_hints = c->layout_hints;
+      cc.first_decor  = hdr.n_decors;
+
+      for (ld = c->decors; ld; ld = ld->next)
+	{
+	  MBWMXmlDecor       *d = ld->data;
+	  struct cache_decor  cd;
+
+	  memset (&cd, 0, sizeof (cd));
+	  cd.type         = d->type;
+	  cd.x            = d->x;
+	  cd.y            = d->y;
+	  cd.width        = d->width;
+	  cd.height       = d->height;
+	  cd.pad_offset   = d->pad_offset;
+	  cd.pad_length   = d->pad_length;
+	  cd.show_title   = d->show_title;
+	  cd.font_size    = d->font_size;
+	  cd.font_units   = d->font_units;
+	  cd.font_family  = cache_add_string (&strings, d->font_family);
+	  cd.first_button = hdr.n_buttons;
+
+	  color_to_cache (&cd.clr_fg, &d->clr_fg);
+	  color_to_cache (&cd.clr_bg, &d->clr_bg);
+
+	  for (lb = d->buttons; lb; lb = lb->next)
+	    {
+	      MBWMXmlButton       *b = lb->data;
+	      struct cache_button  cb;
+
+	      memset (&cb, 0, sizeof (cb));
+	      cb.type            = b->type;
+	      cb.packing         = b->packing;
+	      cb.x               = b->x;
+	      cb.y               = b->y;
+	      cb.width           = b->width;
+	      cb.height          = b->height;
+	      cb.active_x        = b->active_x;
+	      cb.active_y        = b->active_y;
+	      cb.inactive_x      = b->inactive_x;
+	      cb.inactive_y      = b->inactive_y;
+	      cb.press_activated = b->press_activated;
+
+	      color_to_cache (&cb.clr_fg, &b->clr_fg);
+	      color_to_cache (&cb.clr_bg, &b->clr_bg);
+
+	      cache_buf_append (&buttons, &cb, sizeof (cb));
+	      cd.n_buttons++;
+	      hdr.n_buttons++;
+	    }
+
+	  cache_buf_append (&decors, &cd, sizeof (cd));
+	  cc.n_decors++;
+	  hdr.n_decors++;
+	}
+
+      cache_buf_append (&clients, &cc, sizeof (cc));
+      hdr.n_clients++;
+    }
+
+  /* Assemble the file */
+  cache_buf_append (&buf, NULL, sizeof (hdr));
+
+  cache_buf_align (&buf, 8);
+  hdr.clients_offset = cache_buf_append (&buf, clients.data, clients.len);
+  cache_buf_align (&buf, 8);
+  hdr.decors_offset  = cache_buf_append (&buf, decors.data, decors.len);
+  cache_buf_align (&buf, 8);
+  hdr.buttons_offset = cache_buf_append (&buf, buttons.data, buttons.len);
+  hdr.strings_offset = cache_buf_append (&buf, strings.data, strings.len);
+  hdr.strings_size   = strings.len;
+
+  /* Keep pixel rows aligned for the upload code */
+  cache_buf_align (&buf, 16);
+  hdr.pixels_offset  = buf.len;
+
+  if (pixels && width > 0 && height > 0)
+    {
+      hdr.img_width  = width;
+      hdr.img_height = height;
+
+      for (y = 0; y < height; ++y)
+	cache_buf_append (&buf, (const char *) pixels + y * stride,
+			  width * sizeof (uint32_t));
+    }
+
+  hdr.file_size = buf.len;
+
+  if (!buf.failed && !strings.failed && !clients.failed &&
+      !decors.failed && !buttons.failed)
+    {
+      memcpy (buf.data, &hdr, sizeof (hdr));
+
+      for (i = 0; !ret && (path = cache_path (cache->xml_path, i, True)); ++i)
+	{
+	  ret = cache_write_file (path, &buf);
+	  free (path);
+	}
+    }
+
+  MBWM_NOTE (MISC, "theme cache for %s %s", cache->xml_path,
+	     ret ? "written" : "not written");
+
+  cache->saved = ret;
+
+  free (buf.data);
+  free (strings.data);
+  free (clients.data);
+  free (decors.data);
+  free (buttons.data);
+
+  return ret;
+}
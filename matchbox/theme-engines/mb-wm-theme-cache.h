@@ -0,0 +1,80 @@
+/*
+ *  Matchbox Window Manager 2 - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_MB_WM_THEME_CACHE_H
+#define _HAVE_MB_WM_THEME_CACHE_H
+
+#include <stdint.h>
+#include <matchbox/core/mb-wm.h>
+
+/*
+ * Compiled theme cache
+ *
+ * The cache holds the parsed theme.xml description together with the
+ * theme image, already premultiplied and packed as native-order ARGB32, so
+ * that a theme whose cache is current can be loaded without running the
+ * XML parser or the PNG decoder. Cache files are written next to the theme
+ * (or into the user's cache directory if the theme directory is read-only)
+ * and validated against the mtime and size of both theme.xml and the image.
+ */
+typedef struct MBWMThemeCache
+{
+  /* Theme description */
+  int                    version;
+  char                  *engine;
+  char                  *img;
+  MBWMList              *xml_clients;
+  MBWMColor              color_lowlight;
+  MBWMColor              color_shadow;
+  MBWMCompMgrShadowType  shadow_type;
+  Bool                   compositing;
+  Bool                   shaped;
+
+  /*
+   * Theme image; set for a cache loaded from disk, or once the image has
+   * been decoded ahead of the theme construction.
+   */
+  const uint32_t        *pixels;
+  int                    img_width;
+  int                    img_height;
+
+  /* Private */
+  char                  *xml_path;
+  void                  *map;
+  size_t                 map_size;
+  uint32_t              *pixels_buf;
+  Bool                   saved;
+} MBWMThemeCache;
+
+MBWMThemeCache *
+mb_wm_theme_cache_new (const char *xml_path);
+
+MBWMThemeCache *
+mb_wm_theme_cache_load (const char *xml_path);
+
+Bool
+mb_wm_theme_cache_save (MBWMThemeCache *cache,
+			const uint32_t *pixels,
+			int             width,
+			int             height,
+			int             stride);
+
+void
+mb_wm_theme_cache_free (MBWMThemeCache *cache);
+
+#endif
@@ -3,15 +3,35 @@
 
 #include "mb-wm-theme-png.h"
 #include "mb-wm-theme-xml.h"
+#include "mb-wm-theme-cache.h"
 
 #include <X11/Xft/Xft.h>
 
+#include <stdint.h>
+
 #ifdef HAVE_XEXT
 #include <X11/extensions/shape.h>
+#if defined (HAVE_SYS_SHM_H) && defined (HAVE_SYS_IPC_H)
+#define MBWM_THEME_PNG_USE_SHM 1
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+#endif
+
+#if defined (__SSE2__)
+#define MBWM_THEME_PNG_SSE2 1
+#include <emmintrin.h>
+#elif (defined (__ARM_NEON__) || defined (__ARM_NEON)) && \
+      !defined (__ARMEB__) && !defined (__AARCH64EB__)
+#define MBWM_THEME_PNG_NEON 1
+#include <arm_neon.h>
 #endif
 
 static int
-mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img);
+mb_wm_theme_png_ximg (MBWMThemePng   * theme,
+		      const char     * img,
+		      MBWMThemeCache * cache);
 
 static unsigned char*
 mb_wm_theme_png_load_file (const char *file, int *width, int *height);
@@ -60,12 +80,142 @@ mb_wm_theme_png_class_init (MBWMObjectClass *klass)
 #endif
 }
 
+/*
+ * Renders the inactive and pressed images of every button in the theme
+ * into a per-button sprite once, so that painting a button in either
+ * state is a single composite into the decor.
+ */
+static void
+mb_wm_theme_png_build_sprites (MBWMThemePng *p_theme)
+{
+  MBWMTheme         * theme   = MB_WM_THEME (p_theme);
+  Display           * xdpy    = theme->wm->xdpy;
+  int                 xscreen = theme->wm->xscreen;
+  XRenderPictFormat * format;
+  MBWMList          * l;
+
+  format = XRenderFindVisualFormat (xdpy, DefaultVisual (xdpy, xscreen));
+
+  for (l = theme->xml_clients; l; l = l->next)
+    {
+      MBWMXmlClient * c = l->data;
+      MBWMList      * l2;
+
+      for (l2 = c->decors; l2; l2 = l2->next)
+	{
+	  MBWMXmlDecor * d = l2->data;
+	  MBWMList     * l3;
+
+	  for (l3 = d->buttons; l3; l3 = l3->next)
+	    {
+	      MBWMXmlButton * b = l3->data;
+	      Pixmap          xpix;
+	      Picture         pic;
+	      int             w = b->width, h = b->height;
+
+	      int a_x = b->active_x > -1 ? b->active_x : b->x;
+	      int a_y = b->active_y > -1 ? b->active_y : b->y;
+
+	      int i_x = b->inactive_x > -1 ? b->inactive_x : b->x;
+	      int i_y = b->inactive_y > -1 ? b->inactive_y : b->y;
+
+	      if (w <= 0 || h <= 0)
+		continue;
+
+	      xpix = XCreatePixmap (xdpy, RootWindow (xdpy, xscreen),
+				    w * 2, h, DefaultDepth (xdpy, xscreen));
+
+	      pic = XRenderCreatePicture (xdpy, xpix, format, 0, NULL);
+
+	      /* The picture keeps the pixmap alive */
+	      XFreePixmap (xdpy, xpix);
+
+	      /*
+	       * If the background color is set for the parent decor, we do a
+	       * fill with the parent color first, then composite the decor
+	       * image over, and finally composite the button image. (This way
+	       * we can paint the button with a simple PictOpSrc, rather than
+	       * having to do composting on each draw).
+	       */
+	      if (d->clr_bg.set)
+		{
+		  XRenderColor rclr;
+
+		  rclr.red   = (int)(d->clr_bg.r * (double)0xffff);
+		  rclr.green = (int)(d->clr_bg.g * (double)0xffff);
+		  rclr.blue  = (int)(d->clr_bg.b * (double)0xffff);
+		  rclr.alpha = 0xffff;
+
+		  XRenderFillRectangle (xdpy, PictOpSrc, pic, &rclr,
+					0, 0, w * 2, h);
+
+		  /* Composite the decor under both states */
+		  XRenderComposite (xdpy, PictOpOver, p_theme->xpic, None, pic,
+				    b->x, b->y, 0, 0, 0, 0, w, h);
+
+		  XRenderComposite (xdpy, PictOpOver, p_theme->xpic, None, pic,
+				    b->x, b->y, 0, 0, w, 0, w, h);
+
+		  XRenderComposite (xdpy, PictOpOver, p_theme->xpic, None, pic,
+				    i_x, i_y, 0, 0, 0, 0, w, h);
+
+		  XRenderComposite (xdpy, PictOpOver, p_theme->xpic, None, pic,
+				    a_x, a_y, 0, 0, w, 0, w, h);
+		}
+	      else
+		{
+		  XRenderComposite (xdpy, PictOpSrc, p_theme->xpic, None, pic,
+				    i_x, i_y, 0, 0, 0, 0, w, h);
+
+		  XRenderComposite (xdpy, PictOpSrc, p_theme->xpic, None, pic,
+				    a_x, a_y, 0, 0, w, 0, w, h);
+		}
+
+	      b->sprite = pic;
+	    }
+	}
+    }
+}
+
+static void
+mb_wm_theme_png_free_sprites (MBWMThemePng *p_theme)
+{
+  MBWMTheme * theme = MB_WM_THEME (p_theme);
+  Display   * xdpy  = theme->wm->xdpy;
+  MBWMList  * l;
+
+  for (l = theme->xml_clients; l; l = l->next)
+    {
+      MBWMXmlClient * c = l->data;
+      MBWMList      * l2;
+
+      for (l2 = c->decors; l2; l2 = l2->next)
+	{
+	  MBWMXmlDecor * d = l2->data;
+	  MBWMList     * l3;
+
+	  for (l3 = d->buttons; l3; l3 = l3->next)
+	    {
+	      MBWMXmlButton * b = l3->data;
+
+	      if (b->sprite)
+		{
+		  XRenderFreePicture (xdpy, b->sprite);
+		  b->sprite = None;
+		}
+	    }
+	}
+    }
+}
+
 static void
 mb_wm_theme_png_destroy (MBWMObject *obj)
 {
   MBWMThemePng * theme = MB_WM_THEME_PNG (obj);
   Display * dpy = MB_WM_THEME (obj)->wm->xdpy;
 
+  mb_wm_theme_png_free_sprites (theme);
+
   XRenderFreePicture (dpy, theme->xpic);
   XFreePixmap (dpy, theme->xdraw);
 
@@ -80,6 +230,7 @@ mb_wm_theme_png_init (MBWMObject *obj, va_list vap)
   MBWMTheme        *theme   = MB_WM_THEME (obj);
   MBWMObjectProp    prop;
   char             *img = NULL;
+  MBWMThemeCache   *cache = NULL;
 #if USE_PANGO
   Display          *xdpy    = theme->wm->xdpy;
   int               xscreen = theme->wm->xscreen;
@@ -93,6 +244,9 @@ mb_wm_theme_png_init (MBWMObject *obj, va_list vap)
 	case MBWMObjectPropThemeImg:
 	  img = va_arg(vap, char *);
 	  break;
+	case MBWMObjectPropThemeCache:
+	  cache = va_arg(vap, MBWMThemeCache *);
+	  break;
 	default:
 	  MBWMO_PROP_EAT (vap, prop);
 	}
@@ -100,9 +254,11 @@ mb_wm_theme_png_init (MBWMObject *obj, va_list vap)
       prop = va_arg(vap, MBWMObjectProp);
     }
 
-  if (!img || !mb_wm_theme_png_ximg (p_theme, img))
+  if (!img || !mb_wm_theme_png_ximg (p_theme, img, cache))
     return 0;
 
+  mb_wm_theme_png_build_sprites (p_theme);
+
 #if USE_PANGO
   p_theme->context = pango_xft_get_context (xdpy, xscreen);
   p_theme->fontmap = pango_xft_get_font_map (xdpy, xscreen);
@@ -173,28 +329,6 @@ decordata_free (MBWMDecor * decor, void *data)
   free (dd);
 }
 
-struct ButtonData
-{
-  Pixmap    xpix_i;
-  XftDraw  *xftdraw_i;
-  Pixmap    xpix_a;
-  XftDraw  *xftdraw_a;
-};
-
-static void
-buttondata_free (MBWMDecorButton * button, void *data)
-{
-  struct ButtonData * bd = data;
-  Display * xdpy = button->decor->parent_client->wmref->xdpy;
-
-  XFreePixmap (xdpy, bd->xpix_i);
-  XftDrawDestroy (bd->xftdraw_i);
-  XFreePixmap (xdpy, bd->xpix_a);
-  XftDrawDestroy (bd->xftdraw_a);
-
-  free (bd);
-}
-
 #if !USE_PANGO
 static XftFont *
 xft_load_font(MBWMDecor * decor, MBWMXmlDecor *d)
@@ -225,9 +359,8 @@ static void
 mb_wm_theme_png_paint_button (MBWMTheme *theme, MBWMDecorButton *button)
 {
   MBWMDecor              * decor;
-  MBWMThemePng           * p_theme = MB_WM_THEME_PNG (theme);
   MBWindowManagerClient  * client;
-  MBWMClientType           c_type;;
+  MBWMClientType           c_type;
   MBWMXmlClient          * c;
   MBWMXmlDecor           * d;
   MBWMXmlButton          * b;
@@ -239,112 +372,17 @@ mb_wm_theme_png_paint_button (MBWMTheme *theme, MBWMDecorButton *button)
   client = mb_wm_decor_get_parent (decor);
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type))      &&
-      (b = mb_wm_xml_button_find_by_type (d->buttons, button->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type))      &&
+      (b = mb_wm_xml_button_lookup (d, button->type)))
     {
       Display           * xdpy    = theme->wm->xdpy;
-      int                 xscreen = theme->wm->xscreen;
       struct DecorData  * ddata = mb_wm_decor_get_theme_data (decor);
-      struct ButtonData * bdata;
       int                 x, y;
 
-      if (!ddata)
+      if (!ddata || !b->sprite)
 	return;
 
-      bdata = mb_wm_decor_button_get_theme_data (button);
-
-      if (!bdata)
-	{
-	  int a_x = b->active_x > -1 ? b->active_x : b->x;
-	  int a_y = b->active_y > -1 ? b->active_y : b->y;
-
-	  int i_x = b->inactive_x > -1 ? b->inactive_x : b->x;
-	  int i_y = b->inactive_y > -1 ? b->inactive_y : b->y;
-
-	  bdata = malloc (sizeof (struct ButtonData));
-
-	  bdata->xpix_a = XCreatePixmap(xdpy, decor->xwin,
-				      button->geom.width, button->geom.height,
-				      DefaultDepth(xdpy, xscreen));
-
-	  bdata->xftdraw_a = XftDrawCreate (xdpy, bdata->xpix_a,
-					    DefaultVisual (xdpy, xscreen),
-					    DefaultColormap (xdpy, xscreen));
-
-	  bdata->xpix_i = XCreatePixmap(xdpy, decor->xwin,
-				      button->geom.width, button->geom.height,
-				      DefaultDepth(xdpy, xscreen));
-
-	  bdata->xftdraw_i = XftDrawCreate (xdpy, bdata->xpix_i,
-					    DefaultVisual (xdpy, xscreen),
-					    DefaultColormap (xdpy, xscreen));
-
-	  /*
-	   * If the background color is set for the parent decor, we do a fill
-	   * with the parent color first, then composite the decor image over,
-	   * and finally composite the button image. (This way we can paint the
-	   * button with a simple PictOpSrc, rather than having to do
-	   * composting on each draw).
-	   */
-	  if (d->clr_bg.set)
-	    {
-	      XRenderColor rclr2;
-
-	      rclr2.red   = (int)(d->clr_bg.r * (double)0xffff);
-	      rclr2.green = (int)(d->clr_bg.g * (double)0xffff);
-	      rclr2.blue  = (int)(d->clr_bg.b * (double)0xffff);
-
-	      /* Fill the inactive image */
-	      XRenderFillRectangle (xdpy, PictOpSrc,
-				    XftDrawPicture (bdata->xftdraw_i), &rclr2,
-				    0, 0, b->width, b->height);
-
-	      /* Composite the decor over */
-	      XRenderComposite (xdpy, PictOpOver,
-				p_theme->xpic,
-				None,
-				XftDrawPicture (bdata->xftdraw_i),
-				b->x, b->y, 0, 0, 0, 0, b->width, b->height);
-
-	      /* Copy inactive button to the active one */
-	      XRenderComposite (xdpy, PictOpSrc,
-				XftDrawPicture (bdata->xftdraw_i),
-				None,
-				XftDrawPicture (bdata->xftdraw_a),
-				0, 0, 0, 0, 0, 0, b->width, b->height);
-
-	      /* Composite inactive and active image on top */
-	      XRenderComposite (xdpy, PictOpOver,
-				p_theme->xpic,
-				None,
-				XftDrawPicture (bdata->xftdraw_i),
-				i_x, i_y, 0, 0, 0, 0, b->width, b->height);
-
-	      XRenderComposite (xdpy, PictOpOver,
-				p_theme->xpic,
-				None,
-				XftDrawPicture (bdata->xftdraw_a),
-				a_x, a_y, 0, 0, 0, 0, b->width, b->height);
-	    }
-	  else
-	    {
-	      XRenderComposite (xdpy, PictOpSrc,
-				p_theme->xpic,
-				None,
-				XftDrawPicture (bdata->xftdraw_i),
-				i_x, i_y, 0, 0, 0, 0, b->width, b->height);
-
-	      XRenderComposite (xdpy, PictOpSrc,
-				p_theme->xpic,
-				None,
-				XftDrawPicture (bdata->xftdraw_a),
-				a_x, a_y, 0, 0, 0, 0, b->width, b->height);
-	    }
-
-	  mb_wm_decor_button_set_theme_data (button, bdata, buttondata_free);
-	}
-
       /* Here we automagically determine if the button should be left or
        * right aligned in the case that a decor is expanded wider than
        * the template image. If the coordinate comes before the point
@@ -360,12 +398,12 @@ mb_wm_theme_png_paint_button (MBWMTheme *theme, MBWMDecorButton *button)
       y = b->y - d->y;
 
       XRenderComposite (xdpy, PictOpSrc,
-			button->state == MBWMDecorButtonStatePressed ?
-			XftDrawPicture (bdata->xftdraw_a) :
-			XftDrawPicture (bdata->xftdraw_i),
+			b->sprite,
 			None,
 			XftDrawPicture (ddata->xftdraw),
-			0, 0, 0, 0, x, y, b->width, b->height);
+			button->state == MBWMDecorButtonStatePressed ?
+			b->width : 0, 0,
+			0, 0, x, y, b->width, b->height);
 
       XClearWindow (xdpy, decor->xwin);
     }
@@ -397,8 +435,8 @@ mb_wm_theme_png_paint_decor (MBWMTheme *theme, MBWMDecor *decor)
   int			   operator = PictOpSrc;
   Bool			   shaped;
 
-  if (!((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-        (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type))))
+  if (!((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+        (d = mb_wm_xml_decor_lookup (c, decor->type))))
     return;
 
 #ifdef HAVE_XEXT
@@ -908,11 +946,11 @@ mb_wm_theme_png_create_decor (MBWMTheme             *theme,
   MBWindowManager *wm = client->wmref;
   MBWMXmlClient   *c;
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)))
     {
       MBWMXmlDecor *d;
 
-      d = mb_wm_xml_decor_find_by_type (c->decors, type);
+      d = mb_wm_xml_decor_lookup (c, type);
 
       if (d)
 	{
@@ -940,10 +978,10 @@ mb_wm_theme_png_get_button_size (MBWMTheme             *theme,
   MBWMXmlDecor  * d;
 
   /* FIXME -- assumes button on the north decor only */
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)))
     {
-      MBWMXmlButton * b = mb_wm_xml_button_find_by_type (d->buttons, type);
+      MBWMXmlButton * b = mb_wm_xml_button_lookup (d, type);
 
       if (b)
 	{
@@ -978,10 +1016,10 @@ mb_wm_theme_png_get_button_position (MBWMTheme             *theme,
   MBWMXmlDecor  * d;
 
   /* FIXME -- assumes button on the north decor only */
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)))
     {
-      MBWMXmlButton * b = mb_wm_xml_button_find_by_type (d->buttons, type);
+      MBWMXmlButton * b = mb_wm_xml_button_lookup (d, type);
 
       if (b)
 	{
@@ -1032,11 +1070,11 @@ mb_wm_theme_png_get_decor_dimensions (MBWMTheme             *theme,
   MBWMXmlDecor  * d;
 
   /* FIXME -- assumes button on the north decor only */
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)))
     {
       if (north)
 	{
-	  d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeNorth);
+	  d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeNorth);
 
 	  if (d)
 	    *north = d->height;
@@ -1046,7 +1084,7 @@ mb_wm_theme_png_get_decor_dimensions (MBWMTheme             *theme,
 
       if (south)
 	{
-	  d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeSouth);
+	  d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeSouth);
 
 	  if (d)
 	    *south = d->height;
@@ -1056,7 +1094,7 @@ mb_wm_theme_png_get_decor_dimensions (MBWMTheme             *theme,
 
       if (west)
 	{
-	  d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeWest);
+	  d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeWest);
 
 	  if (d)
 	    *west = d->width;
@@ -1066,7 +1104,7 @@ mb_wm_theme_png_get_decor_dimensions (MBWMTheme             *theme,
 
       if (east)
 	{
-	  d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeEast);
+	  d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeEast);
 
 	  if (d)
 	    *east = d->width;
@@ -1201,15 +1239,209 @@ mb_wm_theme_png_load_file (const char *file,
   return data;
 }
 
+/*
+ * Premultiplies a row of RGBA png data and packs it into native-order
+ * ARGB32 pixels, i.e., what XPutPixel would have produced for a 32bpp
+ * image in host byte order.
+ */
+static void
+mb_wm_theme_png_premultiply_row (const unsigned char * src,
+				 uint32_t            * dst,
+				 int                   width)
+{
+  int x = 0;
+
+#if MBWM_THEME_PNG_SSE2
+  {
+    const __m128i zero  = _mm_setzero_si128 ();
+    const __m128i one   = _mm_set_epi16 (0, 1, 1, 1, 0, 1, 1, 1);
+    const __m128i amask = _mm_set_epi16 (0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i a256  = _mm_set_epi16 (256, 0, 0, 0, 256, 0, 0, 0);
+
+    /*
+     * Four pixels per iteration; each pixel is widened to four 16-bit
+     * lanes (r, g, b, a) and multiplied by (a+1, a+1, a+1, 256), so that
+     * alpha passes through unchanged after the shift.
+     */
+    for (; x + 4 <= width; x += 4, src += 16, dst += 4)
+      {
+	__m128i px = _mm_loadu_si128 ((const __m128i *) src);
+	__m128i lo = _mm_unpacklo_epi8 (px, zero);
+	__m128i hi = _mm_unpackhi_epi8 (px, zero);
+	__m128i alo, ahi;
+
+	alo = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo, 0xff), 0xff);
+	ahi = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi, 0xff), 0xff);
+
+	alo = _mm_or_si128 (_mm_and_si128 (_mm_add_epi16 (alo, one), amask),
+			    a256);
+	ahi = _mm_or_si128 (_mm_and_si128 (_mm_add_epi16 (ahi, one), amask),
+			    a256);
+
+	lo = _mm_srli_epi16 (_mm_mullo_epi16 (lo, alo), 8);
+	hi = _mm_srli_epi16 (_mm_mullo_epi16 (hi, ahi), 8);
+
+	/* RGBA -> BGRA, which is ARGB32 in little endian */
+	lo = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo, 0xc6), 0xc6);
+	hi = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi, 0xc6), 0xc6);
+
+	_mm_storeu_si128 ((__m128i *) dst, _mm_packus_epi16 (lo, hi));
+      }
+  }
+#elif MBWM_THEME_PNG_NEON
+  {
+    const uint16x8_t one = vdupq_n_u16 (1);
+
+    for (; x + 8 <= width; x += 8, src += 32, dst += 8)
+      {
+	uint8x8x4_t in = vld4_u8 (src);
+	uint8x8x4_t out;
+	uint16x8_t  a1 = vaddw_u8 (one, in.val[3]);
+
+	out.val[0] = vshrn_n_u16 (vmulq_u16 (vmovl_u8 (in.val[2]), a1), 8);
+	out.val[1] = vshrn_n_u16 (vmulq_u16 (vmovl_u8 (in.val[1]), a1), 8);
+	out.val[2] = vshrn_n_u16 (vmulq_u16 (vmovl_u8 (in.val[0]), a1), 8);
+	out.val[3] = in.val[3];
+
+	vst4_u8 ((uint8_t *) dst, out);
+      }
+  }
+#endif
+
+  for (; x < width; x++)
+    {
+      uint32_t a, r, g, b;
+      r = *src++; g = *src++; b = *src++; a = *src++;
+      r = (r * (a + 1)) >> 8;
+      g = (g * (a + 1)) >> 8;
+      b = (b * (a + 1)) >> 8;
+
+      *dst++ = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+/*
+ * Packs a row of alpha values, spaced 4 bytes apart, into a 1-bit,
+ * LSBFirst shape mask row.
+ */
+static void
+mb_wm_theme_png_shape_row (const unsigned char * alpha,
+			   unsigned char       * dst,
+			   int                   width)
+{
+  int x, bit;
+
+  for (x = 0; x < width; x += 8)
+    {
+      unsigned char byte = 0;
+      int           n    = width - x < 8 ? width - x : 8;
+
+      for (bit = 0; bit < n; bit++)
+	if (alpha[(x + bit) << 2])
+	  byte |= 1 << bit;
+
+      *dst++ = byte;
+    }
+}
+
+static Bool
+mb_wm_theme_png_host_is_lsb_first (void)
+{
+  const uint32_t one = 1;
+
+  return *(const unsigned char *) &one == 1;
+}
+
+#if defined (HAVE_XEXT) && defined (MBWM_THEME_PNG_USE_SHM)
+/*
+ * Creates a shared memory XImage for the upload; returns NULL (leaving the
+ * caller to fall back on XPutImage) if the server cannot do MIT-SHM with us,
+ * e.g., because it is remote.
+ */
+static XImage *
+mb_wm_theme_png_shm_image_new (Display         * dpy,
+			       Visual          * visual,
+			       int               depth,
+			       int               width,
+			       int               height,
+			       XShmSegmentInfo * shminfo)
+{
+  XImage * ximg;
+
+  if (!XShmQueryExtension (dpy))
+    return NULL;
+
+  ximg = XShmCreateImage (dpy, visual, depth, ZPixmap, NULL, shminfo,
+			  width, height);
+
+  if (!ximg)
+    return NULL;
+
+  shminfo->shmid = shmget (IPC_PRIVATE, ximg->bytes_per_line * ximg->height,
+			   IPC_CREAT | 0600);
+
+  if (shminfo->shmid < 0)
+    {
+      XDestroyImage (ximg);
+      return NULL;
+    }
+
+  shminfo->shmaddr = ximg->data = shmat (shminfo->shmid, NULL, 0);
+  shminfo->readOnly = True;
+
+  if (shminfo->shmaddr == (char *) -1)
+    {
+      shmctl (shminfo->shmid, IPC_RMID, NULL);
+      ximg->data = NULL;
+      XDestroyImage (ximg);
+      return NULL;
+    }
+
+  mb_wm_util_trap_x_errors ();
+  XShmAttach (dpy, shminfo);
+  XSync (dpy, False);
+
+  /*
+   * Mark the segment for removal right away, so it does not leak if we
+   * die; it stays around until both we and the server detach.
+   */
+  shmctl (shminfo->shmid, IPC_RMID, NULL);
+
+  if (mb_wm_util_untrap_x_errors ())
+    {
+      shmdt (shminfo->shmaddr);
+      ximg->data = NULL;
+      XDestroyImage (ximg);
+      return NULL;
+    }
+
+  return ximg;
+}
+
+static void
+mb_wm_theme_png_shm_image_free (Display         * dpy,
+				XImage          * ximg,
+				XShmSegmentInfo * shminfo)
+{
+  XShmDetach (dpy, shminfo);
+  XSync (dpy, False);
+  shmdt (shminfo->shmaddr);
+  ximg->data = NULL;
+  XDestroyImage (ximg);
+}
+#endif
+
 static int
-mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
+mb_wm_theme_png_ximg (MBWMThemePng   * theme,
+		      const char     * img,
+		      MBWMThemeCache * cache)
 {
   MBWindowManager * wm = MB_WM_THEME (theme)->wm;
   Display * dpy = wm->xdpy;
   int       screen = wm->xscreen;
 
-  XImage * ximg, * shape_img;
-  GC       gc, gcm;
+  XImage * ximg = NULL, * shape_img = NULL;
+  GC       gc, gcm = NULL;
   int x;
   int y;
   int width;
@@ -1217,10 +1449,26 @@ mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
   XRenderPictFormat       *ren_fmt;
   XRenderPictureAttributes ren_attr;
   unsigned char * p;
-  unsigned char * png_data = mb_wm_theme_png_load_file (img, &width, &height);
+  unsigned char * png_data = NULL;
+  const uint32_t * cached = NULL;
   Bool shaped = MB_WM_THEME (theme)->shaped;
+  Bool use_shm = False;
+  Bool lsb_first = mb_wm_theme_png_host_is_lsb_first ();
+#if defined (HAVE_XEXT) && defined (MBWM_THEME_PNG_USE_SHM)
+  XShmSegmentInfo shminfo;
+#endif
+
+  if (cache && cache->pixels)
+    {
+      /* Premultiplied image straight from the compiled theme cache */
+      cached = cache->pixels;
+      width  = cache->img_width;
+      height = cache->img_height;
+    }
+  else
+    png_data = mb_wm_theme_png_load_file (img, &width, &height);
 
-  if (!png_data || !width || !height)
+  if ((!png_data && !cached) || !width || !height)
     return 0;
 
   ren_fmt = XRenderFindStandardFormat(dpy, PictStandardARGB32);
@@ -1243,11 +1491,27 @@ mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
   if (shaped)
     gcm = XCreateGC (dpy, theme->shape_mask, 0, NULL);
 
-  ximg = XCreateImage (dpy, DefaultVisual (dpy, screen),
-		       ren_fmt->depth, ZPixmap,
-		       0, NULL, width, height, 32, 0);
+#if defined (HAVE_XEXT) && defined (MBWM_THEME_PNG_USE_SHM)
+  ximg = mb_wm_theme_png_shm_image_new (dpy, DefaultVisual (dpy, screen),
+					ren_fmt->depth, width, height,
+					&shminfo);
+  use_shm = (ximg != NULL);
+#endif
 
-  ximg->data = malloc (ximg->bytes_per_line * ximg->height);
+  if (!ximg)
+    {
+      ximg = XCreateImage (dpy, DefaultVisual (dpy, screen),
+			   ren_fmt->depth, ZPixmap,
+			   0, NULL, width, height, 32, 0);
+
+      ximg->data = malloc (ximg->bytes_per_line * ximg->height);
+
+      /*
+       * We fill the image in host byte order; Xlib swaps on upload if the
+       * server differs.
+       */
+      ximg->byte_order = lsb_first ? LSBFirst : MSBFirst;
+    }
 
   if (shaped)
     {
@@ -1255,31 +1519,87 @@ mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
 				1, ZPixmap,
 				0, NULL, width, height, 8, 0);
 
+      /* Byte sized units with a fixed bit order, whatever the server uses */
+      shape_img->bitmap_unit      = 8;
+      shape_img->bitmap_bit_order = LSBFirst;
+      shape_img->bytes_per_line   = (width + 7) / 8;
+
       shape_img->data = malloc (shape_img->bytes_per_line * shape_img->height);
     }
 
   p = png_data;
 
-  for (y = 0; y < height; y++)
-    for (x = 0; x < width; x++)
-      {
-	unsigned char a, r, g, b;
-	r = *p++; g = *p++; b = *p++; a = *p++;
-	r = (r * (a + 1)) / 256;
-	g = (g * (a + 1)) / 256;
-	b = (b * (a + 1)) / 256;
+  if (ximg->bits_per_pixel == 32 &&
+      ximg->byte_order == (lsb_first ? LSBFirst : MSBFirst))
+    {
+      for (y = 0; y < height; y++)
+	{
+	  uint32_t * row = (uint32_t *)(ximg->data + y * ximg->bytes_per_line);
 
-	XPutPixel (ximg, x, y, (a << 24) | (r << 16) | (g << 8) | b);
+	  if (cached)
+	    memcpy (row, cached + y * width, width * sizeof (uint32_t));
+	  else
+	    mb_wm_theme_png_premultiply_row (png_data + y * width * 4,
+					     row, width);
+	}
 
-	if (shaped)
+      /* A no-op unless the cache is new */
+      if (cache)
+	mb_wm_theme_cache_save (cache, (const uint32_t *) ximg->data,
+				width, height, ximg->bytes_per_line);
+    }
+  else
+    {
+      for (y = 0; y < height; y++)
+	for (x = 0; x < width; x++)
 	  {
-	    XPutPixel (shape_img, x, y, a ? 1 : 0);
-	  }
-      }
+	    unsigned char a, r, g, b;
+
+	    if (cached)
+	      {
+		XPutPixel (ximg, x, y, cached[y * width + x]);
+		continue;
+	      }
 
-  XPutImage (dpy, theme->xdraw, gc, ximg, 0, 0, 0, 0, width, height);
+	    r = *p++; g = *p++; b = *p++; a = *p++;
+	    r = (r * (a + 1)) / 256;
+	    g = (g * (a + 1)) / 256;
+	    b = (b * (a + 1)) / 256;
+
+	    XPutPixel (ximg, x, y, (a << 24) | (r << 16) | (g << 8) | b);
+	  }
+    }
 
   if (shaped)
+    {
+      /*
+       * Alpha is the last byte of the png RGBA, and the most significant
+       * byte of the cached native ARGB32
+       */
+      const unsigned char * alpha;
+      int                   row_len = width * 4;
+
+      if (cached)
+	alpha = (const unsigned char *) cached + (lsb_first ? 3 : 0);
+      else
+	alpha = png_data + 3;
+
+      for (y = 0; y < height; y++)
+	mb_wm_theme_png_shape_row (alpha + y * row_len,
+				   (unsigned char *) shape_img->data +
+				   y * shape_img->bytes_per_line,
+				   width);
+    }
+
+#if defined (HAVE_XEXT) && defined (MBWM_THEME_PNG_USE_SHM)
+  if (use_shm)
+    XShmPutImage (dpy, theme->xdraw, gc, ximg, 0, 0, 0, 0, width, height,
+		  False);
+  else
+#endif
+    XPutImage (dpy, theme->xdraw, gc, ximg, 0, 0, 0, 0, width, height);
+
+  if (shape_img)
     XPutImage (dpy, theme->shape_mask, gcm, shape_img,
 	       0, 0, 0, 0, width, height);
 
@@ -1287,12 +1607,20 @@ mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
 				      CPRepeat|CPDither|CPComponentAlpha,
 				      &ren_attr);
 
-  free (ximg->data);
-  ximg->data = NULL;
-  XDestroyImage (ximg);
+#if defined (HAVE_XEXT) && defined (MBWM_THEME_PNG_USE_SHM)
+  if (use_shm)
+    mb_wm_theme_png_shm_image_free (dpy, ximg, &shminfo);
+  else
+#endif
+    {
+      free (ximg->data);
+      ximg->data = NULL;
+      XDestroyImage (ximg);
+    }
+
   XFreeGC (dpy, gc);
 
-  if (shaped)
+  if (shape_img)
     {
       free (shape_img->data);
       shape_img->data = NULL;
@@ -1300,7 +1628,46 @@ mb_wm_theme_png_ximg (MBWMThemePng * theme, const char * img)
       XFreeGC (dpy, gcm);
     }
 
-  free (png_data);
+  if (png_data)
+    free (png_data);
 
   return 1;
 }
+
+/*
+ * Decodes and premultiplies the theme image into the cache ahead of the
+ * theme construction; makes no X calls, so that it can be done off the
+ * main thread.
+ */
+Bool
+mb_wm_theme_png_decode_image (MBWMThemeCache *cache)
+{
+  unsigned char * png_data;
+  uint32_t      * pixels;
+  int             width, height, y;
+
+  if (!cache || !cache->img || cache->pixels)
+    return False;
+
+  png_data = mb_wm_theme_png_load_file (cache->img, &width, &height);
+
+  if (!png_data || !width || !height ||
+      !(pixels = malloc (width * height * sizeof (uint32_t))))
+    {
+      free (png_data);
+      return False;
+    }
+
+  for (y = 0; y < height; y++)
+    mb_wm_theme_png_premultiply_row (png_data + y * width * 4,
+				     pixels + y * width, width);
+
+  free (png_data);
+
+  cache->pixels_buf = pixels;
+  cache->pixels     = pixels;
+  cache->img_width  = width;
+  cache->img_height = height;
+
+  return True;
+}
@@ -23,6 +23,7 @@
 
 #include <matchbox/mb-wm-config.h>
 #include <matchbox/theme-engines/mb-wm-theme.h>
+#include <matchbox/theme-engines/mb-wm-theme-cache.h>
 
 #include <X11/extensions/Xrender.h>
 
@@ -53,4 +54,6 @@ struct MBWMThemePng
 
 int mb_wm_theme_png_class_type (void);
 
+Bool mb_wm_theme_png_decode_image (MBWMThemeCache *cache);
+
 #endif
@@ -177,6 +177,109 @@ mb_wm_xml_button_find_by_type (MBWMList *l, MBWMDecorButtonType type)
   return NULL;
 }
 
+/*
+ * Maps a client type to its lookup table slot, or -1 for (custom) types
+ * that are not a single bit.
+ */
+static int
+client_type_slot (MBWMClientType type)
+{
+  unsigned int t = type;
+  int          slot = 0;
+
+  if (!t || (t & (t - 1)))
+    return -1;
+
+  while (!(t & 1))
+    {
+      t >>= 1;
+      slot++;
+    }
+
+  return slot < MBWM_XML_CLIENT_SLOTS ? slot : -1;
+}
+
+/*
+ * Resolves the client, decor and button lists into direct lookup tables;
+ * like the _find_by_type() functions, the first entry of a given type wins.
+ */
+void
+mb_wm_xml_clients_build_index (MBWMList *l, MBWMXmlClient **index)
+{
+  memset (index, 0, sizeof (MBWMXmlClient*) * MBWM_XML_CLIENT_SLOTS);
+
+  for (; l; l = l->next)
+    {
+      MBWMXmlClient * c = l->data;
+      MBWMList      * l2;
+      int             slot = client_type_slot (c->type);
+
+      if (slot >= 0 && !index[slot])
+	index[slot] = c;
+
+      memset (c->decor_index, 0, sizeof (c->decor_index));
+
+      for (l2 = c->decors; l2; l2 = l2->next)
+	{
+	  MBWMXmlDecor * d = l2->data;
+	  MBWMList     * l3;
+
+	  if (d->type > 0 && d->type < MBWM_XML_DECOR_SLOTS &&
+	      !c->decor_index[d->type])
+	    c->decor_index[d->type] = d;
+
+	  memset (d->button_index, 0, sizeof (d->button_index));
+
+	  for (l3 = d->buttons; l3; l3 = l3->next)
+	    {
+	      MBWMXmlButton * b = l3->data;
+
+	      if (b->type >= 0 && b->type < MBWM_XML_BUTTON_SLOTS &&
+		  !d->button_index[b->type])
+		d->button_index[b->type] = b;
+	    }
+	}
+    }
+}
+
+MBWMXmlClient *
+mb_wm_xml_client_lookup (MBWMTheme *theme, MBWMClientType type)
+{
+  int slot;
+
+  if (!theme)
+    return NULL;
+
+  if ((slot = client_type_slot (type)) >= 0)
+    return theme->xml_client_index[slot];
+
+  return mb_wm_xml_client_find_by_type (theme->xml_clients, type);
+}
+
+MBWMXmlDecor *
+mb_wm_xml_decor_lookup (MBWMXmlClient *c, MBWMDecorType type)
+{
+  if (!c)
+    return NULL;
+
+  if (type > 0 && type < MBWM_XML_DECOR_SLOTS)
+    return c->decor_index[type];
+
+  return mb_wm_xml_decor_find_by_type (c->decors, type);
+}
+
+MBWMXmlButton *
+mb_wm_xml_button_lookup (MBWMXmlDecor *d, MBWMDecorButtonType type)
+{
+  if (!d)
+    return NULL;
+
+  if (type >= 0 && type < MBWM_XML_BUTTON_SLOTS)
+    return d->button_index[type];
+
+  return mb_wm_xml_button_find_by_type (d->buttons, type);
+}
+
 #if 0
 void
 mb_wm_xml_client_dump (MBWMList * l)
@@ -6,6 +6,14 @@
 /*
  * Helper structs for xml theme
  */
+
+/*
+ * Sizes of the direct lookup tables; client types are single bits and are
+ * indexed by bit position, decor and button types by value. Any custom
+ * type that does not fit is looked up by walking the lists.
+ */
+#define MBWM_XML_DECOR_SLOTS  (MBWMDecorTypeWest + 1)
+#define MBWM_XML_BUTTON_SLOTS 16
 typedef struct Button
 {
   MBWMDecorButtonType type;
@@ -26,6 +34,12 @@ typedef struct Button
   int inactive_x;
   int inactive_y;
 
+  /*
+   * Picture holding the inactive and pressed images of the button side by
+   * side; built and owned by the png engine.
+   */
+  XID sprite;
+
   int press_activated;
 } MBWMXmlButton;
 
@@ -55,9 +69,11 @@ typedef struct Decor
   char             * font_family;
 
   MBWMList * buttons;
+
+  MBWMXmlButton * button_index[MBWM_XML_BUTTON_SLOTS];
 }MBWMXmlDecor;
 
-typedef struct Client
+struct Client
 {
   MBWMClientType  type;
 
@@ -71,7 +87,9 @@ typedef struct Client
   MBWMList       *decors;
 
   MBWMClientLayoutHints layout_hints;
-}MBWMXmlClient;
+
+  MBWMXmlDecor   *decor_index[MBWM_XML_DECOR_SLOTS];
+};
 
 MBWMXmlButton *
 mb_wm_xml_button_new ();
@@ -100,6 +118,18 @@ mb_wm_xml_decor_find_by_type (MBWMList *l, MBWMDecorType type);
 MBWMXmlButton *
 mb_wm_xml_button_find_by_type (MBWMList *l, MBWMDecorButtonType type);
 
+void
+mb_wm_xml_clients_build_index (MBWMList *l, MBWMXmlClient **index);
+
+MBWMXmlClient *
+mb_wm_xml_client_lookup (MBWMTheme *theme, MBWMClientType type);
+
+MBWMXmlDecor *
+mb_wm_xml_decor_lookup (MBWMXmlClient *c, MBWMDecorType type);
+
+MBWMXmlButton *
+mb_wm_xml_button_lookup (MBWMXmlDecor *d, MBWMDecorButtonType type);
+
 void
 mb_wm_xml_clr_from_string (MBWMColor * clr, const char *s);
 
@@ -20,8 +20,17 @@
 
 #include "mb-wm-theme.h"
 #include "mb-wm-theme-xml.h"
+#include "mb-wm-theme-cache.h"
+#if THEME_PNG
+#include "mb-wm-theme-png.h"
+#endif
 
 #include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <expat.h>
 #include <X11/Xft/Xft.h>
 
@@ -48,6 +57,12 @@ xml_element_end_cb (void *data, const char *tag);
 static void
 xml_stack_free (MBWMList *stack);
 
+static void
+mb_wm_theme_xml_clients_free (MBWMList *l);
+
+static int
+mb_wm_theme_type_from_name (const char *name);
+
 static void
 mb_wm_theme_simple_paint_decor (MBWMTheme *theme, MBWMDecor *decor);
 static void
@@ -90,17 +105,7 @@ mb_wm_theme_destroy (MBWMObject *obj)
   if (theme->path)
     free (theme->path);
 
-  MBWMList *l = theme->xml_clients;
-
-  while (l)
-    {
-      MBWMXmlClient * c = l->data;
-      MBWMList * n = l->next;
-      mb_wm_xml_client_free (c);
-      free (l);
-
-      l = n;
-    }
+  mb_wm_theme_xml_clients_free (theme->xml_clients);
 }
 
 static int
@@ -153,6 +158,7 @@ mb_wm_theme_init (MBWMObject *obj, va_list vap)
 
   theme->wm = wm;
   theme->xml_clients = xml_clients;
+  mb_wm_xml_clients_build_index (xml_clients, theme->xml_client_index);
 
   if (path)
     theme->path = strdup (path);
@@ -228,9 +234,9 @@ mb_wm_theme_is_button_press_activated (MBWMTheme              *theme,
   client = decor->parent_client;
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)) &&
-      (b = mb_wm_xml_button_find_by_type (d->buttons, type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)) &&
+      (b = mb_wm_xml_button_lookup (d, type)))
     {
       return b->press_activated;
     }
@@ -368,10 +374,10 @@ struct stack_data
 struct expat_data
 {
   XML_Parser   par;
-  int          theme_type;
   int          version;
   MBWMList     *xml_clients;
   char         *img;
+  char         *engine;
   MBWMList     *stack;
   MBWMColor     color_lowlight;
   MBWMColor     color_shadow;
@@ -380,23 +386,41 @@ struct expat_data
   Bool          shaped;
 };
 
-MBWMTheme *
-mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
+static void
+mb_wm_theme_xml_clients_free (MBWMList *l)
+{
+  while (l)
+    {
+      MBWMList * n = l->next;
+
+      mb_wm_xml_client_free (l->data);
+      free (l);
+
+      l = n;
+    }
+}
+
+/*
+ * Theme loading is done in two stages: mb_wm_theme_parse() locates the
+ * theme and reads its description, either from the compiled cache or from
+ * the xml, and for png themes also decodes the image. It makes no X calls
+ * and does not touch the window manager, so it can be run on a worker
+ * thread. mb_wm_theme_construct() then creates the theme object, uploading
+ * the image to the server, and must be called from the main thread.
+ *
+ * Returns NULL if there is no usable theme.xml.
+ */
+static MBWMThemeCache *
+mb_wm_theme_parse (const char * theme_path)
 {
-  MBWMTheme     *theme = NULL;
-  int            theme_type = 0;
   char          *path = NULL;
   char           buf[256];
   XML_Parser     par = NULL;
   FILE          *file = NULL;
-  MBWMList      *xml_clients = NULL;
   char          *img = NULL;
-  MBWMColor      clr_lowlight;
-  MBWMColor      clr_shadow;
-  MBWMCompMgrShadowType shadow_type;
-  Bool           compositing;
-  Bool           shaped;
   struct stat    st;
+  MBWMThemeCache *cache = NULL;
+  struct expat_data  udata;
 
   /*
    * If no theme specified, we try to load the default one, if that fails,
@@ -447,82 +471,147 @@ mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
 	}
     }
 
-  if (path)
+  if (!path)
+    return NULL;
+
+  /*
+   * If the compiled cache is current, we can skip both the xml parsing
+   * and the image decoding.
+   */
+  if ((cache = mb_wm_theme_cache_load (path)))
+    return cache;
+
+  if (!(file = fopen (path, "r")) ||
+      !(par = XML_ParserCreate(NULL)))
     {
-      struct expat_data  udata;
+      if (file)
+	fclose (file);
 
-      if (!(file = fopen (path, "r")) ||
-	  !(par = XML_ParserCreate(NULL)))
-	{
-	  goto default_theme;
-	}
+      return NULL;
+    }
 
-      memset (&udata, 0, sizeof (struct expat_data));
-      udata.compositing = True;
-      udata.par         = par;
+  memset (&udata, 0, sizeof (struct expat_data));
+  udata.compositing = True;
+  udata.par         = par;
 
-      XML_SetElementHandler (par,
-			     xml_element_start_cb,
-			     xml_element_end_cb);
+  XML_SetElementHandler (par,
+			 xml_element_start_cb,
+			 xml_element_end_cb);
 
-      XML_SetUserData(par, (void *)&udata);
+  XML_SetUserData(par, (void *)&udata);
 
-      while (fgets (buf, sizeof (buf), file) &&
-	     XML_Parse(par, buf, strlen(buf), 0));
+  while (fgets (buf, sizeof (buf), file) &&
+	 XML_Parse(par, buf, strlen(buf), 0));
 
-      XML_Parse(par, NULL, 0, 1);
+  XML_Parse(par, NULL, 0, 1);
 
-      if (udata.version == 2)
-	{
-	  theme_type  = udata.theme_type;
-	  xml_clients = udata.xml_clients;
+  XML_ParserFree (par);
+  fclose (file);
 
-	  if (udata.img)
-	    {
-	      if (*udata.img == '/')
-		img = udata.img;
-	      else
-		{
-		  int len = strlen (path) + strlen (udata.img);
-		  char * s;
-		  char * p = malloc (len + 1);
-		  strncpy (p, path, len);
+  xml_stack_free (udata.stack);
 
-		  s = strrchr (p, '/');
+  /*
+   * The description is complete now; for a version 2 theme the cache is
+   * written out once the image is decoded and the theme constructed.
+   */
+  cache = mb_wm_theme_cache_new (path);
 
-		  if (s)
-		    {
-		      *(s+1) = 0;
-		      strcat (p, udata.img);
-		    }
-		  else
-		    {
-		      strncpy (p, udata.img, len);
-		    }
+  cache->version        = udata.version;
+  cache->color_lowlight = udata.color_lowlight;
+  cache->color_shadow   = udata.color_shadow;
+  cache->shadow_type    = udata.shadow_type;
+  cache->compositing    = udata.compositing;
+  cache->shaped         = udata.shaped;
 
-		  img = p;
-		  free (udata.img);
-		}
+  if (udata.version != 2)
+    {
+      mb_wm_theme_xml_clients_free (udata.xml_clients);
+      free (udata.engine);
+      free (udata.img);
+
+      return cache;
+    }
+
+  cache->engine      = udata.engine;
+  cache->xml_clients = udata.xml_clients;
+
+  if (udata.img)
+    {
+      if (*udata.img == '/')
+	img = udata.img;
+      else
+	{
+	  int len = strlen (path) + strlen (udata.img);
+	  char * s;
+	  char * p = malloc (len + 1);
+	  strncpy (p, path, len);
+
+	  s = strrchr (p, '/');
+
+	  if (s)
+	    {
+	      *(s+1) = 0;
+	      strcat (p, udata.img);
+	    }
+	  else
+	    {
+	      strncpy (p, udata.img, len);
 	    }
+
+	  img = p;
+	  free (udata.img);
 	}
+    }
 
-      clr_lowlight.r   = udata.color_lowlight.r;
-      clr_lowlight.g   = udata.color_lowlight.g;
-      clr_lowlight.b   = udata.color_lowlight.b;
-      clr_lowlight.a   = udata.color_lowlight.a;
-      clr_lowlight.set = udata.color_lowlight.set;
+  cache->img = img;
 
-      clr_shadow.r   = udata.color_shadow.r;
-      clr_shadow.g   = udata.color_shadow.g;
-      clr_shadow.b   = udata.color_shadow.b;
-      clr_shadow.a   = udata.color_shadow.a;
-      clr_shadow.set = udata.color_shadow.set;
+#if THEME_PNG
+  if (cache->engine && !strcmp (cache->engine, "png"))
+    mb_wm_theme_png_decode_image (cache);
+#endif
 
-      shadow_type = udata.shadow_type;
-      compositing = udata.compositing;
-      shaped      = udata.shaped;
+  return cache;
+}
 
-      xml_stack_free (udata.stack);
+/*
+ * Creates the theme object from a description returned by
+ * mb_wm_theme_parse(), falling back on the built-in theme; consumes the
+ * description.
+ */
+static MBWMTheme *
+mb_wm_theme_construct (MBWindowManager * wm, MBWMThemeCache * desc)
+{
+  MBWMTheme     *theme = NULL;
+  int            theme_type = 0;
+  const char    *path = NULL;
+  MBWMList      *xml_clients = NULL;
+  const char    *img = NULL;
+  MBWMColor      clr_lowlight;
+  MBWMColor      clr_shadow;
+  MBWMCompMgrShadowType shadow_type = 0;
+  Bool           compositing = True;
+  Bool           shaped = False;
+  MBWMThemeCache *cache = NULL;
+
+  memset (&clr_lowlight, 0, sizeof (MBWMColor));
+  memset (&clr_shadow, 0, sizeof (MBWMColor));
+
+  if (desc)
+    {
+      path         = desc->xml_path;
+      clr_lowlight = desc->color_lowlight;
+      clr_shadow   = desc->color_shadow;
+      shadow_type  = desc->shadow_type;
+      compositing  = desc->compositing;
+      shaped       = desc->shaped;
+
+      if (desc->version == 2)
+	{
+	  theme_type  = mb_wm_theme_type_from_name (desc->engine);
+	  xml_clients = desc->xml_clients;
+	  img         = desc->img;
+	  cache       = desc;
+	}
     }
 
   if (custom_theme_alloc_func)
@@ -538,6 +627,7 @@ mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
 			MBWMObjectPropThemeShadowType,     shadow_type,
 			MBWMObjectPropThemeCompositing,    compositing,
 			MBWMObjectPropThemeShaped,         shaped,
+			MBWMObjectPropThemeCache,          cache,
 			NULL);
     }
   else if (theme_type)
@@ -553,10 +643,16 @@ mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
 			MBWMObjectPropThemeShadowType,     shadow_type,
 			MBWMObjectPropThemeCompositing,    compositing,
 			MBWMObjectPropThemeShaped,         shaped,
+			MBWMObjectPropThemeCache,          cache,
 			NULL));
     }
 
- default_theme:
+  /*
+   * Themes without an image are complete as soon as parsed; with an image,
+   * the cache is written by the engine that decoded it.
+   */
+  if (theme && cache && !cache->img)
+    mb_wm_theme_cache_save (cache, NULL, 0, 0, 0);
 
   if (!theme)
     {
@@ -572,16 +668,187 @@ mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
 			NULL));
     }
 
-  if (par)
-    XML_ParserFree (par);
+  mb_wm_theme_cache_free (desc);
 
-  if (file)
-    fclose (file);
+  return theme;
+}
+
+MBWMTheme *
+mb_wm_theme_new (MBWindowManager * wm, const char * theme_path)
+{
+  return mb_wm_theme_construct (wm, mb_wm_theme_parse (theme_path));
+}
 
-  if (img)
-    free (img);
+#ifdef HAVE_PTHREAD
+struct MBWMThemeLoader
+{
+  MBWindowManager     *wm;
+  char                *theme_path;
+  MBWMThemeCache      *desc;
+  MBWMThemeLoadedFunc  func;
+  void                *userdata;
+
+  pthread_t            thread;
+  int                  fds[2];
+  MBWMIOChannel       *channel;
+  unsigned long        watch_id;
+};
 
-  return theme;
+static void *
+mb_wm_theme_loader_thread (void *data)
+{
+  MBWMThemeLoader * loader = data;
+  char              c = 0;
+
+  loader->desc = mb_wm_theme_parse (loader->theme_path);
+
+  /* Wake up the main loop */
+  while (write (loader->fds[1], &c, 1) < 0 && errno == EINTR);
+
+  return NULL;
+}
+
+static void
+mb_wm_theme_loader_free (MBWMThemeLoader *loader)
+{
+  if (loader->watch_id)
+    mb_wm_main_context_fd_watch_remove (loader->wm->main_ctx,
+					loader->watch_id);
+
+  mb_wm_main_context_io_channel_destroy (loader->channel);
+
+  close (loader->fds[0]);
+  close (loader->fds[1]);
+
+  free (loader->theme_path);
+  free (loader);
+}
+
+static Bool
+mb_wm_theme_loader_done (MBWMIOChannel   *channel,
+			 MBWMIOCondition  events,
+			 void            *userdata)
+{
+  MBWMThemeLoader * loader = userdata;
+  MBWMTheme       * theme;
+
+  pthread_join (loader->thread, NULL);
+
+  /* Returning False removes the watch */
+  loader->watch_id = 0;
+
+  theme = mb_wm_theme_construct (loader->wm, loader->desc);
+
+  loader->func (loader->wm, theme, loader->userdata);
+
+  mb_wm_theme_loader_free (loader);
+
+  return False;
+}
+#endif
+
+/*
+ * Loads a theme without blocking the main loop: the theme is located,
+ * parsed and its image decoded on a worker thread, and only the creation
+ * of the theme object (the upload of the image) happens on the main
+ * thread, just before func is called with the new theme.
+ *
+ * Returns a handle that can be passed to mb_wm_theme_load_cancel() while
+ * the load is in progress; if the theme cannot be loaded in the background,
+ * it is loaded synchronously, func is called before returning, and NULL is
+ * returned.
+ *
+ * NB: the custom theme, client and button type functions may be called
+ *     from the worker thread.
+ */
+MBWMThemeLoader *
+mb_wm_theme_load_async (MBWindowManager     *wm,
+			const char          *theme_path,
+			MBWMThemeLoadedFunc  func,
+			void                *userdata)
+{
+#ifdef HAVE_PTHREAD
+  MBWMThemeLoader * loader = mb_wm_util_malloc0 (sizeof (MBWMThemeLoader));
+
+  loader->wm         = wm;
+  loader->theme_path = theme_path ? strdup (theme_path) : NULL;
+  loader->func       = func;
+  loader->userdata   = userdata;
+
+  if (!wm->main_ctx || pipe (loader->fds))
+    {
+      free (loader->theme_path);
+      free (loader);
+      goto sync;
+    }
+
+  if (pthread_create (&loader->thread, NULL,
+		      mb_wm_theme_loader_thread, loader))
+    {
+      close (loader->fds[0]);
+      close (loader->fds[1]);
+      free (loader->theme_path);
+      free (loader);
+      goto sync;
+    }
+
+  loader->channel  = mb_wm_main_context_io_channel_new (loader->fds[0]);
+  loader->watch_id =
+    mb_wm_main_context_fd_watch_add (wm->main_ctx, loader->channel,
+#if USE_GLIB_MAINLOOP
+				     G_IO_IN,
+#else
+				     POLLIN,
+#endif
+				     mb_wm_theme_loader_done, loader);
+
+  MBWM_NOTE (MISC, "Loading theme %s in the background",
+	     theme_path ? theme_path : "(default)");
+
+  return loader;
+
+ sync:
+#endif
+  func (wm, mb_wm_theme_new (wm, theme_path), userdata);
+
+  return NULL;
+}
+
+/*
+ * Abandons a load started with mb_wm_theme_load_async(); func will not be
+ * called. Waits for the worker thread to finish.
+ */
+void
+mb_wm_theme_load_cancel (MBWMThemeLoader *loader)
+{
+#ifdef HAVE_PTHREAD
+  if (!loader)
+    return;
+
+  pthread_join (loader->thread, NULL);
+
+  if (loader->desc)
+    {
+      mb_wm_theme_xml_clients_free (loader->desc->xml_clients);
+      mb_wm_theme_cache_free (loader->desc);
+    }
+
+  mb_wm_theme_loader_free (loader);
+#endif
+}
+
+/*
+ * Returns the path the theme is being loaded from, as passed to
+ * mb_wm_theme_load_async().
+ */
+const char *
+mb_wm_theme_load_get_path (MBWMThemeLoader *loader)
+{
+#ifdef HAVE_PTHREAD
+  if (loader)
+    return loader->theme_path;
+#endif
+  return NULL;
 }
 
 MBWMDecor *
@@ -633,7 +900,7 @@ mb_wm_theme_get_client_layout_hints (MBWMTheme             * theme,
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
   if (!theme->xml_clients ||
-      !(c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)))
+      !(c = mb_wm_xml_client_lookup (theme, c_type)))
     {
       return 0;
     }
@@ -658,7 +925,7 @@ mb_wm_theme_get_client_geometry (MBWMTheme             * theme,
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
   if (!theme || !theme->xml_clients ||
-      !(c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) ||
+      !(c = mb_wm_xml_client_lookup (theme, c_type)) ||
       (c->x < 0 && c->y < 0 && c->width < 0 && c->height < 0))
     {
       return False;
@@ -686,7 +953,7 @@ mb_wm_theme_is_client_shaped (MBWMTheme             * theme,
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
   if (theme->xml_clients &&
-      (c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)))
+      (c = mb_wm_xml_client_lookup (theme, c_type)))
     {
       return c->shaped;
     }
@@ -795,6 +1062,27 @@ mb_wm_theme_use_compositing_mgr (MBWMTheme * theme)
   return theme->compositing;
 }
 
+/*
+ * Translates the engine-type name from theme.xml to the MBWMObject type
+ */
+static int
+mb_wm_theme_type_from_name (const char *name)
+{
+  if (!name)
+    return 0;
+
+  if (!strcmp (name, "default"))
+    return MB_WM_TYPE_THEME;
+#if THEME_PNG
+  else if (!strcmp (name, "png"))
+    return MB_WM_TYPE_THEME_PNG;
+#endif
+  else if (custom_theme_type_func)
+    return custom_theme_type_func (name, custom_theme_type_func_data);
+
+  return 0;
+}
+
 /*
  * Expat callback stuff
  */
@@ -879,15 +1167,10 @@ xml_element_start_cb (void *data, const char *tag, const char **expat_attr)
 	    exd->version = atoi (*(p+1));
 	  else if (!strcmp (*p, "engine-type"))
 	    {
-	      if (!strcmp (*(p+1), "default"))
-		exd->theme_type = MB_WM_TYPE_THEME;
-#if THEME_PNG
-	      else if (!strcmp (*(p+1), "png"))
-		exd->theme_type = MB_WM_TYPE_THEME_PNG;
-#endif
-	      else if (custom_theme_type_func)
-		exd->theme_type = custom_theme_type_func (*(p+1),
-						  custom_theme_type_func_data);
+	      if (exd->engine)
+		free (exd->engine);
+
+	      exd->engine = strdup (*(p+1));
 	    }
 	  else if (!strcmp (*p, "shaped"))
 	    {
@@ -1501,12 +1784,11 @@ mb_wm_theme_simple_create_decor (MBWMTheme             *theme,
   MBWMXmlClient   *c;
 
   if (MB_WM_THEME (theme)->xml_clients &&
-      (c = mb_wm_xml_client_find_by_type (MB_WM_THEME (theme)->xml_clients,
-					  c_type)))
+      (c = mb_wm_xml_client_lookup (MB_WM_THEME (theme), c_type)))
     {
       MBWMXmlDecor *d;
 
-      d = mb_wm_xml_decor_find_by_type (c->decors, type);
+      d = mb_wm_xml_decor_lookup (c, type);
 
       if (d)
 	{
@@ -1563,10 +1845,10 @@ mb_wm_theme_simple_get_button_size (MBWMTheme             *theme,
   MBWMXmlDecor  * d;
 
   /* FIXME -- assumes button on the north decor only */
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)))
     {
-      MBWMXmlButton * b = mb_wm_xml_button_find_by_type (d->buttons, type);
+      MBWMXmlButton * b = mb_wm_xml_button_lookup (d, type);
 
       if (b)
 	{
@@ -1612,10 +1894,10 @@ mb_wm_theme_simple_get_button_position (MBWMTheme             *theme,
   MBWMXmlDecor  * d;
 
   /* FIXME -- assumes button on the north decor only */
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)))
     {
-      MBWMXmlButton * b = mb_wm_xml_button_find_by_type (d->buttons, type);
+      MBWMXmlButton * b = mb_wm_xml_button_lookup (d, type);
 
       if (b)
 	{
@@ -1654,28 +1936,28 @@ mb_wm_theme_simple_get_decor_dimensions (MBWMTheme             *theme,
   MBWMXmlClient * c;
   MBWMXmlDecor  * d;
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)))
     {
       if (north)
-	if ((d = mb_wm_xml_decor_find_by_type (c->decors,MBWMDecorTypeNorth)))
+	if ((d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeNorth)))
 	  *north = d->height;
 	else
 	  *north = SIMPLE_FRAME_TITLEBAR_HEIGHT;
 
       if (south)
-	if ((d = mb_wm_xml_decor_find_by_type (c->decors,MBWMDecorTypeSouth)))
+	if ((d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeSouth)))
 	  *south = d->height;
 	else
 	  *south = SIMPLE_FRAME_EDGE_SIZE;
 
       if (west)
-	if ((d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeWest)))
+	if ((d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeWest)))
 	  *west = d->width;
 	else
 	  *west = SIMPLE_FRAME_EDGE_SIZE;
 
       if (east)
-	if ((d = mb_wm_xml_decor_find_by_type (c->decors, MBWMDecorTypeEast)))
+	if ((d = mb_wm_xml_decor_lookup (c, MBWMDecorTypeEast)))
 	  *east = d->width;
 	else
 	  *east = SIMPLE_FRAME_EDGE_SIZE;
@@ -1802,8 +2084,8 @@ mb_wm_theme_simple_paint_decor (MBWMTheme *theme, MBWMDecor *decor)
   geom   = mb_wm_decor_get_geometry (decor);
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)))
     {
       if (d->clr_fg.set)
 	{
@@ -1928,9 +2210,9 @@ mb_wm_theme_simple_paint_button (MBWMTheme *theme, MBWMDecorButton *button)
 
   c_type = MB_WM_CLIENT_CLIENT_TYPE (client);
 
-  if ((c = mb_wm_xml_client_find_by_type (theme->xml_clients, c_type)) &&
-      (d = mb_wm_xml_decor_find_by_type (c->decors, decor->type)) &&
-      (b = mb_wm_xml_button_find_by_type (d->buttons, button->type)))
+  if ((c = mb_wm_xml_client_lookup (theme, c_type)) &&
+      (d = mb_wm_xml_decor_lookup (c, decor->type)) &&
+      (b = mb_wm_xml_button_lookup (d, button->type)))
     {
       clr_fg.r = b->clr_fg.r;
       clr_fg.g = b->clr_fg.g;
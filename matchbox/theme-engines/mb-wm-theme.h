@@ -32,6 +32,11 @@
 #define MB_WM_THEME_PNG_CLASS(c) ((MBWMThemePngClass*)(c))
 #define MB_WM_TYPE_THEME_PNG (mb_wm_theme_png_class_type ())
 
+/* Number of client type bits that can be looked up directly */
+#define MBWM_XML_CLIENT_SLOTS 32
+
+typedef struct Client MBWMXmlClient;
+
 enum MBWMThemeCaps
 {
   MBWMThemeCapsFrameMainButtonActionAccept = (1<<0),
@@ -88,6 +93,7 @@ struct MBWMTheme
   MBWMThemeCaps          caps;
   char                  *path;
   MBWMList              *xml_clients;
+  MBWMXmlClient         *xml_client_index[MBWM_XML_CLIENT_SLOTS];
 
   Bool                   compositing;
   Bool                   shaped;
@@ -102,6 +108,22 @@ mb_wm_theme_class_type ();
 MBWMTheme *
 mb_wm_theme_new (MBWindowManager * wm,  const char * theme_path);
 
+typedef void (*MBWMThemeLoadedFunc) (MBWindowManager *wm,
+				     MBWMTheme       *theme,
+				     void            *userdata);
+
+MBWMThemeLoader *
+mb_wm_theme_load_async (MBWindowManager     *wm,
+			const char          *theme_path,
+			MBWMThemeLoadedFunc  func,
+			void                *userdata);
+
+void
+mb_wm_theme_load_cancel (MBWMThemeLoader *loader);
+
+const char *
+mb_wm_theme_load_get_path (MBWMThemeLoader *loader);
+
 void
 mb_wm_theme_paint_decor (MBWMTheme *theme,
 			 MBWMDecor *decor);
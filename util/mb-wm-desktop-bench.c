@@ -0,0 +1,205 @@
+/*
+ *  Matchbox Window Manager - A lightweight window manager not for the
+ *                            desktop.
+ *
+ *  Copyright (c) 2008 OpenedHand Ltd - http://o-hand.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Benchmarks desktop switching: runs the window manager on $DISPLAY, maps
+ * N_WINDOWS application windows spread over N_DESKTOPS desktops from a
+ * second connection, and then times N_SWITCHES _NET_CURRENT_DESKTOP client
+ * messages, from the message arriving until the window manager has handled
+ * all the events its own requests caused.
+ *
+ * Round trips are counted by wrapping _XReply (), which every request that
+ * waits for the server goes through. Run it on an otherwise idle server,
+ * e.g.
+ *
+ *   xvfb-run -s "-screen 0 800x600x24" ./mb-wm-desktop-bench
+ */
+
+#define _GNU_SOURCE
+
+#include "mb-wm.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define N_WINDOWS  200
+#define N_DESKTOPS 4
+#define N_SWITCHES 100
+
+static Display       *bench_dpy;
+static unsigned long  bench_round_trips;
+
+/*
+ * Counts the round trips of the window manager connection, and passes
+ * everything on to the real _XReply ().
+ */
+Status
+_XReply (Display *dpy, void *rep, int extra, Bool discard)
+{
+  static Status (*real_reply) (Display *, void *, int, Bool) = NULL;
+
+  if (!real_reply)
+    real_reply = dlsym (RTLD_NEXT, "_XReply");
+
+  if (dpy == bench_dpy)
+    bench_round_trips++;
+
+  return real_reply (dpy, rep, extra, discard);
+}
+
+/*
+ * Handles the events queued for the window manager, and those caused by its
+ * own requests while doing so, until there are no more. Returns the number
+ * of requests it made to find out, so they can be left out of the counts.
+ */
+static int
+bench_process (MBWindowManager *wm)
+{
+  int requests = 0;
+
+  while (True)
+    {
+      while (mb_wm_main_context_spin_loop (wm->main_ctx));
+
+      if (wm->sync_type)
+	mb_wm_sync (wm);
+
+      XSync (wm->xdpy, False);
+      requests++;
+
+      if (!XPending (wm->xdpy))
+	break;
+    }
+
+  return requests;
+}
+
+static void
+bench_send_desktop (MBWindowManager *wm, Display *dpy, int desktop)
+{
+  XEvent ev;
+
+  memset (&ev, 0, sizeof (ev));
+
+  ev.xclient.type         = ClientMessage;
+  ev.xclient.window       = wm->root_win->xwindow;
+  ev.xclient.message_type = XInternAtom (dpy, "_NET_CURRENT_DESKTOP", False);
+  ev.xclient.format       = 32;
+  ev.xclient.data.l[0]    = desktop;
+  ev.xclient.data.l[1]    = CurrentTime;
+
+  XSendEvent (dpy, wm->root_win->xwindow, False,
+	      SubstructureRedirectMask | SubstructureNotifyMask, &ev);
+
+  /* Make sure the message is with the window manager before we return */
+  XSync (dpy, False);
+}
+
+int
+main (int argc, char **argv)
+{
+  MBWindowManager *wm;
+  Display         *dpy;
+  struct timeval   start, end;
+  unsigned long    round_trips = 0, requests = 0;
+  double           usecs = 0, worst = 0;
+  int              i, d;
+
+  if ((dpy = XOpenDisplay (NULL)) == NULL)
+    {
+      fprintf (stderr, "Cannot open display\n");
+      return 1;
+    }
+
+  mb_wm_object_init ();
+
+  wm = mb_wm_new (argc, argv);
+  mb_wm_init (wm);
+
+  bench_dpy = wm->xdpy;
+
+  mb_wm_set_n_desktops (wm, N_DESKTOPS);
+  bench_process (wm);
+
+  /* New windows go on the active desktop, so fill them one at a time */
+  for (d = 0; d < N_DESKTOPS; d++)
+    {
+      bench_send_desktop (wm, dpy, d);
+      bench_process (wm);
+
+      for (i = 0; i < N_WINDOWS / N_DESKTOPS; i++)
+	{
+	  Window win;
+
+	  win = XCreateSimpleWindow (dpy, wm->root_win->xwindow,
+				     0, 0, 100, 100, 0,
+				     BlackPixel (dpy, DefaultScreen (dpy)),
+				     WhitePixel (dpy, DefaultScreen (dpy)));
+	  XMapWindow (dpy, win);
+	}
+
+      XSync (dpy, False);
+      bench_process (wm);
+
+      printf ("desktop %d: %d clients\n", d,
+	      mb_wm_util_list_length ((MBWMList *)
+				      mb_wm_get_desktop_clients (wm, d)));
+    }
+
+  for (i = 0; i < N_SWITCHES; i++)
+    {
+      unsigned long first_request;
+      double        t;
+      int           own;
+
+      bench_send_desktop (wm, dpy, i % N_DESKTOPS);
+
+      bench_round_trips = 0;
+      first_request     = XNextRequest (wm->xdpy);
+
+      gettimeofday (&start, NULL);
+      own = bench_process (wm);
+      gettimeofday (&end, NULL);
+
+      /* Leave out the XSync ()s of bench_process () */
+      round_trips += bench_round_trips - own;
+      requests    += XNextRequest (wm->xdpy) - first_request - own;
+
+      t = (end.tv_sec - start.tv_sec) * 1000000.0 +
+	(end.tv_usec - start.tv_usec);
+
+      usecs += t;
+
+      if (t > worst)
+	worst = t;
+    }
+
+  printf ("%d windows on %d desktops, %d switches\n",
+	  N_WINDOWS, N_DESKTOPS, N_SWITCHES);
+  printf ("  %.1f round trips, %.1f requests per switch\n",
+	  (double) round_trips / N_SWITCHES, (double) requests / N_SWITCHES);
+  printf ("  %.0f us per switch on average, %.0f us worst\n",
+	  usecs / N_SWITCHES, worst);
+
+  XCloseDisplay (dpy);
+
+  return 0;
+}